@@ -12,11 +12,22 @@
 #include <bluetooth/gatt.h>
 #include <sys/byteorder.h>
 #include <drivers/gpio.h>
+#include <sys/atomic.h>
+#include <shell/shell.h>
 #include <stdio.h>
+#include <string.h>
 
 // #include <toolchain.h>
 #include <logging/log.h>
 #include "base_ble.h"
+#include "base_output.h"
+#include "base_stats.h"
+#include "base_fusion.h"
+#include "base_locate.h"
+#include "base_bulk.h"
+#if defined(CONFIG_BASE_SCAN_FILTER)
+#include "node_filter_peers.h"
+#endif
 
 LOG_MODULE_REGISTER(ble_module, LOG_LEVEL_DBG);
 
@@ -36,8 +47,59 @@ static const struct gpio_dt_spec led = GPIO_DT_SPEC_GET(LED0_NODE, gpios);
 struct advert_user_data  {
     int8_t rssi;
     bt_addr_le_t *addr;
+    bool useful; /* set when the advert was from a node */
 };
 
+/**
+ * @brief Scan callback counters.
+ */
+struct scan_stats {
+    uint32_t callbacks; /* adverts passed up by the controller */
+    uint32_t useful; /* adverts from a node that were printed */
+    uint32_t dropped; /* reports lost because the output queue was full */
+    uint32_t mismatched; /* adverts dropped for reporting another number of beacons */
+};
+
+static struct scan_stats scan_stats;
+
+K_MSGQ_DEFINE(report_msgq, sizeof(struct base_report), CONFIG_BASE_REPORT_QUEUE_SIZE, 4);
+
+#if defined(CONFIG_BASE_SCAN_FILTER)
+/* scan passively for provisioned nodes only, nothing we listen for has scan response data */
+#define SCAN_TYPE BT_LE_SCAN_TYPE_PASSIVE
+#define SCAN_OPT_FILTER BT_LE_SCAN_OPT_FILTER_ACCEPT_LIST
+
+/* set when the controller filter accept list no longer matches the peers, which
+ * are kept and stored in settings by node_filter_peers as on the nodes */
+static atomic_t filter_dirty = ATOMIC_INIT(1);
+#else
+#define SCAN_TYPE BT_LE_SCAN_TYPE_ACTIVE
+#define SCAN_OPT_FILTER BT_LE_SCAN_OPT_NONE
+#endif
+
+#if defined(CONFIG_BASE_SCAN_CONTINUOUS)
+/* scan all the time, every advert from a node is a new report so duplicates are not filtered */
+#define SCAN_OPT_DUPLICATE BT_LE_SCAN_OPT_NONE
+#define SCAN_WINDOW BT_GAP_SCAN_FAST_INTERVAL
+#else
+/* the scan is restarted every BASE_SCAN_RESTART_MS to clear the duplicate filter */
+#define SCAN_OPT_DUPLICATE BT_LE_SCAN_OPT_FILTER_DUPLICATE
+#define SCAN_WINDOW BT_GAP_SCAN_FAST_WINDOW
+#endif
+
+/* static nodes relaying long range are only heard on the coded phy */
+#if defined(CONFIG_BASE_SCAN_CODED)
+#define SCAN_OPT_CODED BT_LE_SCAN_OPT_CODED
+#else
+#define SCAN_OPT_CODED BT_LE_SCAN_OPT_NONE
+#endif
+
+#define SCAN_PARAM BT_LE_SCAN_PARAM(SCAN_TYPE, SCAN_OPT_FILTER | SCAN_OPT_DUPLICATE | SCAN_OPT_CODED, \
+        BT_GAP_SCAN_FAST_INTERVAL, SCAN_WINDOW)
+
+/* given to restart a continuous scan, so a changed scan filter is applied */
+K_SEM_DEFINE(scan_restart_sem, 0, 1);
+
 
 void led_init() {
      int retr, retg, retb;
@@ -63,6 +125,286 @@ void led_init() {
 
 
 
+/**
+ * @brief Formats the beacons of a mobile report as json fields
+ *          "b1":"<id>","b1r":<rssi>, ... for each reported beacon.
+ * 
+ * @param buf Buffer to format into
+ * @param len Length of the buffer
+ * @param mad Mobile report
+ */
+static void format_beacons(char *buf, size_t len, const struct mobile_ad *mad)
+{
+    int pos = 0;
+
+    buf[0] = '\0';
+    for (int i = 0; i < BEACONS && pos < len; i++) {
+        char id[sizeof("\\u0000")] = {mad->beacons[i].id, '\0'};
+
+        // an empty place has id 0, which has to be escaped
+        if (mad->beacons[i].id == 0) {
+            strcpy(id, "\\u0000");
+        }
+        pos += snprintf(&buf[pos], len - pos, "\"b%d\":\"%s\",\"b%dr\":%d,",
+                i + 1, id, i + 1, mad->beacons[i].rssi);
+    }
+}
+
+// longest beacon fields of one report
+#define BEACONS_JSON_LEN (BEACONS * sizeof("\"b1\":\"\\u0000\",\"b1r\":-128,"))
+
+/**
+ * @brief Formats an rssi for json, null if there is none.
+ */
+static void format_rssi(char *buf, size_t len, int8_t rssi)
+{
+    if (rssi == RSSI_NONE) {
+        snprintf(buf, len, "null");
+    } else {
+        snprintf(buf, len, "%d", rssi);
+    }
+}
+
+/**
+ * @brief Prints a report as a json line. Relayed reports carry the rssi
+ *          the static node heard the mobile node with as static_rssi.
+ * 
+ * @param report Report received directly from a mobile node, or relayed
+ *          by a static node
+ */
+static void print_report(const struct base_report *report)
+{
+    char beacons[BEACONS_JSON_LEN];
+
+    if (report->type == STATIC_ADV_TYPE) {
+        const struct static_ad *sad = &report->sad;
+        char static_rssi[sizeof("-128")];
+
+        format_beacons(beacons, sizeof(beacons), &sad->m_ad);
+        format_rssi(static_rssi, sizeof(static_rssi), sad->rssi);
+        LOG_PRINTK("{\"static_id\":%d, \"rssi\":%d, \"static_rssi\":%s, \"ttl\":%d, \"hops\":%d, \"mobile_id\":%d, \"seq\":%d, %s\"steps\":%u,\"heading\":%d,\"uptime\":%d}\n", sad->static_id, report->rssi, static_rssi, sad->ttl,
+                RELAY_HOPS(sad->ttl), sad->m_ad.m_id, sad->m_ad.seq, beacons, sad->m_ad.steps, sad->m_ad.heading, report->uptime);
+    } else {
+        const struct mobile_ad *mad = &report->mad;
+
+        format_beacons(beacons, sizeof(beacons), mad);
+        LOG_PRINTK("{\"mobile_id\":%d, \"rssi\":%d, \"seq\":%d, %s\"steps\":%u,\"heading\":%d,\"uptime\":%d}\n",
+                mad->m_id, report->rssi, mad->seq, beacons, mad->steps, mad->heading, report->uptime);
+    }
+}
+
+// longest static node fields of one fused report
+#define STATICS_JSON_LEN (CONFIG_BASE_FUSION_STATICS * \
+        sizeof("{\"static_id\":-128,\"rssi\":-128,\"ttl\":-128,\"static_rssi\":-128},"))
+
+/**
+ * @brief Prints a report merged from all the copies received within the
+ *          fusion window as a json line, listing the static nodes that
+ *          relayed it. rssi is null if it was not heard directly, and
+ *          static_rssi if the static node did not hear it directly.
+ * 
+ * @param fused Merged report
+ */
+static void print_fused(const struct fused_report *fused)
+{
+    char beacons[BEACONS_JSON_LEN];
+    char statics[STATICS_JSON_LEN + 1];
+    char rssi[sizeof("-128")];
+    int pos = 0;
+
+    format_beacons(beacons, sizeof(beacons), &fused->mad);
+    statics[0] = '\0';
+    for (int i = 0; i < fused->count && pos < sizeof(statics); i++) {
+        const struct fused_static *fs = &fused->statics[i];
+
+        format_rssi(rssi, sizeof(rssi), fs->static_rssi);
+        pos += snprintf(&statics[pos], sizeof(statics) - pos,
+                "%s{\"static_id\":%d,\"rssi\":%d,\"ttl\":%d,\"static_rssi\":%s}",
+                i ? "," : "", fs->static_id, fs->rssi, fs->ttl, rssi);
+    }
+    format_rssi(rssi, sizeof(rssi), fused->rssi);
+
+    LOG_PRINTK("{\"mobile_id\":%d, \"rssi\":%s, \"seq\":%d, \"statics\":[%s], %s\"steps\":%u,\"heading\":%d,\"uptime\":%d}\n",
+            fused->mad.m_id, rssi, fused->mad.seq, statics, beacons, fused->mad.steps, fused->mad.heading,
+            fused->uptime);
+}
+
+/**
+ * @brief Formats a coordinate for json, null if it is unknown.
+ */
+static void format_coord(char *buf, size_t len, int16_t coord)
+{
+    if (coord == LOCATE_UNKNOWN) {
+        snprintf(buf, len, "null");
+    } else {
+        snprintf(buf, len, "%d", coord);
+    }
+}
+
+/**
+ * @brief Prints the position estimated from a report as a json line,
+ *          coordinates in cm.
+ * 
+ * @param mad Report the position was estimated from
+ * @param uptime Uptime (ms) the report was received at
+ * @param pos Estimated position
+ */
+static void print_position(const struct mobile_ad *mad, uint32_t uptime, const struct locate_position *pos)
+{
+    char beacons[BEACONS_JSON_LEN];
+    char coords[4][sizeof("-32768")];
+
+    format_beacons(beacons, sizeof(beacons), mad);
+    format_coord(coords[0], sizeof(coords[0]), pos->x);
+    format_coord(coords[1], sizeof(coords[1]), pos->y);
+    format_coord(coords[2], sizeof(coords[2]), pos->zone_x);
+    format_coord(coords[3], sizeof(coords[3]), pos->zone_y);
+
+    LOG_PRINTK("{\"mobile_id\":%d, \"seq\":%d, \"x\":%s, \"y\":%s, \"anchors\":%d, \"zone\":%d, \"zone_x\":%s, \"zone_y\":%s, %s\"steps\":%u,\"heading\":%d,\"uptime\":%d}\n",
+            mad->m_id, mad->seq, coords[0], coords[1], pos->anchors, pos->zone, coords[2], coords[3], beacons,
+            mad->steps, mad->heading, uptime);
+}
+
+/**
+ * @brief Prints a contact episode as a json line, dated from when it
+ *          started. rssi is the strongest the mobile node heard the
+ *          other one with.
+ * 
+ * @param report Contact episode received
+ */
+static void print_contact(const struct base_report *report)
+{
+    const struct contact_ad *cad = &report->cad;
+
+    LOG_PRINTK("{\"mobile_id\":%d, \"contact_id\":%d, \"episode\":%d, \"rssi\":%d, \"dwell\":%u,\"uptime\":%d}\n",
+            cad->m_id, cad->contact_id, cad->episode, cad->rssi, cad->dwell, report->uptime);
+}
+
+/**
+ * @brief Writes a contact episode to the host.
+ */
+static void emit_contact(const struct base_report *report)
+{
+    if (IS_ENABLED(CONFIG_BASE_OUTPUT_BINARY)) {
+        output_write_contact(report);
+    } else {
+        print_contact(report);
+    }
+}
+
+/**
+ * @brief Estimates the position of a mobile node from a report and the
+ *          static nodes that heard it, and writes it to the host in
+ *          place of the report.
+ */
+static void emit_position(const struct mobile_ad *mad, const struct locate_static *statics, int count,
+        uint32_t uptime)
+{
+    struct locate_position pos;
+
+    locate_mobile(mad, statics, count, &pos);
+    if (IS_ENABLED(CONFIG_BASE_OUTPUT_BINARY)) {
+        output_write_position(mad, uptime, &pos);
+    } else {
+        print_position(mad, uptime, &pos);
+    }
+}
+
+/**
+ * @brief Writes a report leaving the fusion window to the host.
+ */
+static void emit_fused(const struct fused_report *fused)
+{
+    if (IS_ENABLED(CONFIG_BASE_LOCATE)) {
+        struct locate_static statics[LOCATE_STATICS];
+        int count = 0;
+
+        for (int i = 0; i < fused->count && count < LOCATE_STATICS; i++) {
+            if (fused->statics[i].static_rssi != RSSI_NONE) {
+                statics[count].static_id = fused->statics[i].static_id;
+                statics[count].rssi = fused->statics[i].static_rssi;
+                count++;
+            }
+        }
+        emit_position(&fused->mad, statics, count, fused->uptime);
+    } else if (IS_ENABLED(CONFIG_BASE_OUTPUT_BINARY)) {
+        output_write_fused(fused);
+    } else {
+        print_fused(fused);
+    }
+}
+
+/**
+ * @brief Queues a report for the output thread, so no formatting is
+ *          done in the scan callback.
+ * 
+ * @param type MOBILE_ADV_TYPE, STATIC_ADV_TYPE or CONTACT_ADV_TYPE
+ * @param rssi RSSI the report was received with
+ * @param ad Report, a struct mobile_ad, struct static_ad or struct contact_ad
+ * @param age Time (ms) since the report was made, 0 unless it was stored.
+ *          A report older than the base's uptime is dated at 0.
+ * @param agg Aggregated frame the report was relayed in, or NULL
+ */
+static void queue_report(uint8_t type, int8_t rssi, const void *ad, uint32_t age, const struct agg_ad *agg)
+{
+    uint32_t now = k_uptime_get_32();
+    struct base_report report = {
+        .type = type,
+        .rssi = rssi,
+        .uptime = age >= now ? 0 : now - age,
+        .framed = agg != NULL
+    };
+
+    if (type == STATIC_ADV_TYPE) {
+        memcpy(&report.sad, ad, sizeof(report.sad));
+    } else if (type == CONTACT_ADV_TYPE) {
+        memcpy(&report.cad, ad, sizeof(report.cad));
+    } else {
+        memcpy(&report.mad, ad, sizeof(report.mad));
+    }
+    if (agg != NULL) {
+        report.frame.static_id = agg->static_id;
+        report.frame.hops = agg->hops;
+        report.frame.seq = agg->seq;
+    }
+
+    if (k_msgq_put(&report_msgq, &report, K_NO_WAIT) != 0) {
+        scan_stats.dropped++;
+    }
+}
+
+
+/**
+ * @brief Queues a report a mobile node stored while out of range, dated
+ *          back by its age. A report stored before the mobile node
+ *          rebooted has no known time, and is not counted or fused.
+ */
+static void queue_history_report(int8_t rssi, const struct history_report *report)
+{
+    struct base_report rebooted = {
+        .type = MOBILE_ADV_TYPE,
+        .rssi = rssi,
+        .uptime = 0,
+        .rebooted = true,
+        .mad = report->m_ad
+    };
+
+    if (report->age != HISTORY_AGE_UNKNOWN) {
+        queue_report(MOBILE_ADV_TYPE, rssi, &report->m_ad, report->age * 100, NULL);
+    } else if (k_msgq_put(&report_msgq, &rebooted, K_NO_WAIT) != 0) {
+        scan_stats.dropped++;
+    }
+}
+
+/**
+ * @brief Queues a report uploaded over a bulk connection. There is no
+ *          rssi to report.
+ */
+static void queue_bulk_report(const struct history_report *report)
+{
+    queue_history_report(RSSI_NONE, report);
+}
+
 /**
  * @brief Callback for BLE scanning, checks weather the returned 
  *          UUID matches the custom UUID of the mobile device.
@@ -80,26 +422,76 @@ static bool parse_device(struct bt_data *data, void *user_data)
     
     struct advert_user_data *adv_user_dat = user_data;
     
+    // reports are dropped unless they have BEACONS beacons, a node built with
+    // another number sends adverts of another size
+    if ((data->type == STATIC_ADV_TYPE && data->data_len != sizeof(struct static_ad)) ||
+            (data->type == MOBILE_ADV_TYPE && data->data_len != sizeof(struct mobile_ad))) {
+        scan_stats.mismatched++;
+        return false;
+    }
+
     if (data->type == STATIC_ADV_TYPE)
     {
         // LOG_INF("mobile adv found, rssi: %d", adv_user_dat->rssi);
-        struct static_ad sad;
-        memcpy(&sad, data->data, sizeof(sad));
-        LOG_PRINTK("{\"static_id\":%d, \"rssi\":%d, \"ttl\":%d, \"mobile_id\":%d, \"b1\":\"%c\",\"b1r\":%d,\"b2\":\"%c\",\"b2r\":%d,\"b3\":\"%c\",\"b3r\":%d,\"speed\":%d,\"direction\":%d,\"uptime\":%d}\n", sad.static_id, adv_user_dat->rssi, sad.ttl,
-                sad.m_ad.m_id, sad.m_ad.b1_id, sad.m_ad.b1_rssi, 
-                sad.m_ad.b2_id, sad.m_ad.b2_rssi,
-                sad.m_ad.b3_id, sad.m_ad.b3_rssi, sad.m_ad.speed, sad.m_ad.direction, k_uptime_get_32());
+        queue_report(STATIC_ADV_TYPE, adv_user_dat->rssi, data->data, 0, NULL);
+        adv_user_dat->useful = true;
         return false;
         
     }
 
+    if (data->type == AGG_ADV_TYPE && data->data_len >= sizeof(struct agg_ad)) {
+        const struct agg_ad *agg = (const struct agg_ad *) data->data;
+        uint8_t count = (data->data_len - sizeof(struct agg_ad)) / sizeof(struct static_ad);
+
+        if (agg->beacons != BEACONS || (data->data_len - sizeof(struct agg_ad)) % sizeof(struct static_ad) != 0) {
+            scan_stats.mismatched++;
+            return false;
+        }
+
+        for (int i = 0; i < count; i++) {
+            queue_report(STATIC_ADV_TYPE, adv_user_dat->rssi, &agg->reports[i], 0, agg);
+        }
+        adv_user_dat->useful = true;
+        return false;
+    }
+
+    // a mobile node with stored reports to upload, flagged ahead of its report
+    if (data->type == BULK_ADV_TYPE) {
+        if (IS_ENABLED(CONFIG_BASE_BULK) && bulk_request(adv_user_dat->addr)) {
+            k_sem_give(&scan_restart_sem);
+        }
+        return true;
+    }
+
+    // a contact episode the mobile node had, dated back to when it started, ahead
+    // of its report
+    if (data->type == CONTACT_ADV_TYPE && data->data_len >= sizeof(struct contact_ad)) {
+        const struct contact_ad *cad = (const struct contact_ad *) data->data;
+
+        queue_report(CONTACT_ADV_TYPE, adv_user_dat->rssi, cad, cad->start * 1000, NULL);
+        adv_user_dat->useful = true;
+        return true;
+    }
+
     if (data->type == MOBILE_ADV_TYPE) {
-        struct mobile_ad mad;
-        memcpy(&mad, data->data, sizeof(mad));
-        LOG_PRINTK("{\"mobile_id\":%d, \"rssi\":%d, \"b1\":\"%c\",\"b1r\":%d,\"b2\":\"%c\",\"b2r\":%d,\"b3\":\"%c\",\"b3r\":%d,\"speed\":%d,\"direction\":%d,\"uptime\":%d}\n",
-                mad.m_id, adv_user_dat->rssi, mad.b1_id, mad.b1_rssi, 
-                mad.b2_id, mad.b2_rssi,
-                mad.b3_id, mad.b3_rssi, mad.speed,mad.direction,k_uptime_get_32());
+        queue_report(MOBILE_ADV_TYPE, adv_user_dat->rssi, data->data, 0, NULL);
+        adv_user_dat->useful = true;
+        return false;
+    }
+
+    // reports a mobile node stored while out of range, dated back by their age
+    if (data->type == HISTORY_ADV_TYPE && data->data_len >= sizeof(struct history_ad)) {
+        const struct history_ad *h_ad = (const struct history_ad *) data->data;
+        uint8_t count = h_ad->count;
+
+        if (data->data_len != sizeof(struct history_ad) + count * sizeof(struct history_report)) {
+            scan_stats.mismatched++;
+            return false;
+        }
+        for (int i = 0; i < count; i++) {
+            queue_history_report(adv_user_dat->rssi, &h_ad->reports[i]);
+        }
+        adv_user_dat->useful = true;
         return false;
     }
     return true;
@@ -124,11 +516,55 @@ static void device_found(const bt_addr_le_t *addr, int8_t rssi, uint8_t type,
     // bt_data_parse(ad, parse_device, (void *)addr);
     struct advert_user_data user_data = {
         .rssi = rssi,
-        .addr = addr
+        .addr = addr,
+        .useful = false
     };
+
+    scan_stats.callbacks++;
     bt_data_parse(ad, parse_device, &user_data);
+    if (user_data.useful) {
+        scan_stats.useful++;
+    }
+
+}
+
+#if defined(CONFIG_BASE_SCAN_FILTER)
+/**
+ * @brief Adds a provisioned node to the controller filter accept list.
+ */
+static void scan_filter_add(const bt_addr_le_t *addr, void *user_data)
+{
+    int err = bt_le_filter_accept_list_add(addr);
+
+    if (err) {
+        LOG_ERR("Scan filter add failed (err %d)", err);
+    }
+}
 
+/**
+ * @brief Reloads the filter accept list with the provisioned nodes
+ *          if they changed. Must be called while not scanning.
+ */
+static void scan_filter_apply(void)
+{
+    if (!atomic_cas(&filter_dirty, 1, 0)) {
+        return;
+    }
+
+    bt_le_filter_accept_list_clear();
+    filter_peers_foreach(scan_filter_add, NULL);
+}
+
+/**
+ * @brief Called when the provisioned nodes change, restarting the scan
+ *          so the new filter is applied.
+ */
+static void scan_filter_changed(void)
+{
+    atomic_set(&filter_dirty, 1);
+    k_sem_give(&scan_restart_sem);
 }
+#endif
 
 /**
  * @brief Starts passive BLE scanning for nearby
@@ -138,7 +574,10 @@ static void start_scan(void)
 {
     int err;
 
-    err = bt_le_scan_start(BT_LE_SCAN_ACTIVE, device_found);
+#if defined(CONFIG_BASE_SCAN_FILTER)
+    scan_filter_apply();
+#endif
+    err = bt_le_scan_start(SCAN_PARAM, device_found);
     if (err)
     {
         LOG_ERR("Scanning failed to start (err %d)\n", err);
@@ -150,6 +589,93 @@ static void start_scan(void)
 
 
 
+static void beacon_update(struct k_work *work);
+
+K_WORK_DELAYABLE_DEFINE(beacon_work, beacon_update);
+
+static const uint8_t beacon_flags = BT_LE_AD_GENERAL | BT_LE_AD_NO_BREDR;
+
+/* the beacon is sent as a legacy advert from its own advertising set, one
+ * advertising event at a time */
+static struct bt_le_ext_adv *beacon_adv;
+
+/**
+ * @brief Gets the gradient and time sync beacon advertising data,
+ *          stamped with the current network time.
+ */
+static int beacon_data(struct bt_data *data_ad, struct base_ad *bad)
+{
+    int64_t now = k_uptime_get();
+
+    bad->hops = 0;
+    bad->net_time = (uint32_t) now;
+    bad->net_epoch = now >> 32;
+
+    data_ad[0] = (struct bt_data) BT_DATA(BT_DATA_FLAGS, &beacon_flags, sizeof(beacon_flags));
+    data_ad[1] = (struct bt_data) BT_DATA(BASE_ADV_TYPE, bad, sizeof(*bad));
+    return 2;
+}
+
+/**
+ * @brief Restamps the beacon with the network time and sends it in
+ *          a single advertising event, so every copy on air is only
+ *          as late as the controller takes to send it.
+ */
+static void beacon_update(struct k_work *work)
+{
+    int err;
+    struct bt_data data_ad[2];
+    struct base_ad bad;
+    int len = beacon_data(data_ad, &bad);
+
+    err = bt_le_ext_adv_set_data(beacon_adv, data_ad, len, NULL, 0);
+    if (!err)
+    {
+        err = bt_le_ext_adv_start(beacon_adv, BT_LE_EXT_ADV_START_PARAM(0, 1));
+    }
+    if (err)
+    {
+        LOG_ERR("Beacon failed to send (err %d)\n", err);
+        k_work_schedule(&beacon_work, K_MSEC(CONFIG_BASE_BEACON_INTERVAL_MS));
+    }
+}
+
+/**
+ * @brief Called once the beacon advertising event is over, schedules
+ *          the next one.
+ */
+static void beacon_sent(struct bt_le_ext_adv *adv, struct bt_le_ext_adv_sent_info *info)
+{
+    k_work_schedule(&beacon_work, K_MSEC(CONFIG_BASE_BEACON_INTERVAL_MS));
+}
+
+static const struct bt_le_ext_adv_cb beacon_cb = {
+    .sent = beacon_sent,
+};
+
+/**
+ * @brief Starts advertising the gradient and time sync beacon static
+ *          nodes use to learn their hop count to the base and
+ *          all nodes use to synchronise their slot schedule.
+ */
+static void start_beacon(void)
+{
+    int err;
+    /* advertising intervals are in units of 0.625 ms */
+    uint16_t interval = CONFIG_BASE_BEACON_INTERVAL_MS * 8 / 5;
+
+    err = bt_le_ext_adv_create(BT_LE_ADV_PARAM(BT_LE_ADV_OPT_NONE, interval, interval, NULL),
+            &beacon_cb, &beacon_adv);
+    if (err)
+    {
+        LOG_ERR("Beacon failed to start (err %d)\n", err);
+        return;
+    }
+
+    beacon_update(NULL);
+}
+
+
 /**
  * @brief BLE Base entry thread, starts initial ble scanning.
  *          When a valid mobile device is connected.
@@ -182,13 +708,28 @@ void thread_ble_base(void)
 
     LOG_INF("Bluetooth initialized\n");
 
+#if defined(CONFIG_BASE_SCAN_FILTER)
+    filter_peers_init(CONFIG_BASE_SCAN_FILTER_DEFAULTS, scan_filter_changed);
+#endif
+    start_beacon();
+    if (IS_ENABLED(CONFIG_BASE_BULK)) {
+        bulk_init(queue_bulk_report);
+    }
+
     
   
     while (1) {
         start_scan();
-        k_msleep(300);
+#if defined(CONFIG_BASE_SCAN_CONTINUOUS)
+        k_sem_take(&scan_restart_sem, K_FOREVER);
+#else
+        k_msleep(CONFIG_BASE_SCAN_RESTART_MS);
+#endif
         bt_le_scan_stop();
-        
+        // connecting to a node flagging bulk data needs the scanner
+        if (IS_ENABLED(CONFIG_BASE_BULK)) {
+            bulk_connect();
+        }
     }
 
     
@@ -197,4 +738,166 @@ void thread_ble_base(void)
     // LOG_INF("Debug_1\n");
 }
 
+/**
+ * @brief BLE json output thread, prints the reports queued by the
+ *          scan callback at a lower priority than the bt threads,
+ *          or writes them as binary records in binary output mode.
+ *          With fusion, the copies of each report are merged first.
+ */
+void thread_ble_json_output(void)
+{
+    struct base_report report;
+
+    if (IS_ENABLED(CONFIG_BASE_OUTPUT_BINARY) && output_init() != 0) {
+        LOG_ERR("Binary output init failed\n");
+        return;
+    }
+
+    while (1) {
+        // with fusion, wake up for the next fusion window to close
+        k_timeout_t timeout = IS_ENABLED(CONFIG_BASE_FUSION) ? fusion_next_timeout() : K_FOREVER;
+
+        if (k_msgq_get(&report_msgq, &report, timeout) == 0) {
+            if (report.type == CONTACT_ADV_TYPE) {
+                // each episode is advertised several times, only the first copy is written
+                if (stats_contact(&report)) {
+                    emit_contact(&report);
+                }
+            } else if (report.rebooted) {
+                // its seq cannot be told apart from the reports made since
+                if (IS_ENABLED(CONFIG_BASE_OUTPUT_BINARY)) {
+                    output_write_report(&report);
+                } else {
+                    print_report(&report);
+                }
+            } else {
+                stats_report(&report);
+                if (IS_ENABLED(CONFIG_BASE_FUSION)) {
+                    fusion_add(&report, emit_fused);
+                } else if (IS_ENABLED(CONFIG_BASE_LOCATE) && report.type == STATIC_ADV_TYPE) {
+                    struct locate_static relay = {.static_id = report.sad.static_id, .rssi = report.sad.rssi};
+
+                    emit_position(&report.sad.m_ad, &relay, relay.rssi != RSSI_NONE, report.uptime);
+                } else if (IS_ENABLED(CONFIG_BASE_LOCATE)) {
+                    emit_position(&report.mad, NULL, 0, report.uptime);
+                } else if (IS_ENABLED(CONFIG_BASE_OUTPUT_BINARY)) {
+                    output_write_report(&report);
+                } else {
+                    print_report(&report);
+                }
+            }
+        }
+
+        if (IS_ENABLED(CONFIG_BASE_FUSION)) {
+            fusion_flush(emit_fused);
+        }
+    }
+}
+
+#if defined(CONFIG_SHELL)
+#if defined(CONFIG_BASE_SCAN_FILTER)
+/**
+ * @brief Shell command to let a node through the scan filter:
+ *          base allow <addr> <public|random>
+ */
+static int cmd_base_allow(const struct shell *shell, size_t argc, char **argv)
+{
+    bt_addr_le_t addr;
+    int err = bt_addr_le_from_str(argv[1], argv[2], &addr);
+
+    if (err) {
+        shell_error(shell, "invalid address");
+        return err;
+    }
+
+    err = filter_peers_add(&addr);
+    if (err == -ENOMEM) {
+        shell_error(shell, "scan filter full");
+    } else if (err) {
+        shell_error(shell, "failed to store node (%d)", err);
+    }
+    return err;
+}
+
+/**
+ * @brief Shell command to remove a node from the scan filter:
+ *          base deny <addr> <public|random>
+ */
+static int cmd_base_deny(const struct shell *shell, size_t argc, char **argv)
+{
+    bt_addr_le_t addr;
+    int err = bt_addr_le_from_str(argv[1], argv[2], &addr);
+
+    if (err) {
+        shell_error(shell, "invalid address");
+        return err;
+    }
+
+    err = filter_peers_remove(&addr);
+    if (err == -ENOENT) {
+        shell_error(shell, "node not in scan filter");
+    } else if (err) {
+        shell_error(shell, "failed to store removal (%d)", err);
+    }
+    return err;
+}
+
+/**
+ * @brief Prints a node let through the scan filter.
+ */
+static void print_peer(const bt_addr_le_t *addr, void *user_data)
+{
+    char str[BT_ADDR_LE_STR_LEN];
+
+    bt_addr_le_to_str(addr, str, sizeof(str));
+    shell_print((const struct shell *) user_data, "%s", str);
+}
+
+/**
+ * @brief Shell command to list the nodes let through the scan filter.
+ */
+static int cmd_base_peers(const struct shell *shell, size_t argc, char **argv)
+{
+    filter_peers_foreach(print_peer, (void *) shell);
+    return 0;
+}
+#endif
+
+/**
+ * @brief Shell command to print the scan counters.
+ */
+static int cmd_base_stats(const struct shell *shell, size_t argc, char **argv)
+{
+    shell_print(shell, "callbacks %u useful %u dropped %u mismatched %u", scan_stats.callbacks,
+            scan_stats.useful, scan_stats.dropped, scan_stats.mismatched);
+    if (IS_ENABLED(CONFIG_BASE_OUTPUT_BINARY)) {
+        shell_print(shell, "binary frames %u dropped %u", output_stats.frames, output_stats.dropped);
+    }
+    if (IS_ENABLED(CONFIG_BASE_BULK)) {
+        bulk_print(shell);
+    }
+    stats_print(shell);
+    return 0;
+}
+
+/**
+ * @brief Shell command to clear the scan and per node counters.
+ */
+static int cmd_base_reset(const struct shell *shell, size_t argc, char **argv)
+{
+    memset(&scan_stats, 0, sizeof(scan_stats));
+    stats_reset();
+    return 0;
+}
 
+SHELL_STATIC_SUBCMD_SET_CREATE(base_cmds,
+    SHELL_COND_CMD_ARG(CONFIG_BASE_SCAN_FILTER, allow, NULL, "<addr> <public|random>", cmd_base_allow, 3, 0),
+    SHELL_COND_CMD_ARG(CONFIG_BASE_SCAN_FILTER, deny, NULL, "<addr> <public|random>", cmd_base_deny, 3, 0),
+    SHELL_COND_CMD(CONFIG_BASE_SCAN_FILTER, peers, NULL, "list nodes let through the scan filter", cmd_base_peers),
+    SHELL_CMD(stats, NULL, "scan and per node counters", cmd_base_stats),
+    SHELL_CMD(reset, NULL, "clear the counters", cmd_base_reset),
+    SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(base, &base_cmds, "base station", NULL);
+#endif
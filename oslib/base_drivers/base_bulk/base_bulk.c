@@ -0,0 +1,257 @@
+/**
+ *
+ * Opportunistic gatt bulk upload module for project athena-green CSSE4011
+ *
+ * Copyright Haoxi Tan & Geordie Pearson 2022
+ */
+
+#include <zephyr.h>
+#include <string.h>
+#include <sys/atomic.h>
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/hci.h>
+#include <bluetooth/conn.h>
+#include <bluetooth/uuid.h>
+#include <bluetooth/gatt.h>
+#include <logging/log.h>
+
+#include "base_bulk.h"
+
+LOG_MODULE_REGISTER(bulk_module, LOG_LEVEL_DBG);
+
+/* upload states */
+#define BULK_IDLE 0
+#define BULK_REQUESTED 1
+#define BULK_CONNECTING 2
+#define BULK_CONNECTED 3
+
+/* 15 ms connection interval, short for throughput but leaving time to scan */
+#define BULK_CONN_PARAM BT_LE_CONN_PARAM(12, 12, 0, 400)
+
+struct bulk_stats bulk_stats;
+
+static struct bt_uuid_128 bulk_data_uuid = BT_UUID_INIT_128(BULK_DATA_UUID_VAL);
+
+static bulk_report_t bulk_report;
+static atomic_t bulk_state = ATOMIC_INIT(BULK_IDLE);
+static bt_addr_le_t bulk_addr;
+static struct bt_conn *bulk_conn;
+
+/* uptime (ms) the last upload ended, so a node still flagging is not reconnected at once */
+static uint32_t bulk_ended;
+
+/* bytes received and when, for the goodput of the current upload */
+static uint32_t upload_bytes;
+static uint32_t upload_start;
+static uint32_t upload_last;
+
+K_SEM_DEFINE(bulk_connected_sem, 0, 1);
+
+static struct bt_gatt_exchange_params mtu_params;
+static struct bt_gatt_discover_params discover_params;
+static struct bt_gatt_subscribe_params subscribe_params;
+
+/**
+ * @brief Frees the connection and lets the next node be requested.
+ */
+static void bulk_end(void)
+{
+    if (bulk_conn != NULL) {
+        bt_conn_unref(bulk_conn);
+        bulk_conn = NULL;
+    }
+    bulk_ended = k_uptime_get_32();
+    atomic_set(&bulk_state, BULK_IDLE);
+}
+
+/**
+ * @brief Passes each stored report of a notification on, and counts
+ *          the bytes for the goodput.
+ */
+static uint8_t bulk_notify(struct bt_conn *conn, struct bt_gatt_subscribe_params *params,
+        const void *data, uint16_t length)
+{
+    struct history_report report;
+
+    if (data == NULL) {
+        // unsubscribed
+        params->value_handle = 0;
+        return BT_GATT_ITER_STOP;
+    }
+
+    // a node reporting another number of beacons sends records of another size
+    if (length % sizeof(report) != 0) {
+        LOG_WRN("Bulk notification of %u bytes is not whole reports", length);
+        return BT_GATT_ITER_CONTINUE;
+    }
+
+    for (uint16_t off = 0; off + sizeof(report) <= length; off += sizeof(report)) {
+        memcpy(&report, (const uint8_t *) data + off, sizeof(report));
+        bulk_report(&report);
+        bulk_stats.reports++;
+    }
+    upload_bytes += length;
+    upload_last = k_uptime_get_32();
+    bulk_stats.bytes += length;
+    return BT_GATT_ITER_CONTINUE;
+}
+
+/**
+ * @brief Subscribes to the bulk data characteristic once found. The
+ *          node declares its ccc right after the value.
+ */
+static uint8_t bulk_discovered(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+        struct bt_gatt_discover_params *params)
+{
+    int err;
+
+    if (attr == NULL) {
+        LOG_ERR("Bulk data characteristic not found");
+        bt_conn_disconnect(conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
+        return BT_GATT_ITER_STOP;
+    }
+
+    subscribe_params.notify = bulk_notify;
+    subscribe_params.value = BT_GATT_CCC_NOTIFY;
+    subscribe_params.value_handle = ((const struct bt_gatt_chrc *) attr->user_data)->value_handle;
+    subscribe_params.ccc_handle = subscribe_params.value_handle + 1;
+    upload_bytes = 0;
+    upload_start = k_uptime_get_32();
+    upload_last = upload_start;
+
+    err = bt_gatt_subscribe(conn, &subscribe_params);
+    if (err && err != -EALREADY) {
+        LOG_ERR("Bulk subscribe failed (err %d)", err);
+        bt_conn_disconnect(conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
+    }
+    return BT_GATT_ITER_STOP;
+}
+
+/**
+ * @brief Looks for the bulk data characteristic once the mtu is
+ *          agreed, so the first notification can already be full size.
+ */
+static void bulk_mtu_exchanged(struct bt_conn *conn, uint8_t err, struct bt_gatt_exchange_params *params)
+{
+    int ret;
+
+    LOG_INF("Bulk mtu %u", bt_gatt_get_mtu(conn));
+
+    discover_params.uuid = &bulk_data_uuid.uuid;
+    discover_params.func = bulk_discovered;
+    discover_params.start_handle = BT_ATT_FIRST_ATTRIBUTE_HANDLE;
+    discover_params.end_handle = BT_ATT_LAST_ATTRIBUTE_HANDLE;
+    discover_params.type = BT_GATT_DISCOVER_CHARACTERISTIC;
+
+    ret = bt_gatt_discover(conn, &discover_params);
+    if (ret) {
+        LOG_ERR("Bulk discovery failed (err %d)", ret);
+        bt_conn_disconnect(conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
+    }
+}
+
+static void bulk_connected_cb(struct bt_conn *conn, uint8_t err)
+{
+    if (conn != bulk_conn) {
+        return;
+    }
+
+    if (err) {
+        bulk_stats.failed++;
+        bulk_end();
+    } else {
+        atomic_set(&bulk_state, BULK_CONNECTED);
+        bulk_stats.connections++;
+    }
+    k_sem_give(&bulk_connected_sem);
+}
+
+static void bulk_disconnected_cb(struct bt_conn *conn, uint8_t reason)
+{
+    uint32_t ms;
+
+    if (conn != bulk_conn) {
+        return;
+    }
+
+    ms = upload_last - upload_start;
+    if (upload_bytes > 0 && ms > 0) {
+        bulk_stats.goodput = (uint64_t) upload_bytes * 1000 / ms;
+    }
+    LOG_INF("Bulk upload of %u bytes in %u ms, %u bytes/s", upload_bytes, ms, bulk_stats.goodput);
+    upload_bytes = 0;
+    bulk_end();
+}
+
+BT_CONN_CB_DEFINE(bulk_conn_callbacks) = {
+    .connected = bulk_connected_cb,
+    .disconnected = bulk_disconnected_cb,
+};
+
+void bulk_init(bulk_report_t report)
+{
+    bulk_report = report;
+}
+
+bool bulk_request(const bt_addr_le_t *addr)
+{
+    if (bulk_report == NULL || k_uptime_get_32() - bulk_ended < CONFIG_BASE_BULK_BACKOFF_MS) {
+        return false;
+    }
+    if (!atomic_cas(&bulk_state, BULK_IDLE, BULK_REQUESTED)) {
+        return false;
+    }
+    bt_addr_le_copy(&bulk_addr, addr);
+    return true;
+}
+
+void bulk_connect(void)
+{
+    int err;
+
+    if (!atomic_cas(&bulk_state, BULK_REQUESTED, BULK_CONNECTING)) {
+        return;
+    }
+
+    k_sem_reset(&bulk_connected_sem);
+    err = bt_conn_le_create(&bulk_addr, BT_CONN_LE_CREATE_CONN, BULK_CONN_PARAM, &bulk_conn);
+    if (err) {
+        LOG_ERR("Bulk connection failed (err %d)", err);
+        bulk_stats.failed++;
+        bulk_end();
+        return;
+    }
+
+    if (k_sem_take(&bulk_connected_sem, K_MSEC(CONFIG_BASE_BULK_CONNECT_TIMEOUT_MS)) != 0) {
+        // cancels the connection, the connected callback then frees it
+        bt_conn_disconnect(bulk_conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
+        return;
+    }
+    if (atomic_get(&bulk_state) != BULK_CONNECTED) {
+        return;
+    }
+
+    // the node may reject either, the upload then runs at the defaults
+    err = bt_conn_le_data_len_update(bulk_conn, BT_LE_DATA_LEN_PARAM_MAX);
+    if (err) {
+        LOG_WRN("Bulk data length update failed (err %d)", err);
+    }
+    err = bt_conn_le_phy_update(bulk_conn, BT_CONN_LE_PHY_PARAM_2M);
+    if (err) {
+        LOG_WRN("Bulk phy update failed (err %d)", err);
+    }
+
+    mtu_params.func = bulk_mtu_exchanged;
+    err = bt_gatt_exchange_mtu(bulk_conn, &mtu_params);
+    if (err) {
+        LOG_ERR("Bulk mtu exchange failed (err %d)", err);
+        bt_conn_disconnect(bulk_conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
+    }
+}
+
+void bulk_print(const struct shell *shell)
+{
+    shell_print(shell, "bulk connections %u failed %u reports %u bytes %u goodput %u bytes/s",
+            bulk_stats.connections, bulk_stats.failed, bulk_stats.reports, bulk_stats.bytes,
+            bulk_stats.goodput);
+}
@@ -0,0 +1,57 @@
+// Author: Geordie Pearson
+/*
+*************************************************************
+* @file oslib/base_drivers/base_bulk/base_bulk.h
+* @author Geordie Pearson - 45798232
+* @date 20-05-2022
+* @brief opportunistic gatt bulk upload from nodes to the base
+*************************************************************
+*/
+
+#ifndef BASE_BULK_H
+#define BASE_BULK_H
+
+#include <zephyr.h>
+#include <shell/shell.h>
+
+#include "base_ble.h"
+
+/**
+ * bulk upload counters
+ **/
+struct bulk_stats {
+	uint32_t connections; // uploads started
+	uint32_t failed; // connections that could not be made
+	uint32_t reports; // stored reports received
+	uint32_t bytes; // notification bytes received
+	uint32_t goodput; // bytes/s of the last upload, from subscribing to the last notification
+};
+
+extern struct bulk_stats bulk_stats;
+
+typedef void (*bulk_report_t)(const struct history_report *report);
+
+// Sets the function each uploaded report is passed to, from the bt rx thread.
+// Parameters:
+// 	- report: Called with each report received
+void bulk_init(bulk_report_t report);
+
+// Notes a node flagging pending bulk data. Called from the scan callback.
+// Parameters:
+// 	- addr: The address of the node
+// Returns:
+// 	true if the scan should be stopped so bulk_connect can connect to the node
+bool bulk_request(const bt_addr_le_t *addr);
+
+// Connects to the node last requested, if any, while the scan is stopped. Waits up to
+// CONFIG_BASE_BULK_CONNECT_TIMEOUT_MS for the connection, then asks for the largest
+// data length, the 2M phy and the largest att mtu, and subscribes to the bulk data.
+// The node disconnects once it has sent everything.
+void bulk_connect(void);
+
+// Prints the bulk upload counters.
+// Parameters:
+// 	- shell: The shell to print to
+void bulk_print(const struct shell *shell);
+
+#endif
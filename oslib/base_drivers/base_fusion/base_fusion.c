@@ -0,0 +1,135 @@
+/**
+ *
+ * Multi-path report fusion module for project athena-green CSSE4011
+ *
+ * Copyright Haoxi Tan & Geordie Pearson 2022
+ */
+
+#include <zephyr.h>
+#include <string.h>
+
+#include "base_fusion.h"
+
+/**
+ * @brief Report held for its fusion window.
+ */
+struct fusion_slot {
+    bool used;
+    struct fused_report fused;
+};
+
+/* only used by the output thread */
+static struct fusion_slot slots[CONFIG_BASE_FUSION_SLOTS];
+
+/**
+ * @brief Finds the slot of the oldest report held.
+ */
+static struct fusion_slot *fusion_oldest(void)
+{
+    struct fusion_slot *oldest = NULL;
+
+    for (int i = 0; i < ARRAY_SIZE(slots); i++) {
+        if (slots[i].used && (oldest == NULL ||
+                (int32_t) (slots[i].fused.uptime - oldest->fused.uptime) < 0)) {
+            oldest = &slots[i];
+        }
+    }
+    return oldest;
+}
+
+/**
+ * @brief Emits the report held in a slot and frees the slot.
+ */
+static void fusion_emit(struct fusion_slot *slot, fusion_emit_t emit)
+{
+    emit(&slot->fused);
+    slot->used = false;
+}
+
+/**
+ * @brief Adds a static node to the statics a report was relayed by,
+ *          keeping its strongest rssi and shortest path.
+ */
+static void fusion_add_static(struct fused_report *fused, const struct static_ad *sad, int8_t rssi)
+{
+    for (int i = 0; i < fused->count; i++) {
+        struct fused_static *fs = &fused->statics[i];
+
+        if (fs->static_id == sad->static_id) {
+            fs->rssi = MAX(fs->rssi, rssi);
+            fs->ttl = MAX(fs->ttl, sad->ttl);
+            return;
+        }
+    }
+
+    if (fused->count < ARRAY_SIZE(fused->statics)) {
+        struct fused_static *fs = &fused->statics[fused->count++];
+
+        fs->static_id = sad->static_id;
+        fs->rssi = rssi;
+        fs->ttl = sad->ttl;
+        fs->static_rssi = sad->rssi;
+    }
+}
+
+void fusion_add(const struct base_report *report, fusion_emit_t emit)
+{
+    const struct mobile_ad *mad = report->type == STATIC_ADV_TYPE ? &report->sad.m_ad : &report->mad;
+    struct fusion_slot *slot = NULL;
+    struct fusion_slot *free_slot = NULL;
+
+    for (int i = 0; i < ARRAY_SIZE(slots); i++) {
+        if (!slots[i].used) {
+            if (free_slot == NULL) {
+                free_slot = &slots[i];
+            }
+        } else if (slots[i].fused.mad.m_id == mad->m_id && slots[i].fused.mad.seq == mad->seq) {
+            slot = &slots[i];
+            break;
+        }
+    }
+
+    if (slot == NULL) {
+        if (free_slot == NULL) {
+            // out of slots, close the oldest window early
+            free_slot = fusion_oldest();
+            fusion_emit(free_slot, emit);
+        }
+        slot = free_slot;
+        slot->used = true;
+        slot->fused.uptime = report->uptime;
+        slot->fused.rssi = RSSI_NONE;
+        slot->fused.count = 0;
+        slot->fused.mad = *mad;
+    }
+
+    if (report->type == STATIC_ADV_TYPE) {
+        fusion_add_static(&slot->fused, &report->sad, report->rssi);
+    } else if (slot->fused.rssi == RSSI_NONE || report->rssi > slot->fused.rssi) {
+        slot->fused.rssi = report->rssi;
+    }
+}
+
+void fusion_flush(fusion_emit_t emit)
+{
+    uint32_t now = k_uptime_get_32();
+
+    for (int i = 0; i < ARRAY_SIZE(slots); i++) {
+        if (slots[i].used && now - slots[i].fused.uptime >= CONFIG_BASE_FUSION_WINDOW_MS) {
+            fusion_emit(&slots[i], emit);
+        }
+    }
+}
+
+k_timeout_t fusion_next_timeout(void)
+{
+    struct fusion_slot *oldest = fusion_oldest();
+    uint32_t held;
+
+    if (oldest == NULL) {
+        return K_FOREVER;
+    }
+
+    held = k_uptime_get_32() - oldest->fused.uptime;
+    return held >= CONFIG_BASE_FUSION_WINDOW_MS ? K_NO_WAIT : K_MSEC(CONFIG_BASE_FUSION_WINDOW_MS - held);
+}
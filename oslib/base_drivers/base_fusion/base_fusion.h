@@ -0,0 +1,58 @@
+// Author: Geordie Pearson
+/*
+*************************************************************
+* @file oslib/base_drivers/base_fusion/base_fusion.h
+* @author Geordie Pearson - 45798232
+* @date 20-05-2022
+* @brief merges the copies of a mobile report received over several paths
+*************************************************************
+*/
+
+#ifndef BASE_FUSION_H
+#define BASE_FUSION_H
+
+#include <zephyr.h>
+
+#include "base_ble.h"
+
+/**
+ * static node a report was relayed by
+ **/
+struct fused_static {
+	int8_t static_id; // static node that heard the mobile node
+	int8_t rssi; // strongest rssi the base received the relayed report with
+	int8_t ttl; // highest ttl left, so the fewest hops taken
+	int8_t static_rssi; // rssi the static node heard the mobile node with, RSSI_NONE if not known
+};
+
+/**
+ * one mobile report merged from all the copies received within the fusion window
+ **/
+struct fused_report {
+	uint32_t uptime; // uptime (ms) the first copy was received at
+	int8_t rssi; // strongest rssi heard directly from the mobile node, RSSI_NONE if only relayed
+	uint8_t count; // number of statics
+	struct fused_static statics[CONFIG_BASE_FUSION_STATICS];
+	struct mobile_ad mad;
+};
+
+typedef void (*fusion_emit_t)(const struct fused_report *fused);
+
+// Merges a report into the report with the same mobile id and sequence number, or
+// starts a new one. If every slot is taken, the oldest report is emitted first.
+// Parameters:
+// 	- report: The report received
+// 	- emit: Called with each report leaving the fusion window
+void fusion_add(const struct base_report *report, fusion_emit_t emit);
+
+// Emits the reports whose fusion window has closed.
+// Parameters:
+// 	- emit: Called with each report leaving the fusion window
+void fusion_flush(fusion_emit_t emit);
+
+// Gets the time until the next fusion window closes.
+// Returns:
+// 	The timeout to wait for the next report with, K_FOREVER if no report is held
+k_timeout_t fusion_next_timeout(void);
+
+#endif
@@ -0,0 +1,254 @@
+/**
+ *
+ * Fixed point localisation module for project athena-green CSSE4011
+ *
+ * Copyright Haoxi Tan & Geordie Pearson 2022
+ */
+
+#include <zephyr.h>
+#include <errno.h>
+
+#include "base_locate.h"
+#include "base_locate_data.h"
+
+/* the normal equation sums are shifted down below this many bits, so the
+ * products of the 2x2 solve fit in 64 bits */
+#define LOCATE_SUM_BITS 30
+
+#define LOCATE_KNN_K CONFIG_BASE_LOCATE_KNN_K
+
+BUILD_ASSERT(LOCATE_KNN_K <= ARRAY_SIZE(locate_fingerprints), "more neighbours than fingerprints");
+
+/**
+ * @brief Beacon with a known position and its distance from the rssi.
+ */
+struct locate_range {
+    int32_t x;
+    int32_t y;
+    int32_t d;
+    int32_t w;
+};
+
+/**
+ * @brief Finds the position of a beacon or static node.
+ *
+ * @param points locate_anchors or locate_static_anchors
+ * @param n Number of points
+ * @param id Beacon or static node id
+ * @return The position, NULL if it has no known position
+ */
+static const struct locate_point *locate_find(const struct locate_point *points, size_t n, char id)
+{
+    for (int i = 0; i < n; i++) {
+        if (points[i].id == id) {
+            return &points[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Converts an rssi to a distance in cm with a path loss table.
+ *
+ * @param table locate_dist_cm for beacons, locate_static_dist_cm for static nodes
+ */
+static int32_t locate_dist(const uint16_t *table, int8_t rssi)
+{
+    rssi = CLAMP(rssi, LOCATE_RSSI_MIN, LOCATE_RSSI_MAX);
+    return table[rssi - LOCATE_RSSI_MIN];
+}
+
+/**
+ * @brief Adds the range of an anchor at a known position.
+ *
+ * @return Number of ranges
+ */
+static int locate_add_range(struct locate_range *ranges, int n, int *ref, const struct locate_point *anchor,
+        int32_t d)
+{
+    ranges[n].x = anchor->x;
+    ranges[n].y = anchor->y;
+    ranges[n].d = d;
+    ranges[n].w = (1 << 16) / ranges[n].d;
+    if (ranges[n].d < ranges[*ref].d) {
+        *ref = n;
+    }
+    return n + 1;
+}
+
+/**
+ * @brief Solves the position relative to the nearest anchor by weighted
+ *          least squares, each range weighted by the inverse of its
+ *          distance as the path loss error grows with distance. The
+ *          anchors are the beacons in the report and the static nodes
+ *          that heard it.
+ *
+ * @param mad Mobile report
+ * @param statics Static nodes that heard the report
+ * @param count Number of statics
+ * @param pos Position, x and y are set if solved
+ * @return 0 if solved, -ENODATA with fewer than 3 anchors or collinear anchors
+ */
+static int locate_multilat(const struct mobile_ad *mad, const struct locate_static *statics, int count,
+        struct locate_position *pos)
+{
+    struct locate_range ranges[BEACONS + LOCATE_STATICS];
+    int64_t sxx = 0, sxy = 0, syy = 0, tx = 0, ty = 0;
+    int64_t det, max;
+    int n = 0, ref = 0, shift = 0;
+
+    for (int i = 0; i < BEACONS; i++) {
+        const struct locate_point *anchor = mad->beacons[i].id ?
+                locate_find(locate_anchors, ARRAY_SIZE(locate_anchors), mad->beacons[i].id) : NULL;
+
+        if (anchor != NULL) {
+            n = locate_add_range(ranges, n, &ref, anchor, locate_dist(locate_dist_cm, mad->beacons[i].rssi));
+        }
+    }
+    for (int i = 0; i < MIN(count, LOCATE_STATICS); i++) {
+        const struct locate_point *anchor = locate_find(locate_static_anchors,
+                ARRAY_SIZE(locate_static_anchors), statics[i].static_id);
+
+        if (anchor != NULL) {
+            n = locate_add_range(ranges, n, &ref, anchor,
+                    locate_dist(locate_static_dist_cm, statics[i].rssi));
+        }
+    }
+
+    pos->anchors = n;
+    if (n < 3) {
+        return -ENODATA;
+    }
+
+    // subtracting the circle of the nearest anchor leaves one linear equation
+    // a x + b y = c per other anchor, with x and y relative to the nearest
+    for (int i = 0; i < n; i++) {
+        int64_t xi = ranges[i].x - ranges[ref].x;
+        int64_t yi = ranges[i].y - ranges[ref].y;
+        int64_t a = -2 * xi;
+        int64_t b = -2 * yi;
+        int64_t c = (int64_t) ranges[i].d * ranges[i].d - (int64_t) ranges[ref].d * ranges[ref].d
+                - xi * xi - yi * yi;
+
+        if (i == ref) {
+            continue;
+        }
+        sxx += ranges[i].w * a * a;
+        sxy += ranges[i].w * a * b;
+        syy += ranges[i].w * b * b;
+        tx += ranges[i].w * a * c;
+        ty += ranges[i].w * b * c;
+    }
+
+    // scaling every sum by the same power of 2 leaves the solution unchanged
+    max = MAX(MAX(sxx, syy), MAX(MAX(sxy, -sxy), MAX(MAX(tx, -tx), MAX(ty, -ty))));
+    while ((max >> shift) >= (1LL << LOCATE_SUM_BITS)) {
+        shift++;
+    }
+    sxx >>= shift;
+    sxy >>= shift;
+    syy >>= shift;
+    tx >>= shift;
+    ty >>= shift;
+
+    det = sxx * syy - sxy * sxy;
+    if (det == 0) {
+        return -ENODATA;
+    }
+
+    pos->x = CLAMP(ranges[ref].x + (syy * tx - sxy * ty) / det, INT16_MIN + 1, INT16_MAX);
+    pos->y = CLAMP(ranges[ref].y + (sxx * ty - sxy * tx) / det, INT16_MIN + 1, INT16_MAX);
+    return 0;
+}
+
+/**
+ * @brief Finds the zone most of the LOCATE_KNN_K nearest fingerprints
+ *          were recorded in, ties going to the nearest fingerprint.
+ *
+ * @return Zone number, LOCATE_ZONE_NONE if no fingerprinted beacon was heard
+ */
+static uint8_t locate_knn(const struct mobile_ad *mad)
+{
+    int8_t rssi[LOCATE_FP_BEACONS];
+    uint32_t best_dist[LOCATE_KNN_K];
+    uint8_t best_zone[LOCATE_KNN_K];
+    uint8_t zone = LOCATE_ZONE_NONE;
+    int heard = 0, found = 0, votes = 0;
+
+    for (int f = 0; f < LOCATE_FP_BEACONS; f++) {
+        rssi[f] = LOCATE_RSSI_MISSING;
+        for (int i = 0; i < BEACONS; i++) {
+            if (mad->beacons[i].id == locate_fp_beacons[f]) {
+                rssi[f] = mad->beacons[i].rssi;
+                heard++;
+                break;
+            }
+        }
+    }
+    if (heard == 0) {
+        return LOCATE_ZONE_NONE;
+    }
+
+    // keep the nearest fingerprints sorted by squared rssi distance
+    for (int p = 0; p < ARRAY_SIZE(locate_fingerprints); p++) {
+        uint32_t dist = 0;
+        int i;
+
+        for (int f = 0; f < LOCATE_FP_BEACONS; f++) {
+            int32_t diff = rssi[f] - locate_fingerprints[p].rssi[f];
+
+            dist += diff * diff;
+        }
+        if (found == LOCATE_KNN_K && dist >= best_dist[found - 1]) {
+            continue;
+        }
+        i = found < LOCATE_KNN_K ? found++ : found - 1;
+        for (; i > 0 && best_dist[i - 1] > dist; i--) {
+            best_dist[i] = best_dist[i - 1];
+            best_zone[i] = best_zone[i - 1];
+        }
+        best_dist[i] = dist;
+        best_zone[i] = locate_fingerprints[p].zone;
+    }
+
+    for (int i = 0; i < found; i++) {
+        int count = 0;
+
+        for (int j = 0; j < found; j++) {
+            count += best_zone[j] == best_zone[i];
+        }
+        if (count > votes) {
+            votes = count;
+            zone = best_zone[i];
+        }
+    }
+    return zone;
+}
+
+int locate_mobile(const struct mobile_ad *mad, const struct locate_static *statics, int count,
+        struct locate_position *pos)
+{
+    int ret;
+
+    pos->x = LOCATE_UNKNOWN;
+    pos->y = LOCATE_UNKNOWN;
+    pos->zone_x = LOCATE_UNKNOWN;
+    pos->zone_y = LOCATE_UNKNOWN;
+
+    // the anchors are not calibrated yet, see BASE_LOCATE_MULTILAT
+    if (IS_ENABLED(CONFIG_BASE_LOCATE_MULTILAT)) {
+        ret = locate_multilat(mad, statics, count, pos);
+    } else {
+        pos->anchors = 0;
+        ret = -ENODATA;
+    }
+    pos->zone = locate_knn(mad);
+    for (int i = 0; i < ARRAY_SIZE(locate_zones); i++) {
+        if (locate_zones[i].id == pos->zone) {
+            pos->zone_x = locate_zones[i].x;
+            pos->zone_y = locate_zones[i].y;
+        }
+    }
+
+    return ret == 0 || pos->zone != LOCATE_ZONE_NONE ? 0 : -ENODATA;
+}
@@ -0,0 +1,60 @@
+// Author: Geordie Pearson
+/*
+*************************************************************
+* @file oslib/base_drivers/base_locate/base_locate.h
+* @author Geordie Pearson - 45798232
+* @date 20-05-2022
+* @brief fixed point multilateration and kNN zone lookup for base
+*************************************************************
+*/
+
+#ifndef BASE_LOCATE_H
+#define BASE_LOCATE_H
+
+#include <zephyr.h>
+
+#include "base_ble.h"
+
+// coordinate of a position that could not be solved
+#define LOCATE_UNKNOWN INT16_MIN
+// zone of a report no fingerprint matched
+#define LOCATE_ZONE_NONE 0
+// static nodes ranging a report at most, as many as a merged report lists
+#define LOCATE_STATICS CONFIG_BASE_FUSION_STATICS
+
+/**
+ * static node that heard a mobile report directly, ranging the mobile node from
+ * its known position like a beacon
+ **/
+struct locate_static {
+	int8_t static_id;
+	int8_t rssi; // rssi the static node heard the mobile node with
+};
+
+/**
+ * position of a mobile node estimated from one report
+ **/
+struct locate_position {
+	int16_t x; // multilaterated position (cm), LOCATE_UNKNOWN if not solved or not enabled
+	int16_t y;
+	uint8_t anchors; // beacons and static nodes with a known position used to solve x and y
+	uint8_t zone; // zone of the nearest fingerprints, LOCATE_ZONE_NONE if unknown
+	int16_t zone_x; // centre of the zone (cm)
+	int16_t zone_y;
+};
+
+// Estimates the position of a mobile node from the beacons in its report, by
+// voting among the nearest rssi fingerprints recorded in each zone, and with
+// CONFIG_BASE_LOCATE_MULTILAT by weighted multilateration of the beacons and static
+// nodes with a known position.
+// Parameters:
+// 	- mad: The report of the mobile node
+// 	- statics: The static nodes that heard the report directly
+// 	- count: The number of statics, up to LOCATE_STATICS are used
+// 	- pos: The position estimated
+// Returns:
+// 	0 if a position or a zone was found, otherwise -ENODATA
+int locate_mobile(const struct mobile_ad *mad, const struct locate_static *statics, int count,
+		struct locate_position *pos);
+
+#endif
@@ -0,0 +1,211 @@
+// Generated by project/base/data/gen_locate.py from the zone captures, do not edit.
+
+#ifndef BASE_LOCATE_DATA_H
+#define BASE_LOCATE_DATA_H
+
+struct locate_point {
+	char id; // beacon id, static node id, or zone number
+	int16_t x; // cm
+	int16_t y;
+};
+
+#define LOCATE_RSSI_MIN -110
+#define LOCATE_RSSI_MAX -30
+
+// beacon rssi (dBm) to distance (cm), -59 dBm at 1 m, path loss exponent 4
+static const uint16_t locate_dist_cm[LOCATE_RSSI_MAX - LOCATE_RSSI_MIN + 1] = {
+	1884, 1778, 1679, 1585, 1496, 1413, 1334, 1259, 1189, 1122,
+	1059, 1000, 944, 891, 841, 794, 750, 708, 668, 631,
+	596, 562, 531, 501, 473, 447, 422, 398, 376, 355,
+	335, 316, 299, 282, 266, 251, 237, 224, 211, 200,
+	188, 178, 168, 158, 150, 141, 133, 126, 119, 112,
+	106, 100, 94, 89, 84, 79, 75, 71, 67, 63,
+	60, 56, 53, 50, 47, 45, 42, 40, 38, 35,
+	33, 32, 30, 28, 27, 25, 24, 22, 21, 20,
+	19,
+};
+
+// rssi (dBm) of a mobile node heard by a static node to distance (cm), -55 dBm at 1 m, path loss exponent 3
+static const uint16_t locate_static_dist_cm[LOCATE_RSSI_MAX - LOCATE_RSSI_MIN + 1] = {
+	6813, 6310, 5843, 5412, 5012, 4642, 4299, 3981, 3687, 3415,
+	3162, 2929, 2712, 2512, 2326, 2154, 1995, 1848, 1711, 1585,
+	1468, 1359, 1259, 1166, 1080, 1000, 926, 858, 794, 736,
+	681, 631, 584, 541, 501, 464, 430, 398, 369, 341,
+	316, 293, 271, 251, 233, 215, 200, 185, 171, 158,
+	147, 136, 126, 117, 108, 100, 93, 86, 79, 74,
+	68, 63, 58, 54, 50, 46, 43, 40, 37, 34,
+	32, 29, 27, 25, 23, 22, 20, 18, 17, 16,
+	15,
+};
+
+// beacon positions (cm)
+static const struct locate_point locate_anchors[] = {
+	{'A', 400, 850},
+	{'E', 1050, 850},
+	{'F', 1480, 1050},
+	{'G', 2200, 760},
+	{'P', 2700, 1050},
+	{'Z', 3320, 1200},
+};
+
+// static node positions (cm)
+static const struct locate_point locate_static_anchors[] = {
+	{1, 700, 850},
+	{2, 1970, 830},
+	{3, 2600, 930},
+	{4, 3100, 1100},
+};
+
+// zone centres (cm)
+static const struct locate_point locate_zones[] = {
+	{1, 500, 840},
+	{2, 900, 850},
+	{3, 1200, 900},
+	{4, 1800, 850},
+	{5, 2300, 870},
+	{6, 2600, 860},
+	{7, 2900, 870},
+	{8, 3500, 960},
+};
+
+#define LOCATE_RSSI_MISSING -100
+#define LOCATE_FP_BEACONS 6
+static const char locate_fp_beacons[LOCATE_FP_BEACONS] = {'A', 'E', 'F', 'G', 'O', 'P'};
+
+struct locate_fingerprint {
+	uint8_t zone;
+	int8_t rssi[LOCATE_FP_BEACONS]; // rssi of each of locate_fp_beacons
+};
+
+static const struct locate_fingerprint locate_fingerprints[] = {
+	{1, {-82, -68, -66, -100, -100, -100}},
+	{1, {-80, -67, -70, -100, -100, -100}},
+	{1, {-80, -71, -85, -100, -100, -100}},
+	{1, {-79, -71, -75, -100, -100, -100}},
+	{1, {-80, -72, -76, -100, -100, -100}},
+	{1, {-83, -69, -72, -100, -100, -100}},
+	{1, {-83, -72, -81, -100, -100, -100}},
+	{1, {-82, -72, -72, -100, -100, -100}},
+	{1, {-82, -73, -72, -100, -100, -100}},
+	{1, {-82, -79, -82, -100, -100, -100}},
+	{1, {-77, -72, -82, -100, -100, -100}},
+	{1, {-79, -71, -79, -100, -100, -100}},
+	{1, {-80, -69, -74, -100, -100, -100}},
+	{1, {-76, -62, -68, -100, -100, -100}},
+	{1, {-68, -71, -81, -100, -100, -100}},
+	{1, {-63, -79, -83, -100, -100, -100}},
+	{2, {-63, -64, -69, -100, -100, -100}},
+	{2, {-100, -69, -59, -80, -100, -100}},
+	{2, {-61, -64, -82, -100, -100, -100}},
+	{2, {-62, -64, -82, -100, -100, -100}},
+	{2, {-63, -63, -69, -100, -100, -100}},
+	{2, {-61, -62, -73, -100, -100, -100}},
+	{2, {-61, -64, -76, -100, -100, -100}},
+	{2, {-62, -68, -69, -100, -100, -100}},
+	{2, {-63, -64, -70, -100, -100, -100}},
+	{2, {-61, -64, -76, -100, -100, -100}},
+	{2, {-63, -65, -78, -100, -100, -100}},
+	{2, {-62, -64, -78, -100, -100, -100}},
+	{2, {-69, -64, -74, -100, -100, -100}},
+	{2, {-63, -64, -71, -100, -100, -100}},
+	{2, {-63, -63, -78, -100, -100, -100}},
+	{2, {-63, -74, -69, -100, -100, -100}},
+	{3, {-100, -70, -62, -81, -100, -100}},
+	{3, {-100, -74, -77, -81, -100, -100}},
+	{3, {-100, -74, -67, -77, -100, -100}},
+	{3, {-100, -73, -77, -77, -100, -100}},
+	{3, {-100, -70, -78, -83, -100, -100}},
+	{3, {-100, -74, -67, -83, -100, -100}},
+	{3, {-100, -74, -67, -82, -100, -100}},
+	{3, {-100, -74, -67, -77, -100, -100}},
+	{3, {-100, -73, -67, -83, -100, -100}},
+	{3, {-100, -73, -62, -83, -100, -100}},
+	{3, {-100, -77, -67, -83, -100, -100}},
+	{3, {-87, -73, -67, -83, -100, -100}},
+	{3, {-100, -74, -67, -85, -100, -100}},
+	{3, {-100, -74, -67, -77, -100, -100}},
+	{3, {-100, -75, -67, -84, -100, -100}},
+	{3, {-100, -73, -67, -78, -100, -100}},
+	{4, {-100, -73, -64, -71, -100, -100}},
+	{4, {-100, -77, -66, -72, -100, -100}},
+	{4, {-100, -73, -67, -72, -100, -100}},
+	{4, {-100, -77, -66, -72, -100, -100}},
+	{4, {-100, -78, -67, -79, -100, -100}},
+	{4, {-100, -73, -66, -78, -100, -100}},
+	{4, {-100, -77, -63, -73, -100, -100}},
+	{4, {-100, -77, -64, -78, -100, -100}},
+	{4, {-78, -68, -67, -100, -100, -100}},
+	{4, {-76, -62, -69, -100, -100, -100}},
+	{4, {-100, -55, -63, -83, -100, -100}},
+	{4, {-76, -54, -66, -100, -100, -100}},
+	{4, {-76, -57, -66, -100, -100, -100}},
+	{4, {-100, -57, -66, -85, -100, -100}},
+	{4, {-81, -58, -72, -100, -100, -100}},
+	{4, {-100, -84, -75, -100, -100, -78}},
+	{5, {-100, -77, -67, -100, -100, -100}},
+	{5, {-100, -100, -76, -81, -100, -78}},
+	{5, {-100, -100, -76, -100, -100, -78}},
+	{5, {-100, -82, -76, -100, -100, -100}},
+	{5, {-100, -85, -76, -82, -100, -71}},
+	{5, {-100, -77, -67, -100, -100, -100}},
+	{5, {-100, -100, -76, -69, -100, -78}},
+	{5, {-100, -100, -76, -69, -100, -78}},
+	{5, {-83, -68, -67, -100, -100, -100}},
+	{5, {-100, -100, -76, -82, -100, -78}},
+	{5, {-80, -71, -67, -100, -100, -100}},
+	{5, {-100, -84, -76, -69, -100, -100}},
+	{5, {-78, -66, -61, -100, -100, -100}},
+	{5, {-85, -78, -68, -100, -100, -100}},
+	{5, {-100, -84, -74, -83, -100, -100}},
+	{5, {-100, -76, -68, -85, -100, -100}},
+	{6, {-100, -66, -70, -84, -100, -100}},
+	{6, {-100, -69, -71, -80, -100, -100}},
+	{6, {-75, -62, -61, -100, -100, -100}},
+	{6, {-100, -63, -61, -100, -100, -100}},
+	{6, {-100, -63, -65, -82, -100, -100}},
+	{6, {-100, -71, -73, -80, -100, -100}},
+	{6, {-100, -63, -65, -81, -100, -100}},
+	{6, {-76, -62, -65, -100, -100, -100}},
+	{6, {-76, -62, -61, -100, -100, -100}},
+	{6, {-100, -65, -72, -80, -100, -100}},
+	{6, {-100, -69, -67, -81, -100, -100}},
+	{6, {-78, -63, -65, -100, -100, -100}},
+	{6, {-78, -62, -64, -100, -100, -100}},
+	{6, {-77, -62, -64, -100, -100, -100}},
+	{6, {-70, -76, -79, -100, -100, -100}},
+	{6, {-100, -84, -100, -77, -100, -76}},
+	{7, {-100, -61, -72, -100, -100, -100}},
+	{7, {-100, -85, -74, -81, -100, -100}},
+	{7, {-100, -100, -100, -81, -80, -68}},
+	{7, {-100, -100, -100, -81, -78, -68}},
+	{7, {-100, -100, -100, -81, -86, -68}},
+	{7, {-100, -100, -84, -76, -83, -67}},
+	{7, {-100, -100, -84, -100, -77, -77}},
+	{7, {-100, -100, -100, -82, -77, -68}},
+	{7, {-100, -100, -100, -82, -84, -68}},
+	{7, {-100, -84, -78, -80, -100, -100}},
+	{7, {-100, -74, -67, -80, -100, -100}},
+	{7, {-100, -100, -100, -82, -82, -68}},
+	{7, {-100, -100, -100, -82, -78, -68}},
+	{7, {-86, -72, -29, -100, -100, -100}},
+	{7, {-82, -67, -67, -100, -100, -100}},
+	{7, {-75, -64, -69, -100, -100, -100}},
+	{8, {-100, -100, -87, -100, -68, -87}},
+	{8, {-100, -100, -87, -100, -67, -86}},
+	{8, {-100, -59, -64, -85, -100, -100}},
+	{8, {-100, -59, -64, -100, -100, -100}},
+	{8, {-74, -58, -65, -100, -100, -100}},
+	{8, {-100, -63, -64, -100, -100, -100}},
+	{8, {-100, -65, -63, -100, -100, -100}},
+	{8, {-100, -60, -63, -81, -100, -100}},
+	{8, {-100, -64, -64, -100, -100, -100}},
+	{8, {-100, -64, -64, -100, -100, -100}},
+	{8, {-100, -65, -63, -100, -100, -100}},
+	{8, {-100, -64, -63, -100, -100, -100}},
+	{8, {-100, -64, -64, -88, -100, -100}},
+	{8, {-100, -64, -62, -100, -100, -100}},
+	{8, {-100, -61, -62, -100, -100, -100}},
+	{8, {-100, -63, -64, -100, -100, -100}},
+};
+
+#endif
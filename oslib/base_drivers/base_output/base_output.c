@@ -0,0 +1,294 @@
+/**
+ *
+ * Binary framed report output module for project athena-green CSSE4011
+ *
+ * Copyright Haoxi Tan & Geordie Pearson 2022
+ */
+
+#include <zephyr.h>
+#include <device.h>
+#include <drivers/uart.h>
+#include <sys/ring_buffer.h>
+#include <sys/byteorder.h>
+#include <sys/crc.h>
+
+#include <logging/log.h>
+#include "base_output.h"
+
+LOG_MODULE_REGISTER(output_module, LOG_LEVEL_DBG);
+
+/*
+ * Each record is sent as a frame of
+ *     COBS(record | crc16 little endian) 0x00
+ * where the record is, all fields little endian:
+ *     kind u8, rssi i8, uptime u32, static_id i8, ttl i8,
+ *     mobile_id u8, seq u8, steps u16, heading u8,
+ *     beacon count u8, then count x (beacon id u8, beacon rssi i8)
+ * static_id and ttl are 0 in RECORD_MOBILE records. RECORD_STATIC records
+ * follow the beacons with
+ *     static_rssi i8
+ * the rssi the static node heard the mobile node with, 127 if it did not.
+ * RECORD_FUSED records have static_id and ttl 0, rssi 127 if the report was
+ * not heard directly, and follow the beacons with
+ *     static count u8, then count x (static_id i8, rssi i8, ttl i8, static_rssi i8)
+ * RECORD_POSITION records have rssi, static_id and ttl 0, and follow the
+ * beacons with
+ *     x i16, y i16, anchors u8, zone u8, zone_x i16, zone_y i16
+ * all in cm, unknown coordinates being -32768.
+ * RECORD_CONTACT records have none of the fields after uptime, which is when
+ * the episode started, and rssi is the strongest of the episode:
+ *     kind u8, rssi i8, uptime u32, mobile_id u8, contact_id u8,
+ *     episode u8, dwell u16 (s)
+ */
+#define RECORD_HEADER_LEN 14
+#define RECORD_FUSED_LEN (1 + 4 * CONFIG_BASE_FUSION_STATICS)
+#define RECORD_POSITION_LEN 10
+#define RECORD_CONTACT_LEN 11
+#define RECORD_MAX_LEN (RECORD_HEADER_LEN + 2 * BEACONS + MAX(RECORD_FUSED_LEN, RECORD_POSITION_LEN))
+#define FRAME_CRC_LEN 2
+/* COBS adds one byte per 254 bytes, then the delimiter */
+#define FRAME_MAX_LEN (RECORD_MAX_LEN + FRAME_CRC_LEN + 2)
+
+BUILD_ASSERT(RECORD_MAX_LEN + FRAME_CRC_LEN < 254, "record must be COBS encoded in one block");
+
+#define OUTPUT_NODE DT_NODELABEL(cdc_acm_uart1)
+
+RING_BUF_DECLARE(output_ring, CONFIG_BASE_OUTPUT_RING_SIZE);
+
+struct output_stats output_stats;
+
+static const struct device *output_dev = DEVICE_DT_GET(OUTPUT_NODE);
+
+/**
+ * @brief UART interrupt handler, moves the ring buffer into the
+ *          cdc acm tx fifo until the ring buffer is empty.
+ */
+static void output_isr(const struct device *dev, void *user_data)
+{
+    uint8_t *data;
+    uint32_t len;
+    int sent;
+
+    if (!uart_irq_update(dev) || !uart_irq_tx_ready(dev)) {
+        return;
+    }
+
+    len = ring_buf_get_claim(&output_ring, &data, CONFIG_BASE_OUTPUT_RING_SIZE);
+    if (len == 0) {
+        uart_irq_tx_disable(dev);
+        return;
+    }
+
+    sent = uart_fifo_fill(dev, data, len);
+    ring_buf_get_finish(&output_ring, sent > 0 ? sent : 0);
+}
+
+int output_init(void)
+{
+    if (!device_is_ready(output_dev)) {
+        LOG_ERR("Binary output device not ready\n");
+        return -ENODEV;
+    }
+
+    uart_irq_callback_set(output_dev, output_isr);
+    return 0;
+}
+
+/**
+ * @brief Encodes the fields common to every kind of record.
+ *
+ * @return Length of the header and beacons
+ */
+static size_t encode_header(uint8_t kind, int8_t rssi, uint32_t uptime, int8_t static_id, int8_t ttl,
+        const struct mobile_ad *mad, uint8_t *buf)
+{
+    size_t len = 0;
+
+    buf[len++] = kind;
+    buf[len++] = rssi;
+    sys_put_le32(uptime, &buf[len]);
+    len += 4;
+    buf[len++] = static_id;
+    buf[len++] = ttl;
+    buf[len++] = mad->m_id;
+    buf[len++] = mad->seq;
+    sys_put_le16(mad->steps, &buf[len]);
+    len += 2;
+    buf[len++] = mad->heading;
+    buf[len++] = BEACONS;
+    for (int i = 0; i < BEACONS; i++) {
+        buf[len++] = mad->beacons[i].id;
+        buf[len++] = mad->beacons[i].rssi;
+    }
+    return len;
+}
+
+/**
+ * @brief Encodes a report into its binary record.
+ *
+ * @param report Report to encode
+ * @param buf Buffer of at least RECORD_MAX_LEN bytes
+ * @return Length of the record
+ */
+static size_t encode_report(const struct base_report *report, uint8_t *buf)
+{
+    if (report->type == STATIC_ADV_TYPE) {
+        size_t len = encode_header(RECORD_STATIC, report->rssi, report->uptime, report->sad.static_id,
+                report->sad.ttl, &report->sad.m_ad, buf);
+
+        buf[len++] = report->sad.rssi;
+        return len;
+    }
+    return encode_header(RECORD_MOBILE, report->rssi, report->uptime, 0, 0, &report->mad, buf);
+}
+
+/**
+ * @brief Encodes a merged report into its binary record.
+ *
+ * @param fused Merged report to encode
+ * @param buf Buffer of at least RECORD_MAX_LEN bytes
+ * @return Length of the record
+ */
+static size_t encode_fused(const struct fused_report *fused, uint8_t *buf)
+{
+    size_t len = encode_header(RECORD_FUSED, fused->rssi, fused->uptime, 0, 0, &fused->mad, buf);
+
+    buf[len++] = fused->count;
+    for (int i = 0; i < fused->count; i++) {
+        buf[len++] = fused->statics[i].static_id;
+        buf[len++] = fused->statics[i].rssi;
+        buf[len++] = fused->statics[i].ttl;
+        buf[len++] = fused->statics[i].static_rssi;
+    }
+    return len;
+}
+
+/**
+ * @brief Encodes an estimated position into its binary record.
+ *
+ * @param mad Report the position was estimated from
+ * @param uptime Uptime (ms) the report was received at
+ * @param pos Position to encode
+ * @param buf Buffer of at least RECORD_MAX_LEN bytes
+ * @return Length of the record
+ */
+static size_t encode_position(const struct mobile_ad *mad, uint32_t uptime, const struct locate_position *pos,
+        uint8_t *buf)
+{
+    size_t len = encode_header(RECORD_POSITION, 0, uptime, 0, 0, mad, buf);
+
+    sys_put_le16(pos->x, &buf[len]);
+    sys_put_le16(pos->y, &buf[len + 2]);
+    buf[len + 4] = pos->anchors;
+    buf[len + 5] = pos->zone;
+    sys_put_le16(pos->zone_x, &buf[len + 6]);
+    sys_put_le16(pos->zone_y, &buf[len + 8]);
+    return len + RECORD_POSITION_LEN;
+}
+
+/**
+ * @brief Encodes a contact episode into its binary record.
+ *
+ * @param report Contact episode to encode
+ * @param buf Buffer of at least RECORD_CONTACT_LEN bytes
+ * @return Length of the record
+ */
+static size_t encode_contact(const struct base_report *report, uint8_t *buf)
+{
+    const struct contact_ad *cad = &report->cad;
+
+    buf[0] = RECORD_CONTACT;
+    buf[1] = cad->rssi;
+    sys_put_le32(report->uptime, &buf[2]);
+    buf[6] = cad->m_id;
+    buf[7] = cad->contact_id;
+    buf[8] = cad->episode;
+    sys_put_le16(cad->dwell, &buf[9]);
+    return RECORD_CONTACT_LEN;
+}
+
+/**
+ * @brief COBS encodes a buffer of less than 254 bytes, so the frame
+ *          holds no 0x00 bytes and 0x00 can delimit frames.
+ *
+ * @param src Buffer to encode
+ * @param len Length of the buffer
+ * @param dst Encoded buffer, at least len + 1 bytes
+ * @return Length of the encoded buffer
+ */
+static size_t cobs_encode(const uint8_t *src, size_t len, uint8_t *dst)
+{
+    size_t code_pos = 0;
+    size_t out = 1;
+    uint8_t code = 1;
+
+    for (size_t i = 0; i < len; i++) {
+        if (src[i] == 0) {
+            dst[code_pos] = code;
+            code_pos = out++;
+            code = 1;
+        } else {
+            dst[out++] = src[i];
+            code++;
+        }
+    }
+    dst[code_pos] = code;
+    return out;
+}
+
+/**
+ * @brief Frames a record and queues it for the isr, dropping the frame
+ *          if the ring buffer cannot hold all of it.
+ *
+ * @param record Record, with FRAME_CRC_LEN spare bytes after it
+ * @param len Length of the record
+ */
+static void output_write_record(uint8_t *record, size_t len)
+{
+    uint8_t frame[FRAME_MAX_LEN];
+    unsigned int key;
+
+    sys_put_le16(crc16_ccitt(0xffff, record, len), &record[len]);
+    len = cobs_encode(record, len + FRAME_CRC_LEN, frame);
+    frame[len++] = 0x00;
+
+    // the output thread is the only producer, the isr the only consumer
+    key = irq_lock();
+    if (ring_buf_space_get(&output_ring) >= len) {
+        ring_buf_put(&output_ring, frame, len);
+        output_stats.frames++;
+    } else {
+        output_stats.dropped++;
+    }
+    irq_unlock(key);
+
+    uart_irq_tx_enable(output_dev);
+}
+
+void output_write_report(const struct base_report *report)
+{
+    uint8_t record[RECORD_MAX_LEN + FRAME_CRC_LEN];
+
+    output_write_record(record, encode_report(report, record));
+}
+
+void output_write_fused(const struct fused_report *fused)
+{
+    uint8_t record[RECORD_MAX_LEN + FRAME_CRC_LEN];
+
+    output_write_record(record, encode_fused(fused, record));
+}
+
+void output_write_position(const struct mobile_ad *mad, uint32_t uptime, const struct locate_position *pos)
+{
+    uint8_t record[RECORD_MAX_LEN + FRAME_CRC_LEN];
+
+    output_write_record(record, encode_position(mad, uptime, pos, record));
+}
+
+void output_write_contact(const struct base_report *report)
+{
+    uint8_t record[RECORD_CONTACT_LEN + FRAME_CRC_LEN];
+
+    output_write_record(record, encode_contact(report, record));
+}
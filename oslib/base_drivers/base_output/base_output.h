@@ -0,0 +1,68 @@
+// Author: Geordie Pearson
+/*
+*************************************************************
+* @file oslib/base_drivers/base_output/base_output.h
+* @author Geordie Pearson - 45798232
+* @date 20-05-2022
+* @brief binary framed report output for base
+*************************************************************
+*/
+
+#ifndef BASE_OUTPUT_H
+#define BASE_OUTPUT_H
+
+#include <zephyr.h>
+
+#include "base_ble.h"
+#include "base_fusion.h"
+#include "base_locate.h"
+
+/* Defines the kinds of binary record */
+#define RECORD_MOBILE 1 // report heard directly from a mobile node
+#define RECORD_STATIC 2 // report relayed by a static node
+#define RECORD_FUSED 3 // report merged from all the copies received
+#define RECORD_POSITION 4 // position estimated from a report
+#define RECORD_CONTACT 5 // contact episode between two mobile nodes
+
+/**
+ * binary output counters
+ **/
+struct output_stats {
+	uint32_t frames; // frames queued for the host
+	uint32_t dropped; // frames lost because the ring buffer was full
+};
+
+extern struct output_stats output_stats;
+
+// Initialises the cdc acm instance the binary records are written to.
+// Returns:
+// 	0 on success, otherwise a negative error code
+int output_init(void);
+
+// Writes a report to the host as a COBS framed binary record with a CRC-16.
+// The frame is dropped if the ring buffer cannot hold all of it.
+// Parameters:
+// 	- report: The report to write
+void output_write_report(const struct base_report *report);
+
+// Writes a merged report to the host as a COBS framed binary record with a CRC-16,
+// dropped like a report if the ring buffer is full.
+// Parameters:
+// 	- fused: The merged report to write
+void output_write_fused(const struct fused_report *fused);
+
+// Writes the position of a mobile node to the host as a COBS framed binary record
+// with a CRC-16, dropped like a report if the ring buffer is full.
+// Parameters:
+// 	- mad: The report the position was estimated from
+// 	- uptime: Uptime (ms) the report was received at
+// 	- pos: The position estimated
+void output_write_position(const struct mobile_ad *mad, uint32_t uptime, const struct locate_position *pos);
+
+// Writes a contact episode to the host as a COBS framed binary record with a CRC-16,
+// dropped like a report if the ring buffer is full.
+// Parameters:
+// 	- report: The contact episode to write
+void output_write_contact(const struct base_report *report);
+
+#endif
@@ -0,0 +1,252 @@
+/**
+ *
+ * Per node delivery counters module for project athena-green CSSE4011
+ *
+ * Copyright Haoxi Tan & Geordie Pearson 2022
+ */
+
+#include <zephyr.h>
+#include <string.h>
+#include <shell/shell.h>
+
+#include "base_stats.h"
+
+/* reports are late rather than new when their sequence number is up to half
+ * the sequence space behind the newest */
+#define SEQ_HALF 128
+#define SEQ_WINDOW 32
+
+/* copies of a contact episode give its start to the second, and are received
+ * a little later than the advert they were made for */
+#define CONTACT_START_SLACK_MS 2000
+
+static struct mobile_stats mobiles[CONFIG_BASE_STATS_NODES];
+static struct static_stats statics[CONFIG_BASE_STATS_NODES];
+
+/* reports by the static nodes they went through, 0 for heard directly */
+static uint32_t path_hops[RELAY_TTL + 1];
+static K_MUTEX_DEFINE(stats_lock);
+
+/**
+ * @brief Finds the counters of a mobile node, taking a free entry
+ *          the first time it is heard.
+ */
+static struct mobile_stats *mobile_stats_get(char m_id)
+{
+    for (int i = 0; i < ARRAY_SIZE(mobiles); i++) {
+        if (mobiles[i].m_id == m_id) {
+            return &mobiles[i];
+        }
+        if (mobiles[i].m_id == 0) {
+            mobiles[i].m_id = m_id;
+            return &mobiles[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Finds the counters of a static node, taking a free entry
+ *          the first time it is heard.
+ */
+static struct static_stats *static_stats_get(int8_t static_id)
+{
+    for (int i = 0; i < ARRAY_SIZE(statics); i++) {
+        if (statics[i].used && statics[i].static_id == static_id) {
+            return &statics[i];
+        }
+        if (!statics[i].used) {
+            statics[i].used = true;
+            statics[i].static_id = static_id;
+            return &statics[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Restarts counting from a sequence number, as for the first
+ *          report of a mobile node.
+ */
+static void seq_restart(struct mobile_stats *ms, uint8_t seq)
+{
+    ms->last_seq = seq;
+    ms->seen = 1;
+    ms->window = 1;
+    ms->resync = false;
+}
+
+/**
+ * @brief Counts a sequence number as new, late or duplicate. Late
+ *          reports within the last SEQ_WINDOW fill in the gap they
+ *          were counted as missed in, if it was counted. Two reports
+ *          in a row far behind the newest mean the mobile node
+ *          rebooted, and counting restarts from them.
+ */
+static void count_seq(struct mobile_stats *ms, uint8_t seq)
+{
+    uint8_t ahead = seq - ms->last_seq;
+    uint8_t behind = ms->last_seq - seq;
+
+    if (ms->received == 0) {
+        seq_restart(ms, seq);
+        ms->received = 1;
+        return;
+    }
+
+    if (ahead == 0) {
+        ms->duplicates++;
+    } else if (ahead < SEQ_HALF) {
+        ms->missed += ahead - 1;
+        ms->seen = ahead < SEQ_WINDOW ? (ms->seen << ahead) | 1 : 1;
+        ms->window = MIN(ms->window + ahead, SEQ_WINDOW);
+        ms->last_seq = seq;
+        ms->received++;
+        ms->resync = false;
+    } else if (behind < ms->window && !(ms->seen & BIT(behind))) {
+        ms->seen |= BIT(behind);
+        ms->missed--;
+        ms->received++;
+    } else if (behind >= SEQ_WINDOW && ms->resync &&
+            (uint8_t) (seq - ms->resync_seq) >= 1 && (uint8_t) (seq - ms->resync_seq) < SEQ_WINDOW) {
+        // the first report far behind was counted as a duplicate, it was new
+        ms->duplicates--;
+        ms->received += 2;
+        ms->resyncs++;
+        seq_restart(ms, seq);
+    } else {
+        // already received, before the first report received, or too late to tell
+        if (behind >= SEQ_WINDOW) {
+            ms->resync = true;
+            ms->resync_seq = seq;
+        }
+        ms->duplicates++;
+    }
+}
+
+/**
+ * @brief Counts an aggregated frame heard from a static node. Every
+ *          report of a frame carries its sequence number, so only the
+ *          first counts, and frames heard again are ignored. Frames
+ *          skipped were lost on the last hop, or only heard by other
+ *          static nodes.
+ */
+static void count_frame(struct static_stats *ss, uint8_t seq, uint8_t hops)
+{
+    uint8_t ahead = seq - ss->last_seq;
+
+    ss->hops = hops;
+    if (ss->frames == 0) {
+        ss->last_seq = seq;
+        ss->frames = 1;
+    } else if (ahead != 0 && ahead < SEQ_HALF) {
+        ss->missed += ahead - 1;
+        ss->last_seq = seq;
+        ss->frames++;
+    }
+}
+
+void stats_report(const struct base_report *report)
+{
+    const struct mobile_ad *mad = report->type == STATIC_ADV_TYPE ? &report->sad.m_ad : &report->mad;
+    struct mobile_stats *ms;
+
+    k_mutex_lock(&stats_lock, K_FOREVER);
+    ms = mobile_stats_get(mad->m_id);
+    if (ms != NULL) {
+        if (report->type == STATIC_ADV_TYPE) {
+            ms->relayed++;
+        } else {
+            ms->direct++;
+        }
+        count_seq(ms, mad->seq);
+    }
+
+    if (report->type == STATIC_ADV_TYPE) {
+        struct static_stats *ss = static_stats_get(report->sad.static_id);
+
+        if (ss != NULL) {
+            ss->reports++;
+        }
+        path_hops[RELAY_HOPS(report->sad.ttl)]++;
+    } else {
+        path_hops[0]++;
+    }
+
+    if (report->framed) {
+        struct static_stats *ss = static_stats_get(report->frame.static_id);
+
+        if (ss != NULL) {
+            count_frame(ss, report->frame.seq, report->frame.hops);
+        }
+    }
+    k_mutex_unlock(&stats_lock);
+}
+
+bool stats_contact(const struct base_report *report)
+{
+    struct mobile_stats *ms;
+    bool new = true;
+
+    k_mutex_lock(&stats_lock, K_FOREVER);
+    ms = mobile_stats_get(report->cad.m_id);
+    if (ms != NULL) {
+        // a copy has the same episode, contact and start, give or take the
+        // rounding of the start to a second. keyed on the start too, as the
+        // episodes count from 0 again when the mobile node reboots
+        for (int i = 0; i < STATS_EPISODES && new; i++) {
+            int32_t diff = (int32_t) (report->uptime - ms->episodes[i].start);
+
+            new = !(ms->episodes[i].contact_id == report->cad.contact_id &&
+                    ms->episodes[i].episode == report->cad.episode &&
+                    diff > -CONTACT_START_SLACK_MS && diff < CONTACT_START_SLACK_MS);
+        }
+        if (new) {
+            ms->episodes[ms->episode_next].episode = report->cad.episode;
+            ms->episodes[ms->episode_next].contact_id = report->cad.contact_id;
+            ms->episodes[ms->episode_next].start = report->uptime;
+            ms->episode_next = (ms->episode_next + 1) % STATS_EPISODES;
+            ms->contacts++;
+        }
+    }
+    k_mutex_unlock(&stats_lock);
+    return new;
+}
+
+void stats_reset(void)
+{
+    k_mutex_lock(&stats_lock, K_FOREVER);
+    memset(mobiles, 0, sizeof(mobiles));
+    memset(statics, 0, sizeof(statics));
+    memset(path_hops, 0, sizeof(path_hops));
+    k_mutex_unlock(&stats_lock);
+}
+
+void stats_print(const struct shell *shell)
+{
+    k_mutex_lock(&stats_lock, K_FOREVER);
+    for (int i = 0; i < ARRAY_SIZE(mobiles) && mobiles[i].m_id != 0; i++) {
+        const struct mobile_stats *ms = &mobiles[i];
+        uint32_t expected = ms->received + ms->missed;
+
+        shell_print(shell, "mobile %d: direct %u relayed %u received %u duplicates %u missed %u delivery %u%% resyncs %u contacts %u",
+                ms->m_id, ms->direct, ms->relayed, ms->received, ms->duplicates, ms->missed,
+                expected ? ms->received * 100 / expected : 0, ms->resyncs, ms->contacts);
+    }
+    for (int i = 0; i < ARRAY_SIZE(statics) && statics[i].used; i++) {
+        const struct static_stats *ss = &statics[i];
+        uint32_t expected = ss->frames + ss->missed;
+
+        if (ss->frames == 0) {
+            shell_print(shell, "static %d: relayed %u", ss->static_id, ss->reports);
+            continue;
+        }
+        shell_print(shell, "static %d: relayed %u hops %d frames %u missed %u delivery %u%%",
+                ss->static_id, ss->reports, ss->hops == HOPS_UNKNOWN ? -1 : ss->hops, ss->frames,
+                ss->missed, ss->frames * 100 / expected);
+    }
+    for (int i = 0; i <= RELAY_TTL; i++) {
+        shell_print(shell, "reports through %d static nodes: %u", i, path_hops[i]);
+    }
+    k_mutex_unlock(&stats_lock);
+}
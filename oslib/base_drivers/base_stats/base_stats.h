@@ -0,0 +1,84 @@
+// Author: Geordie Pearson
+/*
+*************************************************************
+* @file oslib/base_drivers/base_stats/base_stats.h
+* @author Geordie Pearson - 45798232
+* @date 20-05-2022
+* @brief per node delivery counters for base
+*************************************************************
+*/
+
+#ifndef BASE_STATS_H
+#define BASE_STATS_H
+
+#include <zephyr.h>
+#include <shell/shell.h>
+
+#include "base_ble.h"
+
+// contact episodes remembered per mobile node to drop the repeated copies of
+#define STATS_EPISODES 8
+
+/**
+ * delivery counters of the reports of one mobile node
+ **/
+struct mobile_stats {
+	char m_id; // 0 if the entry is free
+	uint8_t last_seq; // newest sequence number received
+	uint32_t seen; // bit i set if report last_seq - i was received
+	uint8_t window; // sequence numbers behind last_seq counted since the first received, up to 32
+	bool resync; // a report far behind last_seq was received, as after a reboot
+	uint8_t resync_seq; // its sequence number
+	uint32_t resyncs; // times the counting restarted after the mobile node rebooted
+	uint32_t direct; // reports heard directly from the mobile node
+	uint32_t relayed; // reports relayed by static nodes
+	uint32_t received; // distinct reports
+	uint32_t duplicates; // reports received more than once
+	uint32_t missed; // sequence numbers skipped and not received since
+	struct {
+		uint8_t episode;
+		char contact_id; // 0 if the place is free
+		uint32_t start; // uptime (ms) the episode started at
+	} episodes[STATS_EPISODES]; // contact episodes received most recently
+	uint8_t episode_next; // place the next new episode is kept in
+	uint32_t contacts; // distinct contact episodes
+};
+
+/**
+ * counters of the reports relayed by one static node, and of the aggregated
+ * frames the base heard from it directly
+ **/
+struct static_stats {
+	int8_t static_id;
+	bool used;
+	uint32_t reports; // reports of mobile nodes it heard itself
+	uint8_t hops; // hops to the base in its last frame
+	uint8_t last_seq; // newest frame sequence number received
+	uint32_t frames; // distinct frames received
+	uint32_t missed; // frame sequence numbers skipped
+};
+
+// Counts a report against its mobile node, the static node that relayed it, the frame
+// it was received in and the static nodes it went through.
+// Must only be called from the output thread.
+// Parameters:
+// 	- report: The report received
+void stats_report(const struct base_report *report);
+
+// Counts a contact episode against its mobile node. Must only be called from the
+// output thread.
+// Parameters:
+// 	- report: The contact episode received
+// Returns:
+// 	true if the episode is new, false if it is a repeat already received
+bool stats_contact(const struct base_report *report);
+
+// Clears all the counters.
+void stats_reset(void);
+
+// Prints the counters of every node on the shell.
+// Parameters:
+// 	- shell: The shell to print on
+void stats_print(const struct shell *shell);
+
+#endif
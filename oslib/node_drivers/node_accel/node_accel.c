@@ -0,0 +1,191 @@
+// Geordie Pearson
+/*
+*************************************************************
+* @file oslib/node_drivers/node_accel/node_accel.c
+* @author Geordie Pearson - 45798232
+* @date 20-05-2022
+* @brief batched LIS2DH accelerometer sampling through its hardware FIFO
+*************************************************************
+*/
+
+#include <zephyr.h>
+#include <device.h>
+#include <devicetree.h>
+#include <drivers/i2c.h>
+#include <drivers/gpio.h>
+#include <sys/byteorder.h>
+
+#include "node_accel.h"
+#include "node_sensors.h"
+#include "node_trace.h"
+
+/* LIS2DH registers */
+#define LIS2DH_CTRL_REG1 0x20
+#define LIS2DH_CTRL_REG3 0x22
+#define LIS2DH_CTRL_REG4 0x23
+#define LIS2DH_CTRL_REG5 0x24
+#define LIS2DH_OUT_X_L 0x28
+#define LIS2DH_FIFO_CTRL_REG 0x2E
+#define LIS2DH_FIFO_SRC_REG 0x2F
+
+#define LIS2DH_AUTO_INCREMENT BIT(7) // set in the register address of a burst
+#define LIS2DH_XYZ_EN 0x07
+#define LIS2DH_I1_WTM BIT(2)
+#define LIS2DH_BDU BIT(7)
+#define LIS2DH_HR BIT(3) // 12 bit samples, 1 mg per digit at +-2 g
+#define LIS2DH_FIFO_EN BIT(6)
+#define LIS2DH_FIFO_MODE_BYPASS 0x00
+#define LIS2DH_FIFO_MODE_STREAM 0x80
+#define LIS2DH_FIFO_OVRN BIT(6)
+#define LIS2DH_FIFO_FSS_MASK 0x1F
+#define LIS2DH_SAMPLE_SHIFT 4 // samples are left justified in 16 bits
+#define LIS2DH_SAMPLE_LEN 6
+
+/* CTRL_REG1 output data rate codes */
+#if CONFIG_NODE_ACCEL_ODR_HZ == 10
+#define ACCEL_ODR 0x2
+#elif CONFIG_NODE_ACCEL_ODR_HZ == 25
+#define ACCEL_ODR 0x3
+#elif CONFIG_NODE_ACCEL_ODR_HZ == 50
+#define ACCEL_ODR 0x4
+#elif CONFIG_NODE_ACCEL_ODR_HZ == 100
+#define ACCEL_ODR 0x5
+#else
+#error "LIS2DH sample rate must be 10, 25, 50 or 100 Hz"
+#endif
+
+// time the FIFO takes to fill up to the watermark
+#define ACCEL_BATCH_MS (CONFIG_NODE_ACCEL_FIFO_WATERMARK * 1000 / CONFIG_NODE_ACCEL_ODR_HZ)
+
+BUILD_ASSERT(CONFIG_NODE_ACCEL_FIFO_WATERMARK < ACCEL_FIFO_DEPTH, "watermark must leave room in the FIFO");
+
+struct accel_stats accel_stats;
+
+static const struct i2c_dt_spec accel_i2c = I2C_DT_SPEC_GET(LIS2DH_NODE);
+
+/* burst buffer, only used by the sensor thread */
+static uint8_t accel_raw[ACCEL_FIFO_DEPTH * LIS2DH_SAMPLE_LEN];
+
+// given by the watermark interrupt
+static K_SEM_DEFINE(accel_sem, 0, 1);
+
+#if DT_NODE_HAS_PROP(LIS2DH_NODE, irq_gpios)
+static const struct gpio_dt_spec accel_irq = GPIO_DT_SPEC_GET_BY_IDX(LIS2DH_NODE, irq_gpios, 0);
+static struct gpio_callback accel_irq_cb;
+static bool accel_irq_ready = false;
+
+/**
+ * FIFO watermark interrupt, wakes the sensor thread to drain the FIFO
+ **/
+static void accel_watermark(const struct device *dev, struct gpio_callback *cb, uint32_t pins) {
+	k_sem_give(&accel_sem);
+}
+
+/**
+ * routes the FIFO watermark to INT1 and listens for it
+ **/
+static int accel_irq_init(void) {
+	int ret;
+
+	if (!device_is_ready(accel_irq.port)) {
+		return -ENODEV;
+	}
+
+	ret = gpio_pin_configure_dt(&accel_irq, GPIO_INPUT);
+	if (ret == 0) {
+		gpio_init_callback(&accel_irq_cb, accel_watermark, BIT(accel_irq.pin));
+		ret = gpio_add_callback(accel_irq.port, &accel_irq_cb);
+	}
+	if (ret == 0) {
+		ret = gpio_pin_interrupt_configure_dt(&accel_irq, GPIO_INT_EDGE_TO_ACTIVE);
+	}
+	if (ret == 0) {
+		ret = i2c_reg_write_byte_dt(&accel_i2c, LIS2DH_CTRL_REG3, LIS2DH_I1_WTM);
+	}
+	accel_irq_ready = ret == 0;
+	return ret;
+}
+#else
+static const bool accel_irq_ready = false;
+
+static int accel_irq_init(void) {
+	return -ENOTSUP;
+}
+#endif
+
+int accel_fifo_init(void) {
+	const uint8_t config[][2] = {
+		// bypass mode empties the FIFO before it is reconfigured
+		{LIS2DH_FIFO_CTRL_REG, LIS2DH_FIFO_MODE_BYPASS},
+		{LIS2DH_CTRL_REG1, (ACCEL_ODR << 4) | LIS2DH_XYZ_EN},
+		{LIS2DH_CTRL_REG4, LIS2DH_BDU | LIS2DH_HR},
+		{LIS2DH_CTRL_REG5, LIS2DH_FIFO_EN},
+		{LIS2DH_FIFO_CTRL_REG, LIS2DH_FIFO_MODE_STREAM | CONFIG_NODE_ACCEL_FIFO_WATERMARK},
+	};
+	int ret;
+
+	if (!device_is_ready(accel_i2c.bus)) {
+		return -ENODEV;
+	}
+
+	for (int i = 0; i < ARRAY_SIZE(config); i++) {
+		ret = i2c_reg_write_byte_dt(&accel_i2c, config[i][0], config[i][1]);
+		if (ret != 0) {
+			return ret;
+		}
+	}
+
+	if (accel_irq_init() != 0) {
+		printk("No accelerometer watermark interrupt, draining every %d ms\n", ACCEL_BATCH_MS);
+	}
+	return 0;
+}
+
+int accel_fifo_read(struct accel_sample *samples) {
+	uint8_t src;
+	int count;
+	int ret;
+
+	if (accel_irq_ready) {
+		// the timeout recovers from a missed edge, the FIFO keeps the samples
+		k_sem_take(&accel_sem, K_MSEC(2 * ACCEL_BATCH_MS));
+	} else {
+		k_msleep(ACCEL_BATCH_MS);
+	}
+
+	ret = i2c_reg_read_byte_dt(&accel_i2c, LIS2DH_FIFO_SRC_REG, &src);
+	if (ret != 0) {
+		return ret;
+	}
+
+	count = src & LIS2DH_FIFO_FSS_MASK;
+	if (src & LIS2DH_FIFO_OVRN) {
+		// a full FIFO reads as 31 unread samples
+		count = ACCEL_FIFO_DEPTH;
+		accel_stats.overruns++;
+	}
+	if (count == 0) {
+		return 0;
+	}
+
+	// the output registers wrap around from OUT_Z_H to OUT_X_L while the FIFO is
+	// enabled, so one burst drains every sample
+	ret = i2c_burst_read_dt(&accel_i2c, LIS2DH_OUT_X_L | LIS2DH_AUTO_INCREMENT, accel_raw,
+			count * LIS2DH_SAMPLE_LEN);
+	if (ret != 0) {
+		return ret;
+	}
+
+	for (int i = 0; i < count; i++) {
+		const uint8_t *raw = &accel_raw[i * LIS2DH_SAMPLE_LEN];
+
+		samples[i].x = (int16_t) sys_get_le16(&raw[0]) >> LIS2DH_SAMPLE_SHIFT;
+		samples[i].y = (int16_t) sys_get_le16(&raw[2]) >> LIS2DH_SAMPLE_SHIFT;
+		samples[i].z = (int16_t) sys_get_le16(&raw[4]) >> LIS2DH_SAMPLE_SHIFT;
+	}
+
+	accel_stats.batches++;
+	accel_stats.samples += count;
+	TRACE_DBG(TRACE_ACCEL_BATCH, count, accel_stats.overruns);
+	return count;
+}
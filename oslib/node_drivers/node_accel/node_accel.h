@@ -0,0 +1,55 @@
+// Geordie Pearson
+/*
+*************************************************************
+* @file oslib/node_drivers/node_accel/node_accel.h
+* @author Geordie Pearson - 45798232
+* @date 20-05-2022
+* @brief batched LIS2DH accelerometer sampling through its hardware FIFO
+*************************************************************
+*/
+
+#ifndef NODE_ACCEL_H
+#define NODE_ACCEL_H
+
+#include <zephyr.h>
+
+// samples held by the LIS2DH FIFO
+#define ACCEL_FIFO_DEPTH 32
+
+/**
+ * one accelerometer sample, in mg
+ **/
+struct accel_sample {
+	int16_t x;
+	int16_t y;
+	int16_t z;
+};
+
+/**
+ * accelerometer FIFO counters
+ **/
+struct accel_stats {
+	uint32_t batches; // FIFO drains
+	uint32_t samples; // samples read
+	uint32_t overruns; // drains that found the FIFO full, so samples were lost
+};
+
+extern struct accel_stats accel_stats;
+
+// Configures the LIS2DH for CONFIG_NODE_ACCEL_ODR_HZ sampling into its FIFO in stream
+// mode, and its INT1 pin for the FIFO watermark when the board wires it up. Takes over
+// the sampling settings from the zephyr driver, which must not be read from afterwards.
+// Returns:
+// 	0 on success, otherwise a negative error code
+int accel_fifo_init(void);
+
+// Waits until the FIFO holds CONFIG_NODE_ACCEL_FIFO_WATERMARK samples, then drains
+// all of it in one I2C burst. Without the watermark interrupt, waits for the time
+// the watermark takes to fill instead.
+// Parameters:
+// 	- samples: The samples read, oldest first, ACCEL_FIFO_DEPTH long
+// Returns:
+// 	The number of samples read, otherwise a negative error code
+int accel_fifo_read(struct accel_sample *samples);
+
+#endif
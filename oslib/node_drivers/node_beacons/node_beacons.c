@@ -0,0 +1,576 @@
+// Geordie Pearson
+/*
+*************************************************************
+* @file oslib/node_drivers/node_beacons/node_beacons.c
+* @author Geordie Pearson - 45798232
+* @date 20-05-2022
+* @brief beacon registry for mobile nodes
+*************************************************************
+*/
+
+#include <zephyr.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/util.h>
+#include <sys/byteorder.h>
+#include <spinlock.h>
+#include <settings/settings.h>
+#include <shell/shell.h>
+
+#include "node_beacons.h"
+#include "node_filter.h"
+
+#define REGISTRY_SIZE CONFIG_NODE_BEACON_REGISTRY_SIZE
+#define REGISTRY_MASK (REGISTRY_SIZE - 1)
+
+BUILD_ASSERT((REGISTRY_SIZE & REGISTRY_MASK) == 0, "beacon registry size must be a power of 2");
+
+/* Defines the ids of free and removed registry slots */
+#define BEACON_ID_EMPTY 0
+#define BEACON_ID_REMOVED ((char) 0xff)
+
+/* settings are stored as beacon/<key as hex> = id */
+#define BEACON_SETTINGS_ROOT "beacon"
+#define BEACON_SETTINGS_NAME_LEN (sizeof(BEACON_SETTINGS_ROOT "/") + 2 * sizeof(struct beacon_key))
+
+/**
+ * open addressed hash table with linear probing. an entry is published by
+ * writing its id last, so the bt rx context never matches a half written key
+ **/
+struct beacon_entry {
+	struct beacon_key key;
+	char id;
+};
+
+static struct beacon_entry registry[REGISTRY_SIZE];
+// slots that are no longer empty, registered or removed
+static uint16_t registry_count = 0;
+
+void beacon_key_from_addr(struct beacon_key *key, const bt_addr_le_t *addr) {
+	memset(key, 0, sizeof(*key));
+	key->kind = BEACON_KEY_ADDR;
+	key->val[0] = addr->type;
+	memcpy(&key->val[1], addr->a.val, sizeof(addr->a.val));
+}
+
+/* ibeacon manufacturer data: apple company id, ibeacon type and length, uuid,
+ * major, minor and tx power */
+#define IBEACON_PREFIX_LEN 4
+#define IBEACON_DATA_LEN (IBEACON_PREFIX_LEN + 16 + 2 + 2 + 1)
+static const uint8_t ibeacon_prefix[IBEACON_PREFIX_LEN] = {0x4c, 0x00, 0x02, 0x15};
+
+/* eddystone service data: eddystone uuid, uid frame type, tx power, namespace
+ * and instance, optionally followed by 2 reserved bytes */
+#define EDDYSTONE_PREFIX_LEN 3
+#define EDDYSTONE_UID_LEN (EDDYSTONE_PREFIX_LEN + 1 + 10 + 6)
+static const uint8_t eddystone_uid_prefix[EDDYSTONE_PREFIX_LEN] = {0xaa, 0xfe, 0x00};
+
+bool beacon_key_from_ad(struct beacon_key *key, const struct net_buf_simple *ad) {
+	const uint8_t *field = ad->data;
+	const uint8_t *end = ad->data + ad->len;
+
+	// each field is a length byte, covering the type byte and the data that follow it
+	while (end - field >= 2 && field[0] != 0 && field[0] < end - field) {
+		uint8_t type = field[1];
+		const uint8_t *data = &field[2];
+		uint8_t data_len = field[0] - 1;
+
+		if (type == BT_DATA_MANUFACTURER_DATA && data_len == IBEACON_DATA_LEN &&
+				memcmp(data, ibeacon_prefix, IBEACON_PREFIX_LEN) == 0) {
+			memset(key, 0, sizeof(*key));
+			key->kind = BEACON_KEY_IBEACON;
+			memcpy(key->val, &data[IBEACON_PREFIX_LEN], 16 + 2 + 2);
+			return true;
+		}
+		if (type == BT_DATA_SVC_DATA16 && data_len >= EDDYSTONE_UID_LEN &&
+				memcmp(data, eddystone_uid_prefix, EDDYSTONE_PREFIX_LEN) == 0) {
+			memset(key, 0, sizeof(*key));
+			key->kind = BEACON_KEY_EDDYSTONE;
+			memcpy(key->val, &data[EDDYSTONE_PREFIX_LEN + 1], 10 + 6);
+			return true;
+		}
+		field += field[0] + 1;
+	}
+	return false;
+}
+
+#define BEACON_NAME_PREFIX_LEN (sizeof(CONFIG_NODE_BEACON_NAME_PREFIX) - 1)
+
+char beacon_name_lookup(const struct net_buf_simple *ad) {
+	const uint8_t *field = ad->data;
+	const uint8_t *end = ad->data + ad->len;
+
+	if (BEACON_NAME_PREFIX_LEN == 0) {
+		return BEACON_ID_EMPTY;
+	}
+
+	while (end - field >= 2 && field[0] != 0 && field[0] < end - field) {
+		uint8_t type = field[1];
+		const uint8_t *data = &field[2];
+		uint8_t data_len = field[0] - 1;
+
+		if ((type == BT_DATA_NAME_SHORTENED || type == BT_DATA_NAME_COMPLETE) &&
+				data_len > CONFIG_NODE_BEACON_NAME_ID_INDEX &&
+				memcmp(data, CONFIG_NODE_BEACON_NAME_PREFIX, BEACON_NAME_PREFIX_LEN) == 0) {
+			char id = data[CONFIG_NODE_BEACON_NAME_ID_INDEX];
+
+			return id != BEACON_ID_REMOVED ? id : BEACON_ID_EMPTY;
+		}
+		field += field[0] + 1;
+	}
+	return BEACON_ID_EMPTY;
+}
+
+/**
+ * FNV-1a hash of the key bytes
+ **/
+static uint32_t beacon_key_hash(const struct beacon_key *key) {
+	const uint8_t *bytes = (const uint8_t *) key;
+	uint32_t hash = 2166136261U;
+
+	for (int i = 0; i < sizeof(*key); i++) {
+		hash ^= bytes[i];
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+/**
+ * find the slot holding key, or if it is not registered the first free or removed
+ * slot on its probe sequence
+ **/
+static struct beacon_entry *registry_find(const struct beacon_key *key, bool *found) {
+	uint32_t index = beacon_key_hash(key) & REGISTRY_MASK;
+	struct beacon_entry *free_slot = NULL;
+
+	for (int i = 0; i < REGISTRY_SIZE; i++) {
+		struct beacon_entry *entry = &registry[index];
+
+		if (entry->id == BEACON_ID_EMPTY) {
+			*found = false;
+			return free_slot != NULL ? free_slot : entry;
+		}
+		if (entry->id == BEACON_ID_REMOVED) {
+			if (free_slot == NULL) {
+				free_slot = entry;
+			}
+		} else if (memcmp(&entry->key, key, sizeof(*key)) == 0) {
+			*found = true;
+			return entry;
+		}
+		index = (index + 1) & REGISTRY_MASK;
+	}
+
+	*found = false;
+	return free_slot;
+}
+
+char beacon_registry_lookup(const struct beacon_key *key) {
+	bool found;
+	struct beacon_entry *entry = registry_find(key, &found);
+
+	return found ? entry->id : BEACON_ID_EMPTY;
+}
+
+/**
+ * insert or update a beacon in ram only
+ **/
+static int registry_insert(const struct beacon_key *key, char id) {
+	bool found;
+	struct beacon_entry *entry = registry_find(key, &found);
+
+	if (id == BEACON_ID_EMPTY || id == BEACON_ID_REMOVED) {
+		return -EINVAL;
+	}
+
+	if (!found) {
+		if (entry == NULL) {
+			return -ENOMEM;
+		}
+		if (entry->id == BEACON_ID_EMPTY) {
+			// keep an empty slot so probing always terminates
+			if (registry_count >= REGISTRY_SIZE - 1) {
+				return -ENOMEM;
+			}
+			registry_count++;
+		}
+		entry->key = *key;
+	}
+	compiler_barrier();
+	entry->id = id;
+	// beacons are let through the scan filter by address
+	scan_filter_invalidate();
+	return 0;
+}
+
+void beacon_registry_foreach(void (*func)(const struct beacon_key *key, char id, void *user_data),
+		void *user_data) {
+	for (int i = 0; i < REGISTRY_SIZE; i++) {
+		char id = registry[i].id;
+
+		if (id != BEACON_ID_EMPTY && id != BEACON_ID_REMOVED) {
+			func(&registry[i].key, id, user_data);
+		}
+	}
+}
+
+static void beacon_settings_name(char *name, const struct beacon_key *key) {
+	size_t len = strlen(BEACON_SETTINGS_ROOT "/");
+
+	memcpy(name, BEACON_SETTINGS_ROOT "/", len);
+	bin2hex((const uint8_t *) key, sizeof(*key), &name[len], BEACON_SETTINGS_NAME_LEN - len);
+}
+
+int beacon_registry_add(const struct beacon_key *key, char id) {
+	char name[BEACON_SETTINGS_NAME_LEN];
+	int ret = registry_insert(key, id);
+
+	if (ret) {
+		return ret;
+	}
+
+	beacon_settings_name(name, key);
+	return settings_save_one(name, &id, sizeof(id));
+}
+
+int beacon_registry_remove(const struct beacon_key *key) {
+	char name[BEACON_SETTINGS_NAME_LEN];
+	char id = BEACON_ID_REMOVED;
+	bool found;
+	struct beacon_entry *entry = registry_find(key, &found);
+
+	if (!found) {
+		return -ENOENT;
+	}
+	entry->id = BEACON_ID_REMOVED;
+	scan_filter_invalidate();
+
+	// stored as removed rather than deleted, so a default beacon stays removed
+	beacon_settings_name(name, key);
+	return settings_save_one(name, &id, sizeof(id));
+}
+
+/**
+ * settings handler, called for every stored beacon/<key> entry on load
+ **/
+static int beacon_settings_set(const char *name, size_t len, settings_read_cb read_cb, void *cb_arg) {
+	struct beacon_key key;
+	const char *next;
+	size_t name_len = settings_name_next(name, &next);
+	char id;
+
+	// keys stored before they grew are shorter, the missing bytes are 0
+	memset(&key, 0, sizeof(key));
+	if (name_len > 2 * sizeof(key) || name_len % 2 != 0 || next != NULL ||
+			hex2bin(name, name_len, (uint8_t *) &key, sizeof(key)) != name_len / 2) {
+		return -ENOENT;
+	}
+	if (len != sizeof(id) || read_cb(cb_arg, &id, sizeof(id)) != sizeof(id)) {
+		return -EINVAL;
+	}
+	if (id == BEACON_ID_REMOVED) {
+		bool found;
+		struct beacon_entry *entry = registry_find(&key, &found);
+
+		if (found) {
+			entry->id = BEACON_ID_REMOVED;
+			scan_filter_invalidate();
+		}
+		return 0;
+	}
+	return registry_insert(&key, id);
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(beacon, BEACON_SETTINGS_ROOT, NULL, beacon_settings_set, NULL, NULL);
+
+/**
+ * register the beacons of CONFIG_NODE_BEACON_DEFAULTS in ram only, given as
+ * comma separated "<id> <addr> <public|random>" entries
+ **/
+static void registry_seed(void) {
+	char defaults[] = CONFIG_NODE_BEACON_DEFAULTS;
+	char *entry_save;
+
+	for (char *entry = strtok_r(defaults, ",", &entry_save); entry != NULL;
+			entry = strtok_r(NULL, ",", &entry_save)) {
+		char *field_save;
+		char *id = strtok_r(entry, " ", &field_save);
+		char *addr_str = strtok_r(NULL, " ", &field_save);
+		char *type = strtok_r(NULL, " ", &field_save);
+		bt_addr_le_t addr;
+		struct beacon_key key;
+
+		if (id == NULL || type == NULL || bt_addr_le_from_str(addr_str, type, &addr)) {
+			printk("Invalid default beacon %s.\n", entry);
+			continue;
+		}
+		beacon_key_from_addr(&key, &addr);
+		registry_insert(&key, id[0]);
+	}
+}
+
+int beacon_registry_init(void) {
+	int ret;
+
+	// the stored beacons are loaded on top, so they can rename or remove a default
+	registry_seed();
+
+	ret = settings_subsys_init();
+
+	if (ret) {
+		printk("Beacon settings init failed with code %d.\n", ret);
+		return ret;
+	}
+
+	ret = settings_load_subtree(BEACON_SETTINGS_ROOT);
+	printk("Beacon registry loaded (%d).\n", ret);
+	return ret;
+}
+
+/* tracked rssi is an ewma kept as fixed point with 4 fractional bits */
+#define RSSI_FRAC_BITS 4
+#define RSSI_ONE (1 << RSSI_FRAC_BITS)
+#define TRACKER_SIZE CONFIG_NODE_BEACON_TRACKED
+
+BUILD_ASSERT(TRACKER_SIZE >= BEACONS, "beacon tracker must hold at least the reported beacons");
+
+/**
+ * beacon heard recently and its smoothed rssi
+ **/
+struct tracked_beacon {
+	char id;
+	int16_t rssi; // fixed point ewma of the rssi
+	uint32_t last_seen; // uptime (ms) of the last sample
+};
+
+static struct tracked_beacon tracked[TRACKER_SIZE];
+static struct k_spinlock tracker_lock;
+
+static bool tracked_fresh(const struct tracked_beacon *entry, uint32_t now) {
+	return entry->id != BEACON_ID_EMPTY &&
+			(now - entry->last_seen) <= CONFIG_NODE_BEACON_EXPIRY_MS;
+}
+
+/**
+ * round a fixed point rssi to the nearest dBm
+ **/
+static int8_t tracked_rssi(const struct tracked_beacon *entry) {
+	int16_t half = entry->rssi < 0 ? -RSSI_ONE / 2 : RSSI_ONE / 2;
+
+	return (entry->rssi + half) / RSSI_ONE;
+}
+
+void beacon_tracker_update(char id, int8_t rssi) {
+	k_spinlock_key_t key = k_spin_lock(&tracker_lock);
+	uint32_t now = k_uptime_get_32();
+	int16_t sample = rssi * RSSI_ONE;
+	struct tracked_beacon *slot = NULL;
+
+	for (int i = 0; i < TRACKER_SIZE; i++) {
+		if (tracked[i].id == id) {
+			slot = &tracked[i];
+			break;
+		}
+	}
+
+	if (slot != NULL && tracked_fresh(slot, now)) {
+		slot->rssi += (sample - slot->rssi) / (1 << CONFIG_NODE_BEACON_EWMA_SHIFT);
+		slot->last_seen = now;
+		k_spin_unlock(&tracker_lock, key);
+		return;
+	}
+
+	if (slot == NULL) {
+		// take an empty or expired place, otherwise replace the weakest beacon
+		// if this one is stronger
+		for (int i = 0; i < TRACKER_SIZE; i++) {
+			if (!tracked_fresh(&tracked[i], now)) {
+				slot = &tracked[i];
+				break;
+			}
+			if (tracked[i].rssi < sample && (slot == NULL || tracked[i].rssi < slot->rssi)) {
+				slot = &tracked[i];
+			}
+		}
+	}
+
+	// a beacon that was not heard for the expiry time restarts its filter
+	if (slot != NULL) {
+		slot->id = id;
+		slot->rssi = sample;
+		slot->last_seen = now;
+	}
+	k_spin_unlock(&tracker_lock, key);
+}
+
+int beacon_tracker_top(struct beacon_report *reports, int k) {
+	k_spinlock_key_t key = k_spin_lock(&tracker_lock);
+	uint32_t now = k_uptime_get_32();
+	bool taken[TRACKER_SIZE] = {false,};
+	int filled = 0;
+
+	for (; filled < k; filled++) {
+		int best = -1;
+
+		for (int i = 0; i < TRACKER_SIZE; i++) {
+			if (!taken[i] && tracked_fresh(&tracked[i], now) &&
+					(best < 0 || tracked[i].rssi > tracked[best].rssi)) {
+				best = i;
+			}
+		}
+		if (best < 0) {
+			break;
+		}
+		taken[best] = true;
+		reports[filled].id = tracked[best].id;
+		reports[filled].rssi = tracked_rssi(&tracked[best]);
+	}
+	k_spin_unlock(&tracker_lock, key);
+
+	for (int i = filled; i < k; i++) {
+		reports[i].id = BEACON_ID_EMPTY;
+		reports[i].rssi = 0;
+	}
+	return filled;
+}
+
+#if defined(CONFIG_SHELL)
+/**
+ * shell command to provision a beacon by address: beacon add <addr> <public|random> <id>
+ **/
+static int cmd_beacon_add(const struct shell *shell, size_t argc, char **argv) {
+	bt_addr_le_t addr;
+	struct beacon_key key;
+	int ret = bt_addr_le_from_str(argv[1], argv[2], &addr);
+
+	if (ret) {
+		shell_error(shell, "invalid address");
+		return ret;
+	}
+
+	beacon_key_from_addr(&key, &addr);
+	ret = beacon_registry_add(&key, argv[3][0]);
+	if (ret) {
+		shell_error(shell, "failed to add beacon (%d)", ret);
+	}
+	return ret;
+}
+
+/**
+ * parse a hex string into len bytes, ignoring any '-' separators
+ **/
+static int parse_hex(const char *str, uint8_t *buf, size_t len) {
+	char hex[2 * sizeof(struct beacon_key)];
+	size_t hex_len = 0;
+
+	for (; *str != '\0'; str++) {
+		if (*str == '-') {
+			continue;
+		}
+		if (hex_len >= sizeof(hex)) {
+			return -EINVAL;
+		}
+		hex[hex_len++] = *str;
+	}
+	if (hex_len != 2 * len || hex2bin(hex, hex_len, buf, len) != len) {
+		return -EINVAL;
+	}
+	return 0;
+}
+
+/**
+ * shell command to provision an ibeacon: beacon ibeacon <uuid> <major> <minor> <id>
+ **/
+static int cmd_beacon_ibeacon(const struct shell *shell, size_t argc, char **argv) {
+	struct beacon_key key = {.kind = BEACON_KEY_IBEACON};
+	uint16_t major = strtoul(argv[2], NULL, 0);
+	uint16_t minor = strtoul(argv[3], NULL, 0);
+	int ret;
+
+	if (parse_hex(argv[1], key.val, 16)) {
+		shell_error(shell, "invalid uuid");
+		return -EINVAL;
+	}
+	sys_put_be16(major, &key.val[16]);
+	sys_put_be16(minor, &key.val[18]);
+
+	ret = beacon_registry_add(&key, argv[4][0]);
+	if (ret) {
+		shell_error(shell, "failed to add beacon (%d)", ret);
+	}
+	return ret;
+}
+
+/**
+ * shell command to provision an eddystone uid beacon: beacon eddystone <namespace> <instance> <id>
+ **/
+static int cmd_beacon_eddystone(const struct shell *shell, size_t argc, char **argv) {
+	struct beacon_key key = {.kind = BEACON_KEY_EDDYSTONE};
+	int ret;
+
+	if (parse_hex(argv[1], key.val, 10) || parse_hex(argv[2], &key.val[10], 6)) {
+		shell_error(shell, "invalid namespace or instance");
+		return -EINVAL;
+	}
+
+	ret = beacon_registry_add(&key, argv[3][0]);
+	if (ret) {
+		shell_error(shell, "failed to add beacon (%d)", ret);
+	}
+	return ret;
+}
+
+/**
+ * shell command to remove a beacon by address, or by its key as printed by beacon list:
+ * beacon rm <addr> <public|random> | beacon rm <key>
+ **/
+static int cmd_beacon_rm(const struct shell *shell, size_t argc, char **argv) {
+	bt_addr_le_t addr;
+	struct beacon_key key;
+	int ret;
+
+	if (argc == 2) {
+		ret = parse_hex(argv[1], (uint8_t *) &key, sizeof(key));
+	} else {
+		ret = bt_addr_le_from_str(argv[1], argv[2], &addr);
+		beacon_key_from_addr(&key, &addr);
+	}
+	if (ret) {
+		shell_error(shell, "invalid address or key");
+		return ret;
+	}
+
+	ret = beacon_registry_remove(&key);
+	if (ret) {
+		shell_error(shell, "failed to remove beacon (%d)", ret);
+	}
+	return ret;
+}
+
+/**
+ * shell command to list the registered beacons
+ **/
+static int cmd_beacon_list(const struct shell *shell, size_t argc, char **argv) {
+	for (int i = 0; i < REGISTRY_SIZE; i++) {
+		char hex[2 * sizeof(struct beacon_key) + 1];
+
+		if (registry[i].id == BEACON_ID_EMPTY || registry[i].id == BEACON_ID_REMOVED) {
+			continue;
+		}
+		bin2hex((const uint8_t *) &registry[i].key, sizeof(registry[i].key), hex, sizeof(hex));
+		shell_print(shell, "%c %s", registry[i].id, hex);
+	}
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(beacon_cmds,
+	SHELL_CMD_ARG(add, NULL, "<addr> <public|random> <id>", cmd_beacon_add, 4, 0),
+	SHELL_CMD_ARG(ibeacon, NULL, "<uuid> <major> <minor> <id>", cmd_beacon_ibeacon, 5, 0),
+	SHELL_CMD_ARG(eddystone, NULL, "<namespace> <instance> <id>", cmd_beacon_eddystone, 4, 0),
+	SHELL_CMD_ARG(rm, NULL, "<addr> <public|random> | <key>", cmd_beacon_rm, 2, 1),
+	SHELL_CMD(list, NULL, "list registered beacons", cmd_beacon_list),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(beacon, &beacon_cmds, "beacon registry", NULL);
+#endif
@@ -0,0 +1,111 @@
+// Geordie Pearson
+/*
+*************************************************************
+* @file oslib/node_drivers/node_beacons/node_beacons.h
+* @author Geordie Pearson - 45798232
+* @date 20-05-2022
+* @brief beacon registry for mobile nodes
+*************************************************************
+*/
+
+#ifndef NODE_BEACONS_H
+#define NODE_BEACONS_H
+
+#include <zephyr.h>
+#include <bluetooth/bluetooth.h>
+#include <net/buf.h>
+
+#include "node_ble.h"
+
+/* Defines the kinds of key a beacon can be registered under */
+#define BEACON_KEY_ADDR 0 // val holds the address type then the 6 address bytes
+#define BEACON_KEY_IBEACON 1 // val holds the 16 byte uuid, then the major and minor (big endian)
+#define BEACON_KEY_EDDYSTONE 2 // val holds the 10 byte namespace then the 6 byte instance of an eddystone uid
+
+#define BEACON_KEY_LEN 20
+
+/**
+ * registry key identifying a beacon
+ **/
+struct beacon_key {
+	uint8_t kind;
+	uint8_t val[BEACON_KEY_LEN]; // unused bytes are 0
+};
+
+// Builds the registry key of a beacon from its bluetooth address.
+// Parameters:
+// 	- key: The key to fill in
+// 	- addr: The address of the beacon
+void beacon_key_from_addr(struct beacon_key *key, const bt_addr_le_t *addr);
+
+// Builds the registry key of a beacon from the ibeacon or eddystone uid frame in its
+// advert, reading the advert in place.
+// Parameters:
+// 	- key: The key to fill in
+// 	- ad: The advertising data of the beacon
+// Returns:
+// 	true if the advert holds an ibeacon or eddystone uid frame
+bool beacon_key_from_ad(struct beacon_key *key, const struct net_buf_simple *ad);
+
+// Looks up the id of a beacon by its advertised name: a name starting with
+// CONFIG_NODE_BEACON_NAME_PREFIX reports the beacon as the character at
+// CONFIG_NODE_BEACON_NAME_ID_INDEX. Reads the advert in place.
+// Parameters:
+// 	- ad: The advertising data of the beacon
+// Returns:
+// 	The id of the beacon, or 0 if its name does not match
+char beacon_name_lookup(const struct net_buf_simple *ad);
+
+// Registers the default beacons (CONFIG_NODE_BEACON_DEFAULTS), then loads the
+// provisioned beacons from the settings subsystem into the registry.
+// Returns:
+// 	0 on success, otherwise a negative error code
+int beacon_registry_init(void);
+
+// Looks up the id of a beacon. Safe to call from the bt rx context.
+// Parameters:
+// 	- key: The key of the beacon
+// Returns:
+// 	The id of the beacon, or 0 if it is not registered
+char beacon_registry_lookup(const struct beacon_key *key);
+
+// Registers a beacon and stores it in settings so it persists across reboots.
+// Parameters:
+// 	- key: The key of the beacon
+// 	- id: The id to report the beacon as
+// Returns:
+// 	0 on success, -ENOMEM if the registry is full, otherwise a settings error code
+int beacon_registry_add(const struct beacon_key *key, char id);
+
+// Removes a beacon from the registry, and stores it as removed in settings so a
+// default beacon is not registered again on the next boot.
+// Parameters:
+// 	- key: The key of the beacon
+// Returns:
+// 	0 on success, -ENOENT if the beacon is not registered
+int beacon_registry_remove(const struct beacon_key *key);
+
+// Calls func for every registered beacon.
+// Parameters:
+// 	- func: The function to call with the key and id of each beacon
+// 	- user_data: Passed on to func
+void beacon_registry_foreach(void (*func)(const struct beacon_key *key, char id, void *user_data),
+		void *user_data);
+
+// Feeds an rssi sample of a registered beacon into the top beacon tracker.
+// Safe to call from the bt rx context.
+// Parameters:
+// 	- id: The id of the beacon
+// 	- rssi: The rssi the beacon was heard with
+void beacon_tracker_update(char id, int8_t rssi);
+
+// Gets the strongest beacons heard within the expiry time, strongest first.
+// Unused places are filled with id 0.
+// Parameters:
+// 	- reports: The places to fill in
+// 	- k: The number of places
+// Returns:
+// 	The number of beacons filled in
+int beacon_tracker_top(struct beacon_report *reports, int k);
+
+#endif
@@ -22,15 +22,53 @@
 
 #include <node_sensors.h>
 #include "node_ble.h"
+#include "node_relay.h"
+#include "node_tdma.h"
+#include "node_beacons.h"
+#include "node_filter.h"
+#include "node_trace.h"
+#include "node_duty.h"
+#include "node_history.h"
+#include "node_bulk.h"
+#include "node_contact.h"
 
 /* states */
 #define SCANNING 0
 #define ADVERTISING 1
+#define SLEEPING 2 // mobile radio off between cycles while still
+#define HISTORY 3 // mobile sending the reports stored while out of range
+#define HISTORY_WAIT 4 // mobile scanning until its own tdma slot to send stored reports
 
-#define TOO_CLOSE_RSSI -55
+/* advertising interval for tdma slots and relay slots (20 ms), short enough
+ * that every slot gets at least one advertising event */
+#define FAST_ADV_INTERVAL 0x0020
+
+/* static nodes relaying on the coded phy are only heard by scanning it as well */
+#if defined(CONFIG_NODE_RELAY_PHY_CODED)
+#define SCAN_OPT_CODED BT_LE_SCAN_OPT_CODED
+#else
+#define SCAN_OPT_CODED BT_LE_SCAN_OPT_NONE
+#endif
+
+/* scanning is passive, as nothing we listen for has scan response data. with
+ * scan filtering, nodes are matched on their address, so they advertise with
+ * their identity address instead of a private one */
+#if defined(CONFIG_NODE_SCAN_FILTER)
+#define ADV_OPT_IDENTITY BT_LE_ADV_OPT_USE_IDENTITY
+#define SCAN_PARAM BT_LE_SCAN_PARAM(BT_LE_SCAN_TYPE_PASSIVE, BT_LE_SCAN_OPT_FILTER_ACCEPT_LIST | SCAN_OPT_CODED, \
+		BT_GAP_SCAN_FAST_INTERVAL, BT_GAP_SCAN_FAST_WINDOW)
+#else
+#define ADV_OPT_IDENTITY 0
+#define SCAN_PARAM BT_LE_SCAN_PARAM(BT_LE_SCAN_TYPE_PASSIVE, BT_LE_SCAN_OPT_FILTER_DUPLICATE | SCAN_OPT_CODED, \
+		BT_GAP_SCAN_FAST_INTERVAL, BT_GAP_SCAN_FAST_WINDOW)
+#endif
 
 /**
- * list of beacons we have & the [2] [1] [0] (last 3 bytes in small endian) of their MAC addresses:
+ * beacons are identified by their full address, or by their ibeacon or
+ * eddystone uid frame, through the beacon registry (node_beacons), seeded with
+ * the Kontakt beacons below (NODE_BEACON_DEFAULTS), provisioned at runtime and
+ * stored in settings, or by a name starting with "401" (NODE_BEACON_NAME_PREFIX).
+ * the beacons we have:
  * A
  * P (Kontakt) e6:59:ba:5c:80:0a
  * O (Kontakt) ec:eb:da:30:c4:58
@@ -40,50 +78,21 @@
  * K (slow) fd:e0:8d:fa:3e:4a
  **/
 
-/** beacon macs is an equal length array to beacon_names which 
-  * together makes up a mapping between addresses and ibeacon IDs
-**/
-// this macro must reflect the len of the array
-#define NUM_BEACON_HARDCODED_MACS 2
-char * beacon_macs[] = {"\x5c\x80\x0a", "\x30\xc4\x58"}; //last 3 bytes only
-char beacon_ids[] = {'P', 'O'};
-
-uint32_t last_switchtime = 0;
 bool time_corrected = false;
-bool state = SCANNING;
-uint32_t last_too_close = 0;
-bool too_close = false;
+uint8_t state = SCANNING;
 
 struct advert_user_data {
 	int8_t rssi;
 	const bt_addr_le_t *addr;
+	bool useful; // set when the advert was from a beacon or node
 };
 
 bool adv_found = false;
 
 
-#ifndef MOBILE_NODE
-/**
- * these two flags are for the static node to track if they have picked up 
- * anything during scanning phase to relay during advertising phase
- **/
-bool mobile_adv_found = false;
-bool static_adv_found = false;
-// true for scanning for mobile ads, otherwise for scanning for static ads
-bool is_turn_for_mobile_ads = false; 
-#endif
-
 bool is_advertising = false;
 bool is_scanning = false;
 
-// might have a few found m ads?
-struct mobile_ad found_m_adv;
-struct static_ad found_s_adv;
-
-// beacons tracked
-char top_beacon_ids [BEACONS] = {0,};
-int8_t top_beacon_strengths [BEACONS] = {0xff,};
-
 // static bool ble_advertising = false;
 
 /**
@@ -91,8 +100,6 @@ int8_t top_beacon_strengths [BEACONS] = {0xff,};
  **/
 void init_bt(void) {
 	int ret;
-	step_buffer = 0;
-	dir_buffer = 0;
 
 	ret = bt_enable(NULL);
 	if (ret) {
@@ -101,66 +108,36 @@ void init_bt(void) {
 	}
 }
 
+#ifndef MOBILE_NODE
 /**
- * add or update the top N (3) beacon IDs and RSSIs
- * 
+ * queue a mobile report heard directly, or replayed from a mobile node's
+ * history, to be relayed once
  **/
-void add_or_update_beacon(char id, int8_t rssi) {
-	for (int i = 0; i < BEACONS; ++i)
-	{
-		// if id matches, then update. else add a new entry
-		if (id == top_beacon_ids[i]) {
-			top_beacon_strengths[i] = rssi;
-			printk("[add_or_update_beacon] replaced ibeacon %c: %d\n", id, rssi);
-			return; // done now
-		}
-	}
-
-	// no past id's matched. update or add new entry
-	for (int i = 0; i < BEACONS; ++i)
-	{
-		if (top_beacon_ids[i] == 0) { // initial / empty is 0
-			top_beacon_ids[i] = id;
-			top_beacon_strengths[i] = rssi;
-			printk("[add_or_update_beacon] new ibeacon %c: %d\n", id, rssi);
-			return;
-		}
+static void queue_mobile_report(const struct mobile_ad *m_ad, int8_t rssi, size_t len) {
+	if (!relay_seen_check(M_ID, m_ad->m_id, m_ad->seq) &&
+			relay_ring_put(RELAY_RECORD_MOBILE, rssi, m_ad, len) == 0) {
+		relay_seen_mark(M_ID, m_ad->m_id, m_ad->seq);
 	}
-
-	// if its here then none of the id's were empty, get the least strong beacon and update it
-	int weakest = 2;
-	int minrssi = 0;
-	for (int i = 0; i < BEACONS; ++i)
-	{
-		if (top_beacon_strengths[i] < minrssi) {
-			minrssi = top_beacon_strengths[i];
-			weakest = i;
-		}
-	}
-
-	printk("[add_or_update_beacon] updated index[%d] %c (%d) -> %c (%d)\n", weakest, top_beacon_ids[weakest], top_beacon_strengths[weakest], id, rssi);
-	top_beacon_ids[weakest] = id;
-	top_beacon_strengths[weakest] = rssi;
-
-
 }
 
 /**
- * match iBeacon last 3 bytes of mac addr to id
+ * queue a report relayed by another static node to be relayed again,
+ * unless it is our own report or its ttl has run out
  **/
-static char match_addr_to_id(uint8_t *mac) {
-	for (int i = 0; i < NUM_BEACON_HARDCODED_MACS; i++)
-	{
-		// printk("match_addr_to_id i %d\n",i);
-		// printk("i:%d mac2:%02x i2:%02x mac1:%02x i1:%02x mac0:%02x i0:%02x\n",i,mac[2],beacon_macs[i][2], mac[1],beacon_macs[i][1],mac[0],beacon_macs[i][0]);
-		if (mac[0] == beacon_macs[i][2] && mac[1] == beacon_macs[i][1] && mac[2] == beacon_macs[i][0] ) {
-			// printk("match found: %c\n",beacon_ids[i]);
-			return beacon_ids[i];
-		}
-
+static bool queue_static_report(const struct static_ad *s_ad, int8_t rssi) {
+	if (s_ad->static_id == M_ID || s_ad->ttl <= 1) {
+		return false;
+	}
+	if (relay_seen_check(s_ad->static_id, s_ad->m_ad.m_id, s_ad->m_ad.seq)) {
+		return true; // already relayed it once
 	}
-	return 0;
+	// the ttl is decremented when it is relayed
+	if (relay_ring_put(RELAY_RECORD_STATIC, rssi, s_ad, sizeof(*s_ad)) == 0) {
+		relay_seen_mark(s_ad->static_id, s_ad->m_ad.m_id, s_ad->m_ad.seq);
+	}
+	return true;
 }
+#endif
 
 /**
  * @brief Callback for BLE scanning, checks weather the returned 
@@ -176,107 +153,112 @@ static bool parse_device(struct bt_data *data, void *user_data)
 {
     
     struct advert_user_data *adv_user_dat = user_data;
+
+    // base beacon, or repeated by a static node ahead of its relay frame
+    if (data->type == BASE_ADV_TYPE && data->data_len >= sizeof(struct base_ad)) {
+    	struct base_ad bad;
+    	memcpy(&bad, data->data, sizeof(bad));
+    	adv_user_dat->useful = true;
+#ifndef MOBILE_NODE
+    	relay_route_update(bad.hops);
+    	// only take the time from nodes closer to the base, so sync cannot loop between statics
+    	if (bad.hops < relay_route_hops()) {
+    		tdma_sync_sample(((int64_t) bad.net_epoch << 32) | bad.net_time);
+    	}
+#else
+    	tdma_sync_sample(((int64_t) bad.net_epoch << 32) | bad.net_time);
+    	history_link_heard();
+#endif
+    	return true; // keep parsing, a relay frame may follow
+    }
     
 #if MOBILE_NODE == 1
     if (data->type == MOBILE_ADV_TYPE)
     {
-        printk("mobile adv found, rssi: %d\n", adv_user_dat->rssi);
+        TRACE_DBG(TRACE_RX_MOBILE, adv_user_dat->rssi, data->data_len);
+        adv_user_dat->useful = true;
         // time synchonrization: when we find a packet, we switch to scanning mode?
         adv_found = true;
 
-        // detect if it is too close
-        if (adv_user_dat->rssi > TOO_CLOSE_RSSI) {
-        	too_close = true;
-        	last_too_close = k_uptime_get_32();
+        // track how close it is, for contact episodes
+        if (IS_ENABLED(CONFIG_NODE_CONTACT) && data->data_len >= sizeof(struct mobile_ad)) {
+        	contact_heard(((const struct mobile_ad *) data->data)->m_id, adv_user_dat->rssi);
         }
 
         return false;
         
     }
 
-    // if (data->type == BT_DATA_NAME_SHORTENED || data->type==BT_DATA_NAME_COMPLETE ) {
-    if (data->type == BT_DATA_NAME_SHORTENED || data->type==BT_DATA_NAME_COMPLETE ) {
-     	char name[7];
-		strncpy(name, data->data, 6);
-		// printk("found name:%s\n", name);
-		name[6] = 0;
-		// char* name = data;
-		if (data->data != NULL && data->data_len >= 6) {
-			// if (strncmp(data->data, "Kontakt", 7) == 0) {
-				// printk("ibeacon name:%s data_len:%d type:%d rssi:%d\n", name, data->data_len, data->type, adv_user_dat->rssi);	
-			// }
-
-    		if (strncmp(data->data, "401", 3) == 0) {
-    			
-    			// printk("detected ibeacon: %s", name);
-    			// for (int i = 0; i < data->data_len; ++i)
-    			// {
-    			// 	printk("%02x", data->data[i]);
-    			// }
-
-    			char id = name[5];
-    			printk("beacon name:%s data_len:%d type:%d rssi:%d id:%c mac %02x:%02x:%02x:%02x:%02x:%02x\n", name, data->data_len, data->type, adv_user_dat->rssi, id, adv_user_dat->addr->a.val[5],adv_user_dat->addr->a.val[4],adv_user_dat->addr->a.val[3],adv_user_dat->addr->a.val[2],adv_user_dat->addr->a.val[1],adv_user_dat->addr->a.val[0]);
-    			// planning to just match by last 3 bytes of mac addr (2 1 0) in small endian
-    			add_or_update_beacon(id, adv_user_dat->rssi);
-
-    			// add_or_update_ranging_info(adv_user_dat->rssi, 0x42,  adv_user_dat->addr->a.val);
-    		}
-			if (strncmp(data->data, "Kontakt", 7) == 0) {
-				char id = match_addr_to_id(adv_user_dat->addr->a.val);
-				printk("beacon name:%s data_len:%d type:%d rssi:%d id:%c mac %02x:%02x:%02x:%02x:%02x:%02x\n", name, data->data_len, data->type, adv_user_dat->rssi, id, adv_user_dat->addr->a.val[5],adv_user_dat->addr->a.val[4],adv_user_dat->addr->a.val[3],adv_user_dat->addr->a.val[2],adv_user_dat->addr->a.val[1],adv_user_dat->addr->a.val[0]);
-    			
-				add_or_update_beacon(id, adv_user_dat->rssi);
-			}
-
-		}
-
+    // a static node relay frame, so the reports we make are being heard
+    if (data->type == STATIC_ADV_TYPE || data->type == AGG_ADV_TYPE) {
+        adv_user_dat->useful = true;
+        history_link_heard();
+        return false;
+    }
 
-		return false;
-     }
-  //    if (data -> type == BT_DATA_MANUFACTURER_DATA ) {
-		// 	printk("manuf rssi:%d mac %02x:%02x:%02x:%02x:%02x:%02x\n", adv_user_dat->rssi, adv_user_dat->addr->a.val[5],adv_user_dat->addr->a.val[4],adv_user_dat->addr->a.val[3],adv_user_dat->addr->a.val[2],adv_user_dat->addr->a.val[1],adv_user_dat->addr->a.val[0]);
-		// }
+    // beacons are matched on their address in device_found before the advert is parsed
 
 #else
     // STATIC NODE ONLY CODE
 
-    // XXX: prioritize static adv?
-    if (is_turn_for_mobile_ads) {
-    	if (data->type == MOBILE_ADV_TYPE) {
-	    	printk("mobile adv found by SN %d\n", adv_user_dat->rssi);
-	        // time synchonrization: when we find a packet, we switch to scanning mode?
-	        mobile_adv_found = true;
-
-	        // store it in the found adv
-	        memcpy(&found_m_adv, data->data, sizeof(found_m_adv));
-	        printk("m_id: %02x, b1 %c b1r %d b2 %c b2r %d b3 %c b3r %d\n", found_m_adv.m_id,
-	        	found_m_adv.b1_id, found_m_adv.b1_rssi, found_m_adv.b2_id, found_m_adv.b2_rssi,
-	        	found_m_adv.b3_id, found_m_adv.b3_rssi);
-	        return false;
-	    }
+    // every mobile report heard is queued, the ring holds them until the relay slot
+    if (data->type == MOBILE_ADV_TYPE) {
+    	TRACE_DBG(TRACE_RX_MOBILE, adv_user_dat->rssi, data->data_len);
+    	adv_user_dat->useful = true;
+        // queue it to be relayed during the advertising phase, once per report,
+        // unless it reports another number of beacons
+        if (data->data_len == sizeof(struct mobile_ad)) {
+        	queue_mobile_report((const struct mobile_ad *) data->data, adv_user_dat->rssi, data->data_len);
+        }
+        return false;
+    }
 
+    // reports a mobile node stored while out of range are relayed like live ones
+    if (data->type == HISTORY_ADV_TYPE && data->data_len >= sizeof(struct history_ad)) {
+    	const struct history_ad *h_ad = (const struct history_ad *) data->data;
+    	uint8_t count = MIN(h_ad->count,
+    			(data->data_len - sizeof(struct history_ad)) / sizeof(struct history_report));
+
+    	adv_user_dat->useful = true;
+    	// reports with another number of beacons do not fill the frame exactly
+    	if (data->data_len != sizeof(struct history_ad) + h_ad->count * sizeof(struct history_report)) {
+    		return false;
+    	}
+    	for (int i = 0; i < count; i++) {
+    		const struct mobile_ad *m_ad = &h_ad->reports[i].m_ad;
+
+    		// the rssi of the frame says nothing of where the report was made
+    		queue_mobile_report(m_ad, RSSI_NONE, sizeof(*m_ad));
+    	}
+    	return false;
     }
 
-    if (data -> type == STATIC_ADV_TYPE) {
-    	printk("static adv found by SN %d\n", adv_user_dat->rssi);
-    	
-    	
-    	if ( ((struct static_ad*) data->data)->static_id != M_ID && 
-    			((struct static_ad*) data->data)->ttl > 1) { // do not relay my own packet
-    		memcpy(&found_s_adv, data->data, sizeof(found_s_adv));
-    		// dont forward dead packets
-    		static_adv_found = true;
-    		found_s_adv.ttl -= 1;
-	    	printk("ttl: %d, s_id: %02x m_id: %02x, b1 %c b1r %d b2 %c b2r %d b3 %c b3r %d\n", found_s_adv.ttl, found_s_adv.static_id,
-	    		found_s_adv.m_ad.m_id, found_s_adv.m_ad.b1_id, found_s_adv.m_ad.b1_rssi, 
-	    		found_s_adv.m_ad.b2_id, found_s_adv.m_ad.b2_rssi,
-	        	found_s_adv.m_ad.b3_id, found_s_adv.m_ad.b3_rssi);
-	    	return false;
-    	} 
-    	// else { printk("static adv came from me: %02x ttl %02x\n", ((struct static_ad*) data->data)->static_id,  ((struct static_ad*) data->data)->ttl);
-    	
+    // a single relayed report carries no hop count, so it cannot be checked
+    // against the gradient and is not relayed, static nodes send relay frames
+    if (data->type == STATIC_ADV_TYPE) {
+    	TRACE_DBG(TRACE_RX_STATIC, adv_user_dat->rssi, data->data_len);
+    	return false;
     }
 
+    if (data->type == AGG_ADV_TYPE && data->data_len >= sizeof(struct agg_ad)) {
+    	const struct agg_ad *agg = (const struct agg_ad *) data->data;
+    	uint8_t count = (data->data_len - sizeof(struct agg_ad)) / sizeof(struct static_ad);
+
+    	TRACE_DBG(TRACE_RX_AGG, adv_user_dat->rssi, count, agg->hops);
+    	adv_user_dat->useful = true;
+    	if (agg->beacons != BEACONS) {
+    		return false;
+    	}
+    	relay_route_update(agg->hops);
+    	// only forward reports that move closer to the base
+    	if (!relay_route_should_forward(agg->hops)) {
+    		return false;
+    	}
+    	for (int i = 0; i < count; i++) {
+    		queue_static_report(&agg->reports[i], adv_user_dat->rssi);
+    	}
+    	return false;
+    }
     
 
 
@@ -303,10 +285,37 @@ static void device_found(const bt_addr_le_t *addr, int8_t rssi, uint8_t type,
     // all events, not just connectable ones
     struct advert_user_data user_data = {
     		.rssi = rssi,
-    		.addr = addr
+    		.addr = addr,
+    		.useful = false
     	};
+
+    scan_filter_stats.callbacks++;
+
+#if MOBILE_NODE == 1
+    // known beacons are matched on their address, or on the ibeacon or eddystone uid
+    // frame read in place from the advert
+    struct beacon_key key;
+    char id;
+
+    beacon_key_from_addr(&key, addr);
+    id = beacon_registry_lookup(&key);
+    if (!id && beacon_key_from_ad(&key, ad)) {
+    	id = beacon_registry_lookup(&key);
+    }
+    if (!id) {
+    	id = beacon_name_lookup(ad);
+    }
+    if (id) {
+    	beacon_tracker_update(id, rssi);
+    	scan_filter_stats.useful++;
+    	return;
+    }
+#endif
     // LOG_INF("some device found");
     bt_data_parse(ad, parse_device, &user_data);
+    if (user_data.useful) {
+    	scan_filter_stats.useful++;
+    }
 }
 
 /**
@@ -317,15 +326,16 @@ static void start_scan(void)
 {
     int err;
 
-    err = bt_le_scan_start(BT_LE_SCAN_ACTIVE, device_found);
+    // the accept list can only be changed while not scanning
+    scan_filter_apply();
+    err = bt_le_scan_start(SCAN_PARAM, device_found);
     if (err)
     {
-        printk("Scanning failed to start (err %d)\n", err);
+        TRACE_ERR(TRACE_SCAN_START, err);
         return;
     }
 
-    printk("Scanning successfully started\n");
-    
+    TRACE_INF(TRACE_SCAN_START, err);
 }
 
 
@@ -344,251 +354,638 @@ static const struct gpio_dt_spec led = GPIO_DT_SPEC_GET(LED0_NODE, gpios);
 
 #endif
 
+/**
+ * radio role scheduler - a k_timer armed on absolute window boundaries wakes
+ * the bt thread exactly when the radio has to switch between scanning and
+ * advertising, so windows do not drift and the thread sleeps in between
+ **/
+K_SEM_DEFINE(role_switch_sem, 0, 1);
+
+static void role_timer_expiry(struct k_timer *timer) {
+	k_sem_give(&role_switch_sem);
+}
+
+K_TIMER_DEFINE(role_timer, role_timer_expiry, NULL);
+
+// absolute uptime (ticks) of the next window boundary
+static int64_t next_switch_ticks;
+
+// window boundary jitter since the last report
+static uint32_t sched_windows = 0;
+static uint32_t sched_jitter_max_us = 0;
+static uint64_t sched_jitter_sum_us = 0;
+
+/**
+ * arm the role timer for the boundary window_ms after the previous one.
+ * boundaries are accumulated from the ideal schedule, not from when the
+ * thread woke up, so wake up latency never adds up across windows
+ **/
+static void schedule_next_switch(uint32_t window_ms) {
+	int64_t now = k_uptime_ticks();
+
+	next_switch_ticks += k_ms_to_ticks_ceil64(window_ms);
+	if (next_switch_ticks <= now) {
+		// fell a whole window behind, restart the schedule from now
+		next_switch_ticks = now + k_ms_to_ticks_ceil64(window_ms);
+	}
+	k_timer_start(&role_timer, K_TIMEOUT_ABS_TICKS(next_switch_ticks), K_NO_WAIT);
+}
+
+/**
+ * arm the role timer for an absolute boundary
+ **/
+static void schedule_switch_at(int64_t uptime_ms) {
+	next_switch_ticks = k_ms_to_ticks_ceil64(uptime_ms);
+	k_timer_start(&role_timer, K_TIMEOUT_ABS_TICKS(next_switch_ticks), K_NO_WAIT);
+}
+
+/**
+ * end the scanning window window_ms from now, or when synchronised to the base
+ * and running the tdma schedule, at the start of our own slot
+ **/
+static void schedule_scan_window(uint8_t slot, uint32_t window_ms) {
+	if (IS_ENABLED(CONFIG_NODE_TDMA) && tdma_synced()) {
+		schedule_switch_at(tdma_next_slot(slot));
+		return;
+	}
+	schedule_next_switch(window_ms);
+}
+
+/**
+ * end the advertising window window_ms from now, or at the end of our own slot
+ **/
+static void schedule_adv_window(uint8_t slot, uint32_t window_ms) {
+	if (IS_ENABLED(CONFIG_NODE_TDMA) && tdma_synced()) {
+		window_ms = TDMA_SLOT_LEN(slot);
+	}
+	schedule_next_switch(window_ms);
+}
+
+/**
+ * measure how late the thread acted on the boundary it was woken for
+ **/
+static void record_switch_jitter(void) {
+	int64_t late = k_uptime_ticks() - next_switch_ticks;
+	uint32_t late_us = k_ticks_to_us_floor32(late > 0 ? late : 0);
+
+	sched_windows++;
+	sched_jitter_sum_us += late_us;
+	if (late_us > sched_jitter_max_us) {
+		sched_jitter_max_us = late_us;
+	}
+
+	if (CONFIG_NODE_SCHED_STATS_WINDOWS > 0 && sched_windows >= CONFIG_NODE_SCHED_STATS_WINDOWS) {
+		TRACE_INF(TRACE_SCHED_STATS, sched_windows, (uint32_t) (sched_jitter_sum_us / sched_windows),
+			sched_jitter_max_us);
+		TRACE_INF(TRACE_SCAN_STATS, scan_filter_stats.callbacks, scan_filter_stats.useful);
+#if MOBILE_NODE == 1
+		TRACE_INF(TRACE_DUTY_STATS, duty_level(), duty_on_per_hour(), duty_stats.wakes);
+		if (IS_ENABLED(CONFIG_NODE_HISTORY)) {
+			TRACE_INF(TRACE_HISTORY_STATS, history_stats.stored, history_stats.sent,
+				history_stats.dropped);
+		}
+		if (IS_ENABLED(CONFIG_NODE_BULK)) {
+			TRACE_INF(TRACE_BULK_STATS, bulk_stats.connections, bulk_stats.notifications,
+				bulk_stats.lost);
+		}
+		if (IS_ENABLED(CONFIG_NODE_CONTACT)) {
+			TRACE_INF(TRACE_CONTACT_STATS, contact_stats.episodes, contact_stats.sent,
+				contact_stats.dropped);
+		}
+#endif
+		sched_windows = 0;
+		sched_jitter_max_us = 0;
+		sched_jitter_sum_us = 0;
+	}
+}
+
+#if defined(CONFIG_NODE_MOBILE_PHY_2M)
+static struct bt_le_ext_adv *mobile_adv_set;
+#endif
+
+/**
+ * start advertising the mobile data, on an extended advertising set sending it
+ * on the 2M phy when configured, so each event keeps the radio on for less time
+ **/
+static int mobile_adv_start(uint32_t options, uint16_t interval_min, uint16_t interval_max,
+		const struct bt_data *ad, size_t ad_len) {
+#if defined(CONFIG_NODE_MOBILE_PHY_2M)
+	struct bt_le_adv_param param = BT_LE_ADV_PARAM_INIT(options | BT_LE_ADV_OPT_EXT_ADV, interval_min,
+			interval_max, NULL);
+	int ret;
+
+	if (mobile_adv_set == NULL) {
+		ret = bt_le_ext_adv_create(&param, NULL, &mobile_adv_set);
+	} else {
+		ret = bt_le_ext_adv_update_param(mobile_adv_set, &param);
+	}
+	if (ret == 0) {
+		ret = bt_le_ext_adv_set_data(mobile_adv_set, ad, ad_len, NULL, 0);
+	}
+	if (ret == 0) {
+		ret = bt_le_ext_adv_start(mobile_adv_set, BT_LE_EXT_ADV_START_DEFAULT);
+	}
+	return ret;
+#else
+	return bt_le_adv_start(BT_LE_ADV_PARAM(options, interval_min, interval_max, NULL), ad, ad_len, NULL, 0);
+#endif
+}
+
+/**
+ * stop advertising the mobile data
+ **/
+static void mobile_adv_stop(void) {
+#if defined(CONFIG_NODE_MOBILE_PHY_2M)
+	if (mobile_adv_set != NULL) {
+		bt_le_ext_adv_stop(mobile_adv_set);
+	}
+#else
+	bt_le_adv_stop();
+#endif
+}
+
+// sequence number of the next mobile report
+static uint8_t mobile_seq = 0;
+
+// the flags, bulk flag, contact episode and report must fit one legacy advert
+BUILD_ASSERT(3 + 3 + 2 + sizeof(struct contact_ad) + 2 + sizeof(struct mobile_ad) <= BT_GAP_ADV_MAX_ADV_DATA_LEN,
+		"mobile advert too long");
+// relay frames carry the number of beacons in 3 bits
+BUILD_ASSERT(BEACONS < 8, "too many beacons per report");
+
+/**
+ * stop scanning and advertise the current beacon and sensor readings
+ **/
+static void mobile_start_advertising(void) {
+	int ret;
+	struct sensor_snapshot snap;
+	uint32_t options = BT_LE_ADV_OPT_CONNECTABLE | BT_LE_ADV_OPT_USE_NAME | ADV_OPT_IDENTITY;
+	static const uint8_t bulk_flag = 1;
+	struct contact_ad c_ad;
+	size_t data_len = 1;
+
+	sensor_snapshot_read(&snap);
+	struct mobile_ad m_ad = {.m_id = M_ID, .seq = mobile_seq++, .steps = snap.steps, .heading = snap.heading};
+
+	struct bt_data data_ad[4] = {
+			BT_DATA_BYTES(BT_DATA_FLAGS, (BT_LE_AD_GENERAL | BT_LE_AD_NO_BREDR))
+	};
+
+	// flag stored reports for the base to connect and upload, ahead of the report as
+	// receivers stop parsing at it, and stay unconnectable while the base is
+	// connected, as there is only one connection
+	if (IS_ENABLED(CONFIG_NODE_BULK)) {
+		if (bulk_connected()) {
+			options = ADV_OPT_IDENTITY;
+		} else if (bulk_pending()) {
+			data_ad[data_len++] = (struct bt_data) BT_DATA(BULK_ADV_TYPE, &bulk_flag, sizeof(bulk_flag));
+		}
+	}
+	// an ended contact episode, ahead of the report too, only sent while in range as
+	// it is repeated a fixed number of times
+	if (IS_ENABLED(CONFIG_NODE_CONTACT) && (!IS_ENABLED(CONFIG_NODE_HISTORY) || history_link_up()) &&
+			contact_next(&c_ad)) {
+		data_ad[data_len++] = (struct bt_data) BT_DATA(CONTACT_ADV_TYPE, &c_ad, sizeof(c_ad));
+	}
+	data_ad[data_len++] = (struct bt_data) BT_DATA(MOBILE_ADV_TYPE, &m_ad, sizeof(m_ad));
+
+	beacon_tracker_top(m_ad.beacons, BEACONS);
+	duty_update(m_ad.beacons);
+	if (IS_ENABLED(CONFIG_NODE_HISTORY) && !history_link_up()) {
+		history_store(&m_ad);
+	}
+
+	mobile_adv_stop();
+	bt_le_scan_stop();
+	is_scanning = false;
+
+	// tdma slots are short, advertise fast enough to get several events into one
+	ret = IS_ENABLED(CONFIG_NODE_TDMA) ?
+			mobile_adv_start(options, FAST_ADV_INTERVAL, FAST_ADV_INTERVAL, data_ad, data_len) :
+			mobile_adv_start(options, BT_GAP_ADV_FAST_INT_MIN_2, BT_GAP_ADV_FAST_INT_MAX_2, data_ad, data_len);
+	if (ret) {
+		TRACE_ERR(TRACE_ADV_START, ret);
+	} else {
+		TRACE_INF(TRACE_ADV_START, ret);
+	}
+	is_advertising = true;
+	duty_radio(DUTY_RADIO_ADV);
+	gpio_pin_set_dt(&led, 1);
+}
+
+/**
+ * stop advertising and scan for beacons and other mobile nodes
+ **/
+static void mobile_start_scanning(void) {
+	mobile_adv_stop();
+	is_advertising = false;
+	TRACE_INF(TRACE_ADV_STOP);
+
+	bt_le_scan_stop();
+	adv_found = false;
+	start_scan();
+	is_scanning = true;
+	duty_radio(DUTY_RADIO_SCAN);
+
+	if (!(IS_ENABLED(CONFIG_NODE_CONTACT) && contact_close())) {
+		gpio_pin_set_dt(&led, 0); // while in contact with another mobile node, hold LED on
+	}
+}
+
+/**
+ * advertise the next reports stored while out of range, non connectable so the
+ * frame holds nothing else
+ **/
+static bool mobile_advertise_history(void) {
+	uint8_t frame[sizeof(struct history_ad) + HISTORY_AD_REPORTS * sizeof(struct history_report)];
+	struct history_ad *h_ad = (struct history_ad *) frame;
+	int ret;
+
+	h_ad->count = history_take(h_ad->reports, HISTORY_AD_REPORTS);
+	if (h_ad->count == 0) {
+		return false;
+	}
+
+	struct bt_data data_ad[] = {
+			BT_DATA(HISTORY_ADV_TYPE, frame, sizeof(struct history_ad) + h_ad->count * sizeof(struct history_report))
+	};
+
+	mobile_adv_stop();
+	bt_le_scan_stop();
+	is_scanning = false;
+	ret = mobile_adv_start(ADV_OPT_IDENTITY, FAST_ADV_INTERVAL, FAST_ADV_INTERVAL, data_ad, ARRAY_SIZE(data_ad));
+	if (ret) {
+		TRACE_ERR(TRACE_ADV_START, ret);
+	}
+	is_advertising = true;
+	duty_radio(DUTY_RADIO_ADV);
+	return true;
+}
+
+/**
+ * turn the radio off until the next cycle while the node is still
+ **/
+static void mobile_stop_radio(void) {
+	mobile_adv_stop();
+	is_advertising = false;
+	TRACE_INF(TRACE_ADV_STOP);
+	duty_radio(DUTY_RADIO_OFF);
+
+	if (!(IS_ENABLED(CONFIG_NODE_CONTACT) && contact_close())) {
+		gpio_pin_set_dt(&led, 0);
+	}
+}
+
 /**
  * mobile bluetooth thread
  * - broadcasts RSSI of surrounding ibeacons and sensor node
  * - scans for nearly RSSI of ibeacons and other mobile nodes
+ * - switches between the two on CONFIG_NODE_MOBILE_*_WINDOW_MS boundaries, or
+ *   advertises in its own tdma slot once synchronised to the base
+ * - while the node is still and hears no new beacons, turns the radio off
+ *   between cycles, waking every CONFIG_NODE_DUTY_POLL_MS to check for motion
+ * - stores its reports in flash while no static node or base is heard, and
+ *   sends them after its advertising window once back in range, or in its own
+ *   tdma slots once synchronised
+ * - keeps a table of the other mobile nodes heard, and advertises each contact
+ *   episode with one of them ahead of its reports once the episode is over
  */
 void handle_bt_mobile(void) {
 	int ret;
+	uint32_t sleep_left_ms = 0;
+	int history_frames = 0;
 	ret = bt_enable(NULL);
 	if (ret) {
 		printk("Bluetooth init failed with code %d.\n", ret);
 		return;	
 	}
 
+	beacon_registry_init();
+	scan_filter_init();
+	if (IS_ENABLED(CONFIG_NODE_HISTORY)) {
+		history_init();
+	}
 	gpio_pin_configure_dt(&led, GPIO_OUTPUT_ACTIVE);
 
+	// use mobile id to offset the schedule of each mobile node
+	state = SCANNING;
+	mobile_start_scanning();
+	next_switch_ticks = k_uptime_ticks() + k_ms_to_ticks_ceil64(M_ID * 5);
+	schedule_scan_window(TDMA_MOBILE_SLOT(M_ID), CONFIG_NODE_MOBILE_SCAN_WINDOW_MS);
+
 	while (1) {
+		k_sem_take(&role_switch_sem, K_FOREVER);
+		record_switch_jitter();
 
-		// printk("uptim32: %d\n", k_uptime_get_32());
-		// last_switchtime = k_uptime_get_32();
-		// printk("last_switchtime: %d\n", k_uptime_get_32());
+		if (IS_ENABLED(CONFIG_NODE_CONTACT)) {
+			contact_update();
+		}
 
-		// k_msleep(100);
+		if (state == SCANNING) {
+			if (adv_found == true && time_corrected == false && !tdma_synced()) { // only do this once
+				TRACE_INF(TRACE_SCAN_EXTEND);
+				adv_found = false;
+				time_corrected = true;
+				schedule_next_switch(CONFIG_NODE_MOBILE_SCAN_WINDOW_MS);
+				continue;
+			}
 
-		/*** state switcher ***/
-		if (state == SCANNING && ((k_uptime_get_32() - last_switchtime) > 200)) {
-			printk("[%d] Switching to advertising\n", k_uptime_get_32());
-			
+			TRACE_INF(TRACE_TO_ADV);
 			state = ADVERTISING;
-			last_switchtime = k_uptime_get_32();
-			continue;
-		} else if (state == ADVERTISING && ((k_uptime_get_32() - last_switchtime) > 50)) {
-			printk("[%d] Switching to scanning\n", k_uptime_get_32());
-			state = SCANNING;
-			last_switchtime = k_uptime_get_32();
-			continue;
-		}
+			mobile_start_advertising();
+			schedule_adv_window(TDMA_MOBILE_SLOT(M_ID), CONFIG_NODE_MOBILE_ADV_WINDOW_MS);
+		} else {
+			// once connected, the bulk upload thread sends the stored reports instead
+			if (state == ADVERTISING && IS_ENABLED(CONFIG_NODE_HISTORY) && history_link_up() &&
+					!(IS_ENABLED(CONFIG_NODE_BULK) && bulk_connected()) && history_pending()) {
+				state = HISTORY;
+				history_frames = 0;
+			}
+			// once synchronised, each frame is sent in our own slot of the next tdma
+			// frame, scanning until then, so it does not collide with other nodes
+			if (state == HISTORY && history_frames < CONFIG_NODE_HISTORY_FRAMES &&
+					IS_ENABLED(CONFIG_NODE_TDMA) && tdma_synced() && history_pending()) {
+				state = HISTORY_WAIT;
+				mobile_start_scanning();
+				schedule_scan_window(TDMA_MOBILE_SLOT(M_ID), CONFIG_NODE_HISTORY_SLOT_MS);
+				continue;
+			}
+			if (state == HISTORY_WAIT) {
+				state = HISTORY;
+			}
+			if (state == HISTORY && history_frames++ < CONFIG_NODE_HISTORY_FRAMES &&
+					mobile_advertise_history()) {
+				schedule_adv_window(TDMA_MOBILE_SLOT(M_ID), CONFIG_NODE_HISTORY_SLOT_MS);
+				continue;
+			}
 
-		if (too_close == true && (k_uptime_get_32() - last_too_close > 1500)) {
-			too_close = false;
-		}
+			if (state == ADVERTISING || state == HISTORY) {
+				sleep_left_ms = duty_motion() ? 0 : duty_off_ms();
+			} else if (duty_motion()) {
+				sleep_left_ms = 0;
+			}
+
+			if (sleep_left_ms > 0) {
+				uint32_t poll_ms = MIN(sleep_left_ms, CONFIG_NODE_DUTY_POLL_MS);
 
-		
-		if (state == ADVERTISING) {
-			// stop scanning and start advertising
-			
-			// printk("[%d] Scanning stopped \n", k_uptime_get_32());
-
-			// k_msleep(30);
-
-			if (is_advertising == false) { // only start advertising when it isn started already
-				struct mobile_ad m_ad = {.m_id = M_ID, .b1_id = top_beacon_ids[0], .b1_rssi = top_beacon_strengths[0], .b2_id = top_beacon_ids[1],
-							 .b2_rssi = top_beacon_strengths[1], .b3_id = top_beacon_ids[2], .b3_rssi = top_beacon_strengths[2],
-							 .speed=step_buffer, .direction=dir_buffer};
-
-				struct bt_data data_ad[] = {
-						BT_DATA_BYTES(BT_DATA_FLAGS, (BT_LE_AD_GENERAL | BT_LE_AD_NO_BREDR)),
-						BT_DATA(MOBILE_ADV_TYPE, &m_ad, sizeof(m_ad))
-						// BT_DATA(BT_DATA_UUID128_ALL,)
-				};
-
-				bt_le_adv_stop();
-				bt_le_scan_stop();
-				is_scanning = false;
-				
-				ret = bt_le_adv_start(BT_LE_ADV_CONN_NAME, data_ad, ARRAY_SIZE(data_ad), NULL, 0);
-				printk("[%d] Adv started %d.\n", k_uptime_get_32(), ret);
-				if (ret) {
-					printk("Advertising failed with code %d.\n", ret);
-					// return;
+				if (state != SLEEPING) {
+					state = SLEEPING;
+					mobile_stop_radio();
 				}
-				is_advertising = true;
-				// k_msleep(200);
+				sleep_left_ms -= poll_ms;
+				schedule_next_switch(poll_ms);
+				continue;
 			}
 
-			
+			TRACE_INF(TRACE_TO_SCAN, (int32_t) tdma_stats.offset);
+			state = SCANNING;
+			mobile_start_scanning();
+			schedule_scan_window(TDMA_MOBILE_SLOT(M_ID), CONFIG_NODE_MOBILE_SCAN_WINDOW_MS);
+		}
+	}
+}
 
-			gpio_pin_set_dt(&led, 1);
 
-		} else if (state == SCANNING) {
-			
+#ifndef MOBILE_NODE
 
-			// make timing a bit more random
-			// if (k_uptime_get_32() % 2 == 1) {
-			// 	k_msleep(30);
-			// }
+/**
+ * a legacy relay frame (RELAY_FRAME_LEN, node_relay.h) only has room for the
+ * repeated base beacon (8 bytes) with fewer reports, so it goes in every other
+ * frame, and in the first frame of each window
+ **/
+#define RELAY_BASE_LEN (2 + sizeof(struct base_ad))
+#if defined(CONFIG_NODE_RELAY_EXT_ADV)
+#define RELAY_BASE_MAX_REPORTS RELAY_MAX_REPORTS
+#else
+#define RELAY_BASE_MAX_REPORTS RELAY_REPORTS(RELAY_FRAME_LEN - RELAY_BASE_LEN)
+#endif
 
-			if (adv_found == true && time_corrected == false) { // only do this once
-				printk("adv found, staying in scanning mode a little longer\n");
-				last_switchtime = k_uptime_get_32();
-				adv_found = false;
-				time_corrected = true;
-			}
+BUILD_ASSERT(RELAY_MAX_REPORTS >= 2, "relay frame too short to aggregate reports");
+BUILD_ASSERT(RELAY_BASE_MAX_REPORTS >= 1, "relay frame too short for a report after the base beacon");
+BUILD_ASSERT(M_ID >= 1 && M_ID <= STATIC_ID_MAX, "static node id out of range");
+
+static uint8_t relay_frame[RELAY_FRAME_LEN];
+static uint8_t relay_seq = 0;
+// length of the frame advertised and whether it carries the base beacon
+static uint8_t relay_frame_len = 0;
+static bool relay_base_sent = false;
+
+#if defined(CONFIG_NODE_RELAY_EXT_ADV)
+static struct bt_le_ext_adv *relay_adv_set;
+
+/* the extended advertising set sends its frames on the secondary phy selected,
+ * with the primary channels on 1M, or everything on the coded phy */
+#if defined(CONFIG_NODE_RELAY_PHY_CODED)
+#define RELAY_ADV_OPT_PHY BT_LE_ADV_OPT_CODED
+#elif defined(CONFIG_NODE_RELAY_PHY_2M)
+#define RELAY_ADV_OPT_PHY 0
+#else
+#define RELAY_ADV_OPT_PHY BT_LE_ADV_OPT_NO_2M
+#endif
+#endif
 
-			is_advertising = false;
-			if (is_scanning == false) {
-				bt_le_adv_stop();
-				printk("[%d] Adv stopped\n", k_uptime_get_32());
-				
-				bt_le_scan_stop();
-				// k_msleep(100);
+/**
+ * start advertising the given frame, or replace the frame currently advertised
+ **/
+static int relay_adv_send(uint8_t len, bool with_base) {
+	int ret;
+	size_t data_len = 0;
+	struct bt_data data_ad[2];
+	int64_t net_time = tdma_net_time();
+	struct base_ad bad = {.hops = relay_route_hops(), .net_time = (uint32_t) net_time, .net_epoch = net_time >> 32};
+
+	// pass the base time on to nodes further from the base
+	if (with_base) {
+		data_ad[data_len++] = (struct bt_data) BT_DATA(BASE_ADV_TYPE, &bad, sizeof(bad));
+	}
+	data_ad[data_len++] = (struct bt_data) BT_DATA(AGG_ADV_TYPE, relay_frame, len);
+
+#if defined(CONFIG_NODE_RELAY_EXT_ADV)
+	if (relay_adv_set == NULL) {
+		ret = bt_le_ext_adv_create(BT_LE_ADV_PARAM(BT_LE_ADV_OPT_EXT_ADV | RELAY_ADV_OPT_PHY | ADV_OPT_IDENTITY,
+				FAST_ADV_INTERVAL, FAST_ADV_INTERVAL, NULL), NULL, &relay_adv_set);
+		if (ret) {
+			return ret;
+		}
+	}
 
-				adv_found = false;
-				start_scan(); // this will set is_scanning to true if success
-				is_scanning = true;
-				printk("[%d] Scanning started\n", k_uptime_get_32());
-		
-			}
+	ret = bt_le_ext_adv_set_data(relay_adv_set, data_ad, data_len, NULL, 0);
+	if (ret == 0 && !is_advertising) {
+		ret = bt_le_ext_adv_start(relay_adv_set, BT_LE_EXT_ADV_START_DEFAULT);
+	}
+#else
+	if (is_advertising) {
+		ret = bt_le_adv_update_data(data_ad, data_len, NULL, 0);
+	} else {
+		ret = bt_le_adv_start(BT_LE_ADV_PARAM(ADV_OPT_IDENTITY, FAST_ADV_INTERVAL,
+				FAST_ADV_INTERVAL, NULL), data_ad, data_len, NULL, 0);
+	}
+#endif
+	return ret;
+}
+
+/**
+ * stop advertising relay frames
+ **/
+static void relay_adv_stop(void) {
+#if defined(CONFIG_NODE_RELAY_EXT_ADV)
+	if (relay_adv_set != NULL) {
+		bt_le_ext_adv_stop(relay_adv_set);
+	}
+#endif
+	bt_le_adv_stop();
+	is_advertising = false;
+}
+
+/**
+ * pack as many queued reports as fit into one aggregated frame and advertise it,
+ * replacing the frame advertised in the previous relay slot. when nothing is
+ * pending the last frame keeps being advertised until the window ends, with its
+ * base beacon restamped
+ **/
+static void static_relay_next(void) {
+	int ret;
+	struct agg_ad *agg = (struct agg_ad *) relay_frame;
+	struct relay_record *recs[RELAY_MAX_REPORTS];
+	uint8_t count = 0;
+	bool with_base = tdma_synced() && relay_route_hops() != HOPS_UNKNOWN &&
+			(IS_ENABLED(CONFIG_NODE_RELAY_EXT_ADV) || !is_advertising || !relay_base_sent);
+	uint8_t max_reports = with_base ? RELAY_BASE_MAX_REPORTS : RELAY_MAX_REPORTS;
+
+	while (count < max_reports && (recs[count] = relay_ring_get()) != NULL) {
+		struct relay_record *rec = recs[count];
+		struct static_ad *s_ad = &agg->reports[count];
+
+		if (rec->type == RELAY_RECORD_STATIC) {
+			*s_ad = rec->s_ad;
+			s_ad->ttl -= 1;
+		} else {
+			// we are at a known position, so the rssi we heard the report with
+			// ranges the mobile node like a beacon
+			s_ad->ttl = RELAY_TTL;
+			s_ad->static_id = M_ID;
+			s_ad->rssi = rec->rssi;
+			s_ad->m_ad = rec->m_ad;
+		}
+		count++;
+	}
+
+	agg->static_id = M_ID;
+	agg->beacons = BEACONS;
+	agg->hops = relay_route_hops();
+	// the base counts gaps in the sequence of the frames it hears from us
+	if (count > 0) {
+		agg->seq = relay_seq++;
+	}
 
-			if (!too_close) {
-				gpio_pin_set_dt(&led, 0); // if they are too close, hold LED on
+	// the frame kept advertised has its base beacon restamped every slot, so its
+	// network time is at most a slot late, or dropped once we lose sync
+	if (count == 0 && is_advertising) {
+		if (relay_base_sent) {
+			relay_base_sent = tdma_synced();
+			ret = relay_adv_send(relay_frame_len, relay_base_sent);
+			if (ret) {
+				TRACE_ERR(TRACE_ADV_START, ret);
 			}
-			
 		}
+		return;
+	}
+
+	// with nothing to relay, still advertise our hop count once per window so
+	// static nodes further from the base can learn their route
+	if (count == 0 && agg->hops == HOPS_UNKNOWN) {
+		return;
+	}
 
-		k_msleep(50 + 30 * (M_ID % 2) + M_ID * 5); // use mobile id to randomize timing
+	if (!is_advertising) {
+		bt_le_scan_stop();
+		is_scanning = false;
+	}
 
+	ret = relay_adv_send(sizeof(struct agg_ad) + count * sizeof(struct static_ad), with_base);
+	if (ret == 0) {
+		relay_frame_len = sizeof(struct agg_ad) + count * sizeof(struct static_ad);
+		relay_base_sent = with_base;
+	}
+	if (!is_advertising) {
+		TRACE_INF(TRACE_RELAY_ADV_START, ret);
+		is_advertising = (ret == 0);
+	}
+
+	for (int i = 0; i < count; i++) {
+		if (ret) {
+			relay_ring_drop(recs[i]);
+		} else {
+			relay_ring_free(recs[i]);
+		}
+	}
+
+	if (ret) {
+		TRACE_ERR(TRACE_ADV_START, ret);
 	}
 }
 
+/**
+ * stop advertising relay frames and scan for mobile and static adverts
+ **/
+static void static_start_scanning(void) {
+	if (is_scanning) {
+		return;
+	}
 
-#ifndef MOBILE_NODE
+	relay_adv_stop();
+	TRACE_INF(TRACE_ADV_STOP);
+
+	bt_le_scan_stop();
+	adv_found = false;
+	start_scan();
+	is_scanning = true;
+}
 
 /**
- * Bluetooth code for static nodes - creates a "mesh network" by forwarding mobile node packets to other static nodes
+ * Bluetooth code for static nodes - creates a "mesh network" by forwarding mobile node packets to other static nodes,
+ * following the hop count gradient advertised from the base. relays in its own tdma slot once synchronised to the base
  **/
 void handle_bt_static(void) {
 
 	printk("static node.\n");
 	init_bt();
+	scan_filter_init();
 
 	gpio_pin_configure_dt(&led, GPIO_OUTPUT_ACTIVE);
 
-	int ret;
+	state = SCANNING;
+	static_start_scanning();
+	next_switch_ticks = k_uptime_ticks();
+	schedule_scan_window(TDMA_STATIC_SLOT(M_ID), CONFIG_NODE_STATIC_SCAN_WINDOW_MS);
+
 	// listen & adv etc..
 	while (1) {
-
-		// printk("uptim32: %d\n", k_uptime_get_32());
-		// last_switchtime = k_uptime_get_32();
-		// printk("last_switchtime: %d\n", k_uptime_get_32());
-
-		// k_msleep(100);
-
-		/*** state switcher ***/
-		if (state == SCANNING && ((k_uptime_get_32() - last_switchtime) > 400)) {
-			printk("[%d] Switching to advertising\n", k_uptime_get_32());
-			
-			state = ADVERTISING;
-			last_switchtime = k_uptime_get_32();
-			continue;
-		} else if (state == ADVERTISING && ((k_uptime_get_32() - last_switchtime) > 100)) {
-			printk("[%d] Switching to scanning (mobileturn:%i)\n", k_uptime_get_32(), is_turn_for_mobile_ads);
-			state = SCANNING;
-			last_switchtime = k_uptime_get_32();
+		// between window boundaries, send a relay frame per relay slot
+		if (k_sem_take(&role_switch_sem, state == ADVERTISING ? K_MSEC(CONFIG_NODE_RELAY_SLOT_MS) :
+				K_FOREVER) != 0) {
+			static_relay_next();
 			continue;
 		}
+		record_switch_jitter();
 
 		if (state == SCANNING) {
-
-			is_turn_for_mobile_ads = ! is_turn_for_mobile_ads; // flip this
-
-			
-			is_advertising = false;
-			if (is_scanning == false) {
-				bt_le_adv_stop();
-				printk("[%d] SN Adv stopped\n", k_uptime_get_32());
-				
-				bt_le_scan_stop();
-				// k_msleep(100);
-
-				adv_found = false;
-				start_scan(); // this will set is_scanning to true if success
-				printk("[%d] SN Scanning started\n", k_uptime_get_32());
-			
-			}
-			gpio_pin_set_dt(&led, 0); 
-		} else if (state == ADVERTISING) {
-			// stop scanning and start advertising
-			
-			// printk("[%d] Scanning stopped \n", k_uptime_get_32());
-
-			// k_msleep(30);
-
-			// XXX need to advertise both found mobile adverts and relay static adverts
-			if (is_advertising == false) { // only start advertising when it isn started already
-
-				is_advertising = true;
-
-				printk("about to start adv staticfound:%i mobilefound:%i\n", static_adv_found, mobile_adv_found);
-
-				if (static_adv_found) {
-
-					struct bt_data data_ad[] = {
-							BT_DATA_BYTES(BT_DATA_FLAGS, (BT_LE_AD_GENERAL | BT_LE_AD_NO_BREDR)),
-							BT_DATA(STATIC_ADV_TYPE, &found_s_adv, sizeof(found_s_adv))
-							// BT_DATA(BT_DATA_UUID128_ALL,)
-					};
-
-					bt_le_adv_stop();
-					bt_le_scan_stop();
-					is_scanning = false;
-					
-					ret = bt_le_adv_start(BT_LE_ADV_CONN_NAME, data_ad, ARRAY_SIZE(data_ad), NULL, 0);
-					printk("[%d] SN Adv started, turn for mobile:%i ret:%d.\n", k_uptime_get_32(), is_turn_for_mobile_ads, ret);
-					if (ret) {
-						printk("SN Advertising failed with code %d.\n", ret);
-						// return;
-					}
-					is_advertising = true;
-
-				} else if (mobile_adv_found) {
-					struct static_ad s_ad = {.ttl=4, .static_id = M_ID, .m_ad = found_m_adv};
-
-					struct bt_data data_ad[] = {
-							BT_DATA_BYTES(BT_DATA_FLAGS, (BT_LE_AD_GENERAL | BT_LE_AD_NO_BREDR)),
-							BT_DATA(STATIC_ADV_TYPE, &s_ad, sizeof(s_ad))
-							// BT_DATA(BT_DATA_UUID128_ALL,)
-					};
-
-					bt_le_adv_stop();
-					bt_le_scan_stop();
-					is_scanning = false;
-					
-					ret = bt_le_adv_start(BT_LE_ADV_CONN_NAME, data_ad, ARRAY_SIZE(data_ad), NULL, 0);
-					printk("[%d] Adv started %d.\n", k_uptime_get_32(), ret);
-					if (ret) {
-						printk("Advertising failed with code %d.\n", ret);
-						// return;
-					}
-					
-				}
-
-				
-			}
-			
+			TRACE_INF(TRACE_TO_ADV);
+			TRACE_INF(TRACE_RELAY_QUEUE, relay_route_hops(), relay_ring_pending(), relay_stats.overflow);
+			TRACE_INF(TRACE_RELAY_STATS, relay_stats.dropped, relay_stats.seen_hits, relay_stats.seen_misses);
+			state = ADVERTISING;
+			// relay the next frame of queued adverts, one per relay slot
+			static_relay_next();
 			gpio_pin_set_dt(&led, 1);
-			// reset at the end of starting adv
-			mobile_adv_found = false;
-			static_adv_found = false;
-
+			schedule_adv_window(TDMA_STATIC_SLOT(M_ID), CONFIG_NODE_STATIC_ADV_WINDOW_MS);
+		} else {
+			TRACE_INF(TRACE_TO_SCAN, (int32_t) tdma_stats.offset);
+			state = SCANNING;
+			static_start_scanning();
+			gpio_pin_set_dt(&led, 0);
+			schedule_scan_window(TDMA_STATIC_SLOT(M_ID), CONFIG_NODE_STATIC_SCAN_WINDOW_MS);
 		}
-
-		k_msleep(50);
 	}
-
-	
 }
 
 #endif
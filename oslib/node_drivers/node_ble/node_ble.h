@@ -25,33 +25,125 @@
 /* Defines constants for bluetooth sleep times (ms) */
 #define MOBILE_ADV_TYPE 0x42
 #define STATIC_ADV_TYPE 0x43
+#define AGG_ADV_TYPE 0x44
+#define BASE_ADV_TYPE 0x45
+#define HISTORY_ADV_TYPE 0x46
+#define BULK_ADV_TYPE 0x47
+#define CONTACT_ADV_TYPE 0x48
+
+// number of beacons reported by each mobile node, the same on every node and the
+// base, as the size of every report depends on it. Adverts of another size are dropped
+#define BEACONS CONFIG_NODE_BEACON_TOP_K
+
+/**
+ * beacon heard by a mobile node
+ **/
+struct beacon_report {
+	char id; // 0 if there is no beacon to report in this place
+	int8_t rssi; // smoothed rssi
+};
 
 /**
  * packet structure to advertise to nearly mobile and static nodes
  **/
 struct mobile_ad {
 	char m_id;
-	char b1_id; 
-	int8_t b1_rssi;
-	char b2_id; 
-	int8_t b2_rssi;
-	char b3_id; 
-	int8_t b3_rssi;
-	int8_t speed;
-	int8_t direction;
-};
+	uint8_t seq; // incremented by the mobile node for every new report
+	struct beacon_report beacons[BEACONS]; // strongest first
+	uint16_t steps; // steps since the mobile node booted, wrapping, differenced by the host
+	uint8_t heading; // 1/256 of a turn clockwise from north
+} __packed;
 
 /**
  * packet structure to relay information between static nodes
  **/
 struct static_ad {
-	int8_t ttl; // initially a small value and packet should no longer be forwarded when this hits 0
-	int8_t static_id; // static node id
+	// ttl and static id share a byte, so two reports fit a legacy relay frame
+	uint8_t ttl : 3; // initially a small value and packet should no longer be forwarded when this hits 0
+	uint8_t static_id : 5; // static node id, at most STATIC_ID_MAX
+	int8_t rssi; // rssi the static node heard the mobile node with, RSSI_NONE for stored reports
 	struct mobile_ad m_ad;
 };
 
-// define beacons tracked
-#define BEACONS 3
+/**
+ * packet structure to relay several mobile reports in one frame between static nodes,
+ * the header is followed by static_ad reports up to the end of the frame
+ **/
+struct agg_ad {
+	// static id and beacon count share a byte, so two reports still fit a legacy relay frame
+	uint8_t static_id : 5; // static node that sent the frame, at most STATIC_ID_MAX
+	uint8_t beacons : 3; // BEACONS of the reports, frames with another number are dropped
+	uint8_t hops; // hops from the sending static node to the base, HOPS_UNKNOWN if not known
+	uint8_t seq; // incremented by the sending static node for every new frame
+	struct static_ad reports[]; // as many as the length of the frame holds
+};
+
+/**
+ * packet structure of the gradient and time sync beacon advertised by the base,
+ * and repeated by synchronised static nodes in their relay frames
+ **/
+struct base_ad {
+	uint8_t hops; // hops from the sender to the base, 0 for the base itself
+	uint32_t net_time; // network time (ms), the uptime of the base
+	uint8_t net_epoch; // times net_time has wrapped, so the slot schedule does not jump when it does
+} __packed;
+
+// hop count of a node that has not heard the base or a static node closer to it
+#define HOPS_UNKNOWN 0xff
+
+// ttl the static node that heard a mobile report relays it with, each further static
+// node relaying it decrements the ttl
+#define RELAY_TTL 4
+// largest static node id a relayed report can carry
+#define STATIC_ID_MAX 31
+
+// rssi of a report not received directly, as in hci
+#define RSSI_NONE 127
+
+/**
+ * report a mobile node stored while out of range, sent once it is back in range
+ **/
+struct history_report {
+	uint16_t age; // time (1/10 s) since the report was made when it was sent, or HISTORY_AGE_UNKNOWN
+	struct mobile_ad m_ad;
+} __packed;
+
+// age of a report made before the mobile node last rebooted, as the time since is not known
+#define HISTORY_AGE_UNKNOWN UINT16_MAX
+
+/**
+ * packet structure of the stored reports a mobile node sends after being out of
+ * range, the header is followed by count history_report reports
+ **/
+struct history_ad {
+	uint8_t count; // number of reports in the frame
+	struct history_report reports[];
+} __packed;
+
+// stored reports that fit one legacy advert
+#define HISTORY_AD_REPORTS ((BT_GAP_ADV_MAX_ADV_DATA_LEN - 2 - sizeof(struct history_ad)) / \
+		sizeof(struct history_report))
+
+/**
+ * gatt service a node flagging BULK_ADV_TYPE in its advert uploads its pending data
+ * over once the base connects, each notification of the data characteristic holding
+ * a run of history_report records
+ **/
+#define BULK_SERVICE_UUID_VAL BT_UUID_128_ENCODE(0x61746865, 0x6e61, 0x4752, 0x4e00, 0x000000000001)
+#define BULK_DATA_UUID_VAL BT_UUID_128_ENCODE(0x61746865, 0x6e61, 0x4752, 0x4e00, 0x000000000002)
+
+/**
+ * contact episode a mobile node had with another mobile node, advertised ahead of
+ * its report once the episode is over
+ **/
+struct contact_ad {
+	char m_id; // mobile node reporting the contact
+	uint8_t episode; // incremented by the reporting node for every new episode
+	char contact_id; // mobile node it was close to
+	int8_t rssi; // strongest filtered rssi of the episode
+	uint16_t start; // time (s) since the episode started, when it was sent
+	uint16_t dwell; // time (s) the nodes were close during the episode
+} __packed;
 
 
 //struct mobile_ad m_ad = {} 
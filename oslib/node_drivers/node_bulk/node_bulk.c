@@ -0,0 +1,164 @@
+// Geordie Pearson
+/*
+*************************************************************
+* @file oslib/node_drivers/node_bulk/node_bulk.c
+* @author Geordie Pearson - 45798232
+* @date 20-05-2022
+* @brief gatt bulk upload of stored reports to the base
+*************************************************************
+*/
+
+#include <zephyr.h>
+#include <sys/atomic.h>
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/hci.h>
+#include <bluetooth/conn.h>
+#include <bluetooth/uuid.h>
+#include <bluetooth/gatt.h>
+#if defined(CONFIG_SHELL)
+#include <shell/shell.h>
+#endif
+
+#include "node_bulk.h"
+#include "node_ble.h"
+#include "node_history.h"
+
+// stored reports per notification at the largest att mtu
+#define BULK_MAX_REPORTS ((CONFIG_BT_L2CAP_TX_MTU - 3) / sizeof(struct history_report))
+
+struct bulk_stats bulk_stats;
+
+static struct bt_uuid_128 bulk_service_uuid = BT_UUID_INIT_128(BULK_SERVICE_UUID_VAL);
+static struct bt_uuid_128 bulk_data_uuid = BT_UUID_INIT_128(BULK_DATA_UUID_VAL);
+
+/* connection from the base, set and cleared by the bt callbacks */
+static struct bt_conn *bulk_conn = NULL;
+static struct k_spinlock bulk_lock;
+static atomic_t bulk_subscribed = ATOMIC_INIT(0);
+
+/* given when the base subscribes or disconnects */
+K_SEM_DEFINE(bulk_sem, 0, 1);
+
+static void bulk_ccc_changed(const struct bt_gatt_attr *attr, uint16_t value) {
+	atomic_set(&bulk_subscribed, value == BT_GATT_CCC_NOTIFY);
+	k_sem_give(&bulk_sem);
+}
+
+BT_GATT_SERVICE_DEFINE(bulk_svc,
+	BT_GATT_PRIMARY_SERVICE(&bulk_service_uuid),
+	BT_GATT_CHARACTERISTIC(&bulk_data_uuid.uuid, BT_GATT_CHRC_NOTIFY, BT_GATT_PERM_NONE, NULL, NULL, NULL),
+	BT_GATT_CCC(bulk_ccc_changed, BT_GATT_PERM_READ | BT_GATT_PERM_WRITE),
+);
+
+static void bulk_connected_cb(struct bt_conn *conn, uint8_t err) {
+	struct bt_conn_info info;
+	k_spinlock_key_t key;
+
+	if (err || bt_conn_get_info(conn, &info) != 0 || info.role != BT_CONN_ROLE_PERIPHERAL) {
+		return;
+	}
+
+	key = k_spin_lock(&bulk_lock);
+	if (bulk_conn == NULL) {
+		bulk_conn = bt_conn_ref(conn);
+		bulk_stats.connections++;
+	}
+	k_spin_unlock(&bulk_lock, key);
+}
+
+static void bulk_disconnected_cb(struct bt_conn *conn, uint8_t reason) {
+	k_spinlock_key_t key = k_spin_lock(&bulk_lock);
+
+	if (conn == bulk_conn) {
+		bt_conn_unref(bulk_conn);
+		bulk_conn = NULL;
+		atomic_set(&bulk_subscribed, 0);
+	}
+	k_spin_unlock(&bulk_lock, key);
+	k_sem_give(&bulk_sem);
+}
+
+BT_CONN_CB_DEFINE(bulk_conn_callbacks) = {
+	.connected = bulk_connected_cb,
+	.disconnected = bulk_disconnected_cb,
+};
+
+bool bulk_connected(void) {
+	return bulk_conn != NULL;
+}
+
+bool bulk_pending(void) {
+	return !bulk_connected() && history_link_up() && history_pending();
+}
+
+/**
+ * take a reference to the connection from the base, so it outlives a disconnect
+ * while the thread is still sending
+ **/
+static struct bt_conn *bulk_get_conn(void) {
+	k_spinlock_key_t key = k_spin_lock(&bulk_lock);
+	struct bt_conn *conn = bulk_conn != NULL ? bt_conn_ref(bulk_conn) : NULL;
+
+	k_spin_unlock(&bulk_lock, key);
+	return conn;
+}
+
+void handle_bulk_mobile(void) {
+	struct history_report reports[BULK_MAX_REPORTS];
+
+	while (1) {
+		struct bt_conn *conn;
+
+		k_sem_take(&bulk_sem, K_FOREVER);
+		conn = bulk_get_conn();
+		if (conn == NULL || !atomic_get(&bulk_subscribed)) {
+			if (conn != NULL) {
+				bt_conn_unref(conn);
+			}
+			continue;
+		}
+
+		// as many reports per notification as the negotiated mtu fits
+		while (atomic_get(&bulk_subscribed)) {
+			int max = MIN(BULK_MAX_REPORTS, (bt_gatt_get_mtu(conn) - 3) / sizeof(struct history_report));
+			int n = history_take(reports, max);
+			int ret;
+
+			if (n == 0) {
+				if (!history_pending()) {
+					break;
+				}
+				// a batch is being written to flash
+				k_msleep(10);
+				continue;
+			}
+
+			ret = bt_gatt_notify(conn, &bulk_svc.attrs[1], reports, n * sizeof(reports[0]));
+			if (ret) {
+				bulk_stats.lost += n;
+				break;
+			}
+			bulk_stats.notifications++;
+			bulk_stats.bytes += n * sizeof(reports[0]);
+		}
+
+		// everything is sent, or the base went away, free the radio for scanning
+		bt_conn_disconnect(conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
+		bt_conn_unref(conn);
+	}
+}
+
+#if defined(CONFIG_SHELL)
+static int cmd_bulk_stats(const struct shell *shell, size_t argc, char **argv) {
+	shell_print(shell, "connections %u notifications %u bytes %u lost %u", bulk_stats.connections,
+		bulk_stats.notifications, bulk_stats.bytes, bulk_stats.lost);
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(bulk_cmds,
+	SHELL_CMD(stats, NULL, "bulk upload counters", cmd_bulk_stats),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(bulk, &bulk_cmds, "gatt bulk upload", NULL);
+#endif
@@ -0,0 +1,44 @@
+// Geordie Pearson
+/*
+*************************************************************
+* @file oslib/node_drivers/node_bulk/node_bulk.h
+* @author Geordie Pearson - 45798232
+* @date 20-05-2022
+* @brief gatt bulk upload of stored reports to the base
+*************************************************************
+*/
+
+#ifndef NODE_BULK_H
+#define NODE_BULK_H
+
+#include <zephyr.h>
+
+/* Defines thread specfics */
+#define BULK_STACKSIZE 1024
+#define BULK_PRIORITY 9
+
+/**
+ * bulk upload counters
+ **/
+struct bulk_stats {
+	uint32_t connections; // connections made by the base
+	uint32_t notifications; // notifications sent
+	uint32_t bytes; // bytes of reports sent
+	uint32_t lost; // reports taken but not sent, as the connection was lost
+};
+
+extern struct bulk_stats bulk_stats;
+
+// Gets whether the base is connected to upload the stored reports.
+bool bulk_connected(void);
+
+// Gets whether the mobile advert should flag pending bulk data, so the base connects.
+// Returns:
+// 	true if reports are stored, the node is in range and the base is not connected
+bool bulk_pending(void);
+
+// Function that operates as thread opening point to stream the stored reports to the
+// base as notifications while it is connected and subscribed, then disconnect.
+void handle_bulk_mobile(void);
+
+#endif
@@ -0,0 +1,252 @@
+// Geordie Pearson
+/*
+*************************************************************
+* @file oslib/node_drivers/node_contact/node_contact.c
+* @author Geordie Pearson - 45798232
+* @date 20-05-2022
+* @brief proximity contact table of mobile nodes
+*************************************************************
+*/
+
+#include <zephyr.h>
+#include <string.h>
+#if defined(CONFIG_SHELL)
+#include <shell/shell.h>
+#endif
+
+#include "node_contact.h"
+
+#define CONTACT_SLOTS CONFIG_NODE_CONTACT_SLOTS
+#define CONTACT_EPISODES CONFIG_NODE_CONTACT_EPISODES
+
+// filtered rssi is kept in 1/16 dBm, so small steps are not lost to rounding
+#define RSSI_SCALE 16
+
+/**
+ * mobile node heard recently
+ **/
+struct contact_entry {
+	char m_id; // 0 if the entry is free
+	bool close; // in a contact episode
+	int8_t peak; // strongest filtered rssi of the episode
+	int16_t rssi; // filtered rssi (1/16 dBm)
+	uint32_t first_seen; // uptime (ms) first heard, or the episode started
+	uint32_t last_seen; // uptime (ms) last heard
+	uint32_t dwell; // time (ms) close during the episode
+};
+
+/**
+ * ended episode waiting to be advertised
+ **/
+struct contact_episode {
+	char contact_id;
+	int8_t rssi;
+	uint8_t episode;
+	uint8_t repeats; // times advertised so far
+	uint32_t start; // uptime (ms) the episode started
+	uint32_t dwell; // time (ms) close during the episode
+};
+
+struct contact_stats contact_stats;
+
+/* the table is updated by the bt rx thread and aged and read by the mobile bt
+ * thread, guarded by contact_lock */
+static struct contact_entry contacts[CONTACT_SLOTS];
+static struct contact_episode episodes[CONTACT_EPISODES];
+static int episode_head = 0;
+static int episode_len = 0;
+static uint8_t episode_seq = 0;
+static struct k_spinlock contact_lock;
+
+/**
+ * end the episode of an entry, queueing it to be advertised if it lasted long
+ * enough. when the queue is full the oldest episode is dropped. must hold
+ * contact_lock
+ **/
+static void contact_end(struct contact_entry *c) {
+	struct contact_episode *ep;
+
+	c->close = false;
+	if (c->dwell < CONFIG_NODE_CONTACT_MIN_DWELL_MS) {
+		contact_stats.short_episodes++;
+		return;
+	}
+
+	if (episode_len == CONTACT_EPISODES) {
+		episode_head = (episode_head + 1) % CONTACT_EPISODES;
+		episode_len--;
+		contact_stats.dropped++;
+	}
+	ep = &episodes[(episode_head + episode_len) % CONTACT_EPISODES];
+	episode_len++;
+
+	ep->contact_id = c->m_id;
+	ep->rssi = c->peak;
+	ep->episode = episode_seq++;
+	ep->repeats = 0;
+	ep->start = c->first_seen;
+	ep->dwell = c->dwell;
+	contact_stats.episodes++;
+}
+
+/**
+ * find the entry of a mobile node, or the entry to replace with it: a free one,
+ * otherwise the one heard least recently that is not in an episode. must hold
+ * contact_lock
+ **/
+static struct contact_entry *contact_find(char m_id, uint32_t now) {
+	struct contact_entry *free = NULL;
+	struct contact_entry *oldest = NULL;
+
+	for (int i = 0; i < CONTACT_SLOTS; i++) {
+		struct contact_entry *c = &contacts[i];
+
+		if (c->m_id == m_id) {
+			return c;
+		}
+		if (c->m_id == 0) {
+			if (free == NULL) {
+				free = c;
+			}
+		} else if (!c->close && (oldest == NULL || now - c->last_seen > now - oldest->last_seen)) {
+			oldest = c;
+		}
+	}
+	return free != NULL ? free : oldest;
+}
+
+void contact_heard(char m_id, int8_t rssi) {
+	k_spinlock_key_t key = k_spin_lock(&contact_lock);
+	uint32_t now = k_uptime_get_32();
+	struct contact_entry *c = contact_find(m_id, now);
+	int8_t filtered;
+
+	contact_stats.heard++;
+	if (c == NULL) {
+		contact_stats.full++;
+		k_spin_unlock(&contact_lock, key);
+		return;
+	}
+
+	if (c->m_id != m_id) {
+		memset(c, 0, sizeof(*c));
+		c->m_id = m_id;
+		c->rssi = rssi * RSSI_SCALE;
+		c->first_seen = now;
+	} else {
+		if (c->close && now - c->last_seen >= CONFIG_NODE_CONTACT_TIMEOUT_MS) {
+			// not aged out yet, the episode ended when it was last heard
+			contact_end(c);
+		} else if (c->close) {
+			c->dwell += now - c->last_seen;
+		}
+		c->rssi += (rssi * RSSI_SCALE - c->rssi) / (1 << CONFIG_NODE_CONTACT_FILTER_SHIFT);
+	}
+	c->last_seen = now;
+
+	filtered = c->rssi / RSSI_SCALE;
+	if (!c->close && filtered > CONFIG_NODE_CONTACT_RSSI) {
+		c->close = true;
+		c->first_seen = now;
+		c->dwell = 0;
+		c->peak = filtered;
+	} else if (c->close && filtered <= CONFIG_NODE_CONTACT_RSSI - CONFIG_NODE_CONTACT_HYSTERESIS) {
+		contact_end(c);
+	} else if (c->close && filtered > c->peak) {
+		c->peak = filtered;
+	}
+	k_spin_unlock(&contact_lock, key);
+}
+
+void contact_update(void) {
+	k_spinlock_key_t key = k_spin_lock(&contact_lock);
+	uint32_t now = k_uptime_get_32();
+
+	for (int i = 0; i < CONTACT_SLOTS; i++) {
+		struct contact_entry *c = &contacts[i];
+
+		if (c->m_id == 0 || now - c->last_seen < CONFIG_NODE_CONTACT_TIMEOUT_MS) {
+			continue;
+		}
+		if (c->close) {
+			contact_end(c);
+		}
+		c->m_id = 0;
+	}
+	k_spin_unlock(&contact_lock, key);
+}
+
+bool contact_close(void) {
+	k_spinlock_key_t key = k_spin_lock(&contact_lock);
+	bool close = false;
+
+	for (int i = 0; i < CONTACT_SLOTS && !close; i++) {
+		close = contacts[i].m_id != 0 && contacts[i].close;
+	}
+	k_spin_unlock(&contact_lock, key);
+	return close;
+}
+
+bool contact_next(struct contact_ad *c_ad) {
+	k_spinlock_key_t key = k_spin_lock(&contact_lock);
+	uint32_t now = k_uptime_get_32();
+	struct contact_episode *ep;
+
+	if (episode_len == 0) {
+		k_spin_unlock(&contact_lock, key);
+		return false;
+	}
+
+	ep = &episodes[episode_head];
+	c_ad->m_id = M_ID;
+	c_ad->episode = ep->episode;
+	c_ad->contact_id = ep->contact_id;
+	c_ad->rssi = ep->rssi;
+	c_ad->start = MIN((now - ep->start) / 1000, UINT16_MAX);
+	c_ad->dwell = MIN(ep->dwell / 1000, UINT16_MAX);
+
+	// repeated over several adverts, as nothing acknowledges it
+	if (++ep->repeats >= CONFIG_NODE_CONTACT_REPEATS) {
+		episode_head = (episode_head + 1) % CONTACT_EPISODES;
+		episode_len--;
+		contact_stats.sent++;
+	}
+	k_spin_unlock(&contact_lock, key);
+	return true;
+}
+
+#if defined(CONFIG_SHELL)
+static int cmd_contact_list(const struct shell *shell, size_t argc, char **argv) {
+	struct contact_entry table[CONTACT_SLOTS];
+	uint32_t now = k_uptime_get_32();
+	k_spinlock_key_t key = k_spin_lock(&contact_lock);
+
+	memcpy(table, contacts, sizeof(table));
+	k_spin_unlock(&contact_lock, key);
+
+	for (int i = 0; i < CONTACT_SLOTS; i++) {
+		if (table[i].m_id == 0) {
+			continue;
+		}
+		shell_print(shell, "mobile %d: rssi %d %s first seen %u ms ago, last %u ms ago, dwell %u ms",
+			table[i].m_id, table[i].rssi / RSSI_SCALE, table[i].close ? "close" : "far",
+			now - table[i].first_seen, now - table[i].last_seen, table[i].dwell);
+	}
+	return 0;
+}
+
+static int cmd_contact_stats(const struct shell *shell, size_t argc, char **argv) {
+	shell_print(shell, "heard %u full %u", contact_stats.heard, contact_stats.full);
+	shell_print(shell, "episodes %u short %u dropped %u sent %u pending %d", contact_stats.episodes,
+		contact_stats.short_episodes, contact_stats.dropped, contact_stats.sent, episode_len);
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(contact_cmds,
+	SHELL_CMD(list, NULL, "mobile nodes heard recently", cmd_contact_list),
+	SHELL_CMD(stats, NULL, "contact counters", cmd_contact_stats),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(contact, &contact_cmds, "proximity contacts with other mobile nodes", NULL);
+#endif
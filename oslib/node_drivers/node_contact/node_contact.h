@@ -0,0 +1,55 @@
+// Geordie Pearson
+/*
+*************************************************************
+* @file oslib/node_drivers/node_contact/node_contact.h
+* @author Geordie Pearson - 45798232
+* @date 20-05-2022
+* @brief proximity contact table of mobile nodes
+*************************************************************
+*/
+
+#ifndef NODE_CONTACT_H
+#define NODE_CONTACT_H
+
+#include <zephyr.h>
+
+#include "node_ble.h"
+
+/**
+ * contact counters
+ **/
+struct contact_stats {
+	uint32_t heard; // adverts heard from other mobile nodes
+	uint32_t full; // adverts ignored as the table was full of nodes in contact
+	uint32_t episodes; // episodes ended long enough to be reported
+	uint32_t short_episodes; // episodes ended too short to be reported
+	uint32_t dropped; // episodes overwritten before being advertised
+	uint32_t sent; // episodes advertised NODE_CONTACT_REPEATS times
+};
+
+extern struct contact_stats contact_stats;
+
+// Filters the rssi of an advert heard from another mobile node, starting a contact
+// episode once it rises above CONFIG_NODE_CONTACT_RSSI, and ending it once it falls
+// CONFIG_NODE_CONTACT_HYSTERESIS below. Must only be called from the bt rx context.
+// Parameters:
+// 	- m_id: The mobile node heard
+// 	- rssi: The rssi its advert was received with
+void contact_heard(char m_id, int8_t rssi);
+
+// Ends the episodes of nodes not heard for CONFIG_NODE_CONTACT_TIMEOUT_MS and frees
+// their entries. Called once per cycle from the mobile bt thread.
+void contact_update(void);
+
+// Gets whether another mobile node is currently close.
+bool contact_close(void);
+
+// Gets the oldest ended episode to advertise. Each episode is handed out
+// CONFIG_NODE_CONTACT_REPEATS times before the next one.
+// Parameters:
+// 	- c_ad: Filled with the episode, with its start dated from now
+// Returns:
+// 	true if an episode was pending
+bool contact_next(struct contact_ad *c_ad);
+
+#endif
@@ -0,0 +1,157 @@
+// Geordie Pearson
+/*
+*************************************************************
+* @file oslib/node_drivers/node_duty/node_duty.c
+* @author Geordie Pearson - 45798232
+* @date 20-05-2022
+* @brief motion gated radio duty cycling for mobile nodes
+*************************************************************
+*/
+
+#include <zephyr.h>
+#include <string.h>
+#include <stdlib.h>
+#if defined(CONFIG_SHELL)
+#include <shell/shell.h>
+#endif
+
+#include "node_duty.h"
+#include "node_sensors.h"
+
+// one scan/advertise cycle of the fixed schedule
+#define DUTY_CYCLE_MS (CONFIG_NODE_MOBILE_SCAN_WINDOW_MS + CONFIG_NODE_MOBILE_ADV_WINDOW_MS)
+
+struct duty_stats duty_stats;
+static struct k_spinlock duty_lock;
+static enum duty_radio duty_state = DUTY_RADIO_OFF;
+static int64_t duty_since;
+
+/* only used by the bt thread */
+static uint8_t level = 0;
+static uint8_t quiet_cycles = 0;
+static struct sensor_snapshot last_snap;
+static char last_beacons[BEACONS];
+
+void duty_radio(enum duty_radio radio) {
+	k_spinlock_key_t key = k_spin_lock(&duty_lock);
+	int64_t now = k_uptime_get();
+
+	duty_stats.radio_ms[duty_state] += (uint32_t) (now - duty_since);
+	duty_state = radio;
+	duty_since = now;
+	k_spin_unlock(&duty_lock, key);
+}
+
+/**
+ * steps taken or heading turned more than CONFIG_NODE_DUTY_HEADING_DELTA since the
+ * last cycle
+ **/
+static bool duty_moved(const struct sensor_snapshot *snap) {
+	int8_t turn = (int8_t) (snap->heading - last_snap.heading);
+
+	return snap->steps != last_snap.steps || abs(turn) > CONFIG_NODE_DUTY_HEADING_DELTA;
+}
+
+/**
+ * a beacon is reported that was not reported last cycle. beacons dropping out
+ * are not counted, as slow beacons are easily missed in one scan window
+ **/
+static bool duty_new_beacon(const struct beacon_report *beacons) {
+	for (int i = 0; i < BEACONS; i++) {
+		if (beacons[i].id != 0 && memchr(last_beacons, beacons[i].id, BEACONS) == NULL) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void duty_update(const struct beacon_report *beacons) {
+	struct sensor_snapshot snap;
+
+	sensor_snapshot_read(&snap);
+	if (!IS_ENABLED(CONFIG_NODE_DUTY_CYCLE) || duty_moved(&snap) || duty_new_beacon(beacons)) {
+		level = 0;
+		quiet_cycles = 0;
+	} else if (++quiet_cycles >= CONFIG_NODE_DUTY_IDLE_CYCLES) {
+		quiet_cycles = 0;
+		if (level < CONFIG_NODE_DUTY_MAX_LEVEL) {
+			level++;
+		}
+	}
+
+	last_snap = snap;
+	for (int i = 0; i < BEACONS; i++) {
+		last_beacons[i] = beacons[i].id;
+	}
+}
+
+bool duty_motion(void) {
+	struct sensor_snapshot snap;
+
+	sensor_snapshot_read(&snap);
+	if (!duty_moved(&snap)) {
+		return false;
+	}
+	if (level > 0) {
+		duty_stats.wakes++;
+	}
+	level = 0;
+	quiet_cycles = 0;
+	return true;
+}
+
+uint32_t duty_off_ms(void) {
+	// the radio stays on for one cycle out of every 2^level
+	return DUTY_CYCLE_MS * ((1U << level) - 1);
+}
+
+uint8_t duty_level(void) {
+	return level;
+}
+
+uint32_t duty_on_per_hour(void) {
+	k_spinlock_key_t key = k_spin_lock(&duty_lock);
+	uint64_t on = (uint64_t) duty_stats.radio_ms[DUTY_RADIO_SCAN] + duty_stats.radio_ms[DUTY_RADIO_ADV];
+	uint64_t total = on + duty_stats.radio_ms[DUTY_RADIO_OFF];
+
+	k_spin_unlock(&duty_lock, key);
+	return total ? (uint32_t) (on * 3600 / total) : 0;
+}
+
+#if defined(CONFIG_SHELL)
+/**
+ * shell commands to compare the radio on time against the fixed schedule
+ **/
+static int cmd_duty_stats(const struct shell *shell, size_t argc, char **argv) {
+	struct duty_stats stats;
+	k_spinlock_key_t key = k_spin_lock(&duty_lock);
+
+	stats = duty_stats;
+	k_spin_unlock(&duty_lock, key);
+
+	shell_print(shell, "level %u off %u ms per cycle, woken by motion %u", level, duty_off_ms(),
+		stats.wakes);
+	shell_print(shell, "scan %u ms adv %u ms off %u ms", stats.radio_ms[DUTY_RADIO_SCAN],
+		stats.radio_ms[DUTY_RADIO_ADV], stats.radio_ms[DUTY_RADIO_OFF]);
+	// the fixed schedule is always either scanning or advertising
+	shell_print(shell, "radio on %u s per hour, fixed schedule 3600 s per hour", duty_on_per_hour());
+	return 0;
+}
+
+static int cmd_duty_reset(const struct shell *shell, size_t argc, char **argv) {
+	k_spinlock_key_t key = k_spin_lock(&duty_lock);
+
+	memset(&duty_stats, 0, sizeof(duty_stats));
+	duty_since = k_uptime_get();
+	k_spin_unlock(&duty_lock, key);
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(duty_cmds,
+	SHELL_CMD(stats, NULL, "radio on time against the fixed schedule", cmd_duty_stats),
+	SHELL_CMD(reset, NULL, "restart the radio time accounting", cmd_duty_reset),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(duty, &duty_cmds, "radio duty cycling", NULL);
+#endif
@@ -0,0 +1,66 @@
+// Geordie Pearson
+/*
+*************************************************************
+* @file oslib/node_drivers/node_duty/node_duty.h
+* @author Geordie Pearson - 45798232
+* @date 20-05-2022
+* @brief motion gated radio duty cycling for mobile nodes
+*************************************************************
+*/
+
+#ifndef NODE_DUTY_H
+#define NODE_DUTY_H
+
+#include <zephyr.h>
+
+#include "node_ble.h"
+
+/* Defines what the radio is doing, for the energy accounting */
+enum duty_radio {
+	DUTY_RADIO_OFF,
+	DUTY_RADIO_SCAN,
+	DUTY_RADIO_ADV,
+	DUTY_RADIO_COUNT
+};
+
+/**
+ * radio time accounting since boot or the last reset
+ **/
+struct duty_stats {
+	uint32_t radio_ms[DUTY_RADIO_COUNT]; // time spent in each radio state
+	uint32_t wakes; // radio off periods cut short by motion
+};
+
+extern struct duty_stats duty_stats;
+
+// Accounts the time spent in the current radio state and switches to the next one.
+// Parameters:
+// 	- radio: The radio state from now on
+void duty_radio(enum duty_radio radio);
+
+// Ends a scan/advertise cycle. The duty cycle drops back to the fixed schedule if the
+// node moved or heard a new beacon since the last cycle, otherwise it is lowered one
+// level every CONFIG_NODE_DUTY_IDLE_CYCLES cycles.
+// Parameters:
+// 	- beacons: The BEACONS strongest beacons reported this cycle
+void duty_update(const struct beacon_report *beacons);
+
+// Checks for motion since the last cycle, dropping back to the fixed schedule if so.
+// Returns:
+// 	true if the steps or heading changed since the last cycle
+bool duty_motion(void);
+
+// Gets how long the radio is left off after each advertising window.
+// Returns:
+// 	Radio off time (ms), 0 on the fixed schedule
+uint32_t duty_off_ms(void);
+
+// Gets the radio on time the current schedule averages per hour.
+// Returns:
+// 	Radio on time (s) per hour, 3600 on the fixed schedule
+uint32_t duty_on_per_hour(void);
+
+// Gets the current duty cycle level, the radio is on for 1 / 2^level of the time.
+uint8_t duty_level(void);
+
+#endif
@@ -0,0 +1,156 @@
+// Geordie Pearson
+/*
+*************************************************************
+* @file oslib/node_drivers/node_filter/node_filter.c
+* @author Geordie Pearson - 45798232
+* @date 20-05-2022
+* @brief controller scan filtering of known beacons and nodes
+*************************************************************
+*/
+
+#include <zephyr.h>
+#include <string.h>
+#include <sys/util.h>
+#include <sys/atomic.h>
+#if defined(CONFIG_SHELL)
+#include <shell/shell.h>
+#endif
+
+#include "node_filter.h"
+#include "node_filter_peers.h"
+#if MOBILE_NODE == 1
+#include "node_beacons.h"
+#endif
+
+struct scan_filter_stats scan_filter_stats;
+
+// set when the controller filter accept list no longer matches the peers and beacons
+static atomic_t filter_dirty = ATOMIC_INIT(1);
+
+void scan_filter_invalidate(void) {
+	atomic_set(&filter_dirty, 1);
+}
+
+#if defined(CONFIG_NODE_SCAN_FILTER)
+static void filter_list_add(const bt_addr_le_t *addr, void *user_data) {
+	int ret = bt_le_filter_accept_list_add(addr);
+
+	if (ret) {
+		printk("Scan filter add failed with code %d.\n", ret);
+	}
+}
+
+#if MOBILE_NODE == 1
+static void filter_add_beacon(const struct beacon_key *key, char id, void *user_data) {
+	bt_addr_le_t addr;
+
+	// only beacons registered by address can be matched by the controller
+	if (key->kind != BEACON_KEY_ADDR) {
+		(*(int *) user_data)++;
+		return;
+	}
+	addr.type = key->val[0];
+	memcpy(addr.a.val, &key->val[1], sizeof(addr.a.val));
+	filter_list_add(&addr, NULL);
+}
+#endif
+#endif
+
+void scan_filter_apply(void) {
+#if defined(CONFIG_NODE_SCAN_FILTER)
+	if (!atomic_cas(&filter_dirty, 1, 0)) {
+		return;
+	}
+
+	bt_le_filter_accept_list_clear();
+
+	filter_peers_foreach(filter_list_add, NULL);
+
+#if MOBILE_NODE == 1
+	int unmatched = 0;
+
+	beacon_registry_foreach(filter_add_beacon, &unmatched);
+	if (unmatched > 0) {
+		printk("Scan filter drops %d beacons registered by payload key.\n", unmatched);
+	}
+#endif
+#endif
+}
+
+int scan_filter_init(void) {
+	return filter_peers_init(CONFIG_NODE_SCAN_FILTER_DEFAULTS, scan_filter_invalidate);
+}
+
+#if defined(CONFIG_SHELL)
+/**
+ * shell command to let a node through the filter: filter add <addr> <public|random>
+ **/
+static int cmd_filter_add(const struct shell *shell, size_t argc, char **argv) {
+	bt_addr_le_t addr;
+	int ret = bt_addr_le_from_str(argv[1], argv[2], &addr);
+
+	if (ret) {
+		shell_error(shell, "invalid address");
+		return ret;
+	}
+
+	ret = filter_peers_add(&addr);
+	if (ret) {
+		shell_error(shell, "failed to add node (%d)", ret);
+	}
+	return ret;
+}
+
+/**
+ * shell command to remove a node from the filter: filter rm <addr> <public|random>
+ **/
+static int cmd_filter_rm(const struct shell *shell, size_t argc, char **argv) {
+	bt_addr_le_t addr;
+	int ret = bt_addr_le_from_str(argv[1], argv[2], &addr);
+
+	if (ret) {
+		shell_error(shell, "invalid address");
+		return ret;
+	}
+
+	ret = filter_peers_remove(&addr);
+	if (ret) {
+		shell_error(shell, "failed to remove node (%d)", ret);
+	}
+	return ret;
+}
+
+/**
+ * shell command to list the nodes let through the filter
+ **/
+static void filter_print(const bt_addr_le_t *addr, void *user_data) {
+	char str[BT_ADDR_LE_STR_LEN];
+
+	bt_addr_le_to_str(addr, str, sizeof(str));
+	shell_print((const struct shell *) user_data, "%s", str);
+}
+
+static int cmd_filter_list(const struct shell *shell, size_t argc, char **argv) {
+	filter_peers_foreach(filter_print, (void *) shell);
+	return 0;
+}
+
+/**
+ * shell command to print the scan callback counters
+ **/
+static int cmd_filter_stats(const struct shell *shell, size_t argc, char **argv) {
+	shell_print(shell, "callbacks %u useful %u", scan_filter_stats.callbacks,
+		scan_filter_stats.useful);
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(filter_cmds,
+	SHELL_CMD_ARG(add, NULL, "<addr> <public|random>", cmd_filter_add, 3, 0),
+	SHELL_CMD_ARG(rm, NULL, "<addr> <public|random>", cmd_filter_rm, 3, 0),
+	SHELL_CMD(list, NULL, "list nodes let through the filter", cmd_filter_list),
+	SHELL_CMD(stats, NULL, "scan callback counters", cmd_filter_stats),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(filter, &filter_cmds, "scan filter", NULL);
+#endif
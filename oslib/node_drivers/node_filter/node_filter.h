@@ -0,0 +1,43 @@
+// Geordie Pearson
+/*
+*************************************************************
+* @file oslib/node_drivers/node_filter/node_filter.h
+* @author Geordie Pearson - 45798232
+* @date 20-05-2022
+* @brief controller scan filtering of known beacons and nodes
+*************************************************************
+*/
+
+#ifndef NODE_FILTER_H
+#define NODE_FILTER_H
+
+#include <zephyr.h>
+#include <bluetooth/bluetooth.h>
+
+/**
+ * scan callback counters
+ **/
+struct scan_filter_stats {
+	uint32_t callbacks; // adverts passed up by the controller
+	uint32_t useful; // adverts from a beacon or a node that were used
+};
+
+extern struct scan_filter_stats scan_filter_stats;
+
+// Lets the nodes of CONFIG_NODE_SCAN_FILTER_DEFAULTS through the filter, then loads
+// the nodes provisioned with the filter shell command from the settings subsystem
+// (node_filter_peers).
+// Returns:
+// 	0 on success, otherwise a negative error code
+int scan_filter_init(void);
+
+// Marks the filter accept list as out of date, so it is reloaded the next time
+// scanning starts.
+void scan_filter_invalidate(void);
+
+// Reloads the filter accept list with the provisioned nodes and, on mobile nodes,
+// the beacons registered by address. Does nothing unless the list is out of date.
+// Must be called while the node is not scanning.
+void scan_filter_apply(void);
+
+#endif
@@ -0,0 +1,214 @@
+// Geordie Pearson
+/*
+*************************************************************
+* @file oslib/node_drivers/node_filter/node_filter_peers.c
+* @author Geordie Pearson - 45798232
+* @date 20-05-2022
+* @brief nodes let through the scan filter, stored in settings, shared by the
+*        nodes and the base
+*************************************************************
+*/
+
+#include <zephyr.h>
+#include <string.h>
+#include <sys/util.h>
+#include <settings/settings.h>
+
+#include "node_filter_peers.h"
+
+#if defined(CONFIG_NODE_SCAN_FILTER_PEERS)
+#define FILTER_PEERS CONFIG_NODE_SCAN_FILTER_PEERS
+#else
+#define FILTER_PEERS CONFIG_BASE_SCAN_FILTER_PEERS
+#endif
+
+/* settings are stored as filter/<address as hex> = address, or FILTER_PEER_REMOVED
+ * once removed, so a default node stays removed */
+#define FILTER_SETTINGS_ROOT "filter"
+#define FILTER_SETTINGS_NAME_LEN (sizeof(FILTER_SETTINGS_ROOT "/") + 2 * sizeof(bt_addr_le_t))
+#define FILTER_PEER_REMOVED 0xff
+
+// nodes let through the filter, guarded by filter_lock
+static bt_addr_le_t filter_peers[FILTER_PEERS];
+static uint8_t filter_peer_count = 0;
+static K_MUTEX_DEFINE(filter_lock);
+
+static void (*filter_changed)(void);
+
+static int filter_find(const bt_addr_le_t *addr) {
+	for (int i = 0; i < filter_peer_count; i++) {
+		if (bt_addr_le_cmp(&filter_peers[i], addr) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static void filter_notify(void) {
+	if (filter_changed != NULL) {
+		filter_changed();
+	}
+}
+
+/**
+ * add a node in ram only
+ **/
+static int filter_insert(const bt_addr_le_t *addr) {
+	int ret = 0;
+	bool added = false;
+
+	k_mutex_lock(&filter_lock, K_FOREVER);
+	if (filter_find(addr) < 0) {
+		if (filter_peer_count < FILTER_PEERS) {
+			bt_addr_le_copy(&filter_peers[filter_peer_count++], addr);
+			added = true;
+		} else {
+			ret = -ENOMEM;
+		}
+	}
+	k_mutex_unlock(&filter_lock);
+
+	if (added) {
+		filter_notify();
+	}
+	return ret;
+}
+
+/**
+ * remove a node in ram only
+ **/
+static int filter_delete(const bt_addr_le_t *addr) {
+	int index;
+
+	k_mutex_lock(&filter_lock, K_FOREVER);
+	index = filter_find(addr);
+	if (index >= 0) {
+		filter_peers[index] = filter_peers[--filter_peer_count];
+	}
+	k_mutex_unlock(&filter_lock);
+
+	if (index < 0) {
+		return -ENOENT;
+	}
+	filter_notify();
+	return 0;
+}
+
+static void filter_settings_name(char *name, const bt_addr_le_t *addr) {
+	size_t len = strlen(FILTER_SETTINGS_ROOT "/");
+
+	memcpy(name, FILTER_SETTINGS_ROOT "/", len);
+	bin2hex((const uint8_t *) addr, sizeof(*addr), &name[len], FILTER_SETTINGS_NAME_LEN - len);
+}
+
+int filter_peers_add(const bt_addr_le_t *addr) {
+	char name[FILTER_SETTINGS_NAME_LEN];
+	int ret = filter_insert(addr);
+
+	if (ret) {
+		return ret;
+	}
+
+	filter_settings_name(name, addr);
+	return settings_save_one(name, addr, sizeof(*addr));
+}
+
+int filter_peers_remove(const bt_addr_le_t *addr) {
+	char name[FILTER_SETTINGS_NAME_LEN];
+	uint8_t removed = FILTER_PEER_REMOVED;
+	int ret = filter_delete(addr);
+
+	if (ret) {
+		return ret;
+	}
+
+	filter_settings_name(name, addr);
+	return settings_save_one(name, &removed, sizeof(removed));
+}
+
+void filter_peers_foreach(filter_peer_cb cb, void *user_data) {
+	k_mutex_lock(&filter_lock, K_FOREVER);
+	for (int i = 0; i < filter_peer_count; i++) {
+		cb(&filter_peers[i], user_data);
+	}
+	k_mutex_unlock(&filter_lock);
+}
+
+int filter_peers_count(void) {
+	return filter_peer_count;
+}
+
+/**
+ * settings handler, called for every stored filter/<address> entry on load
+ **/
+static int filter_settings_set(const char *name, size_t len, settings_read_cb read_cb, void *cb_arg) {
+	bt_addr_le_t addr;
+	const char *next;
+	size_t name_len = settings_name_next(name, &next);
+
+	if (len == sizeof(uint8_t)) {
+		// removed, the address is only in the name
+		if (name_len != 2 * sizeof(addr) || next != NULL ||
+				hex2bin(name, name_len, (uint8_t *) &addr, sizeof(addr)) != sizeof(addr)) {
+			return -ENOENT;
+		}
+		filter_delete(&addr);
+		return 0;
+	}
+	if (len != sizeof(addr) || read_cb(cb_arg, &addr, sizeof(addr)) != sizeof(addr)) {
+		return -EINVAL;
+	}
+	return filter_insert(&addr);
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(filter, FILTER_SETTINGS_ROOT, NULL, filter_settings_set, NULL, NULL);
+
+/**
+ * add the default nodes in ram only, given as comma separated
+ * "<addr> <public|random>" entries
+ **/
+static void filter_seed(const char *defaults) {
+	// "xx:xx:xx:xx:xx:xx random" with some room for spaces
+	char entry[BT_ADDR_LE_STR_LEN + 8];
+
+	for (const char *next = defaults; next != NULL;) {
+		const char *end = strchr(next, ',');
+		size_t len = MIN(end != NULL ? (size_t) (end - next) : strlen(next), sizeof(entry) - 1);
+		char *field_save;
+		char *addr_str, *type;
+		bt_addr_le_t addr;
+
+		memcpy(entry, next, len);
+		entry[len] = '\0';
+		next = end != NULL ? end + 1 : NULL;
+
+		addr_str = strtok_r(entry, " ", &field_save);
+		if (addr_str == NULL) {
+			continue; // empty entry, or no defaults at all
+		}
+		type = strtok_r(NULL, " ", &field_save);
+		if (type == NULL || bt_addr_le_from_str(addr_str, type, &addr)) {
+			printk("Invalid default filter node %s.\n", addr_str);
+			continue;
+		}
+		filter_insert(&addr);
+	}
+}
+
+int filter_peers_init(const char *defaults, void (*changed)(void)) {
+	int ret;
+
+	filter_changed = changed;
+	// the stored nodes are loaded on top, so they can remove a default
+	filter_seed(defaults);
+
+	ret = settings_subsys_init();
+	if (ret) {
+		printk("Filter settings init failed with code %d.\n", ret);
+		return ret;
+	}
+
+	ret = settings_load_subtree(FILTER_SETTINGS_ROOT);
+	printk("Scan filter loaded %d nodes (%d).\n", filter_peer_count, ret);
+	return ret;
+}
@@ -0,0 +1,53 @@
+// Geordie Pearson
+/*
+*************************************************************
+* @file oslib/node_drivers/node_filter/node_filter_peers.h
+* @author Geordie Pearson - 45798232
+* @date 20-05-2022
+* @brief nodes let through the scan filter, stored in settings, shared by the
+*        nodes and the base
+*************************************************************
+*/
+
+#ifndef NODE_FILTER_PEERS_H
+#define NODE_FILTER_PEERS_H
+
+#include <zephyr.h>
+#include <bluetooth/bluetooth.h>
+
+// Called for each node let through the filter.
+typedef void (*filter_peer_cb)(const bt_addr_le_t *addr, void *user_data);
+
+// Adds the default nodes, then loads the nodes provisioned since from the settings
+// subsystem, which also removes the defaults that were removed.
+// Parameters:
+// 	- defaults: Comma separated "<addr> <public|random>" entries
+// 	- changed: Called whenever the nodes change, to reload the filter accept list
+// Returns:
+// 	0 on success, otherwise a negative error code
+int filter_peers_init(const char *defaults, void (*changed)(void));
+
+// Adds a node and stores it in settings so it persists across reboots.
+// Parameters:
+// 	- addr: The identity address of the node
+// Returns:
+// 	0 on success, -ENOMEM if the filter is full, otherwise a settings error code
+int filter_peers_add(const bt_addr_le_t *addr);
+
+// Removes a node, and stores the removal so a default node stays removed.
+// Parameters:
+// 	- addr: The identity address of the node
+// Returns:
+// 	0 on success, -ENOENT if the node is not in the filter
+int filter_peers_remove(const bt_addr_le_t *addr);
+
+// Calls a function for every node, holding the peer lock.
+// Parameters:
+// 	- cb: The function, which must not add or remove nodes
+// 	- user_data: Passed to cb
+void filter_peers_foreach(filter_peer_cb cb, void *user_data);
+
+// Gets the number of nodes let through the filter.
+int filter_peers_count(void);
+
+#endif
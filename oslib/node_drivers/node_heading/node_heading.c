@@ -0,0 +1,137 @@
+// Geordie Pearson
+/*
+*************************************************************
+* @file oslib/node_drivers/node_heading/node_heading.c
+* @author Geordie Pearson - 45798232
+* @date 20-05-2022
+* @brief gyro and magnetometer heading fusion for mobile nodes
+*************************************************************
+*/
+
+#include <zephyr.h>
+#include <device.h>
+#include <devicetree.h>
+#include <drivers/sensor.h>
+#include <sys/atomic.h>
+#include <math.h>
+
+#include "node_heading.h"
+#include "node_sensors.h"
+
+#define HEADING_PERIOD_MS (1000 / CONFIG_NODE_HEADING_RATE_HZ)
+#define HEADING_DT (HEADING_PERIOD_MS / 1000.0f)
+// share of the magnetometer error corrected per sample
+#define HEADING_MAG_GAIN (CONFIG_NODE_HEADING_MAG_GAIN / 100.0f * HEADING_DT)
+#define HEADING_PI 3.14159265f
+
+static const struct device* heading_mpu = DEVICE_DT_GET(MPU_NODE);
+static atomic_t heading_ready = ATOMIC_INIT(0);
+
+/**
+ * vector in the accel and gyro axes of the MPU9250
+ **/
+struct heading_vec {
+	float x;
+	float y;
+	float z;
+};
+
+bool heading_available(void) {
+	return atomic_get(&heading_ready) != 0;
+}
+
+/**
+ * reads a 3 axis channel in single precision
+ **/
+static int heading_read_vec(enum sensor_channel chan, struct heading_vec* v) {
+	struct sensor_value val[3];
+	int ret = sensor_channel_get(heading_mpu, chan, val);
+
+	v->x = val[0].val1 + val[0].val2 / 1000000.0f;
+	v->y = val[1].val1 + val[1].val2 / 1000000.0f;
+	v->z = val[2].val1 + val[2].val2 / 1000000.0f;
+	return ret;
+}
+
+static float heading_dot(const struct heading_vec* a, const struct heading_vec* b) {
+	return a->x * b->x + a->y * b->y + a->z * b->z;
+}
+
+/**
+ * wraps an angle into [-pi, pi)
+ **/
+static float heading_wrap(float angle) {
+	while (angle >= HEADING_PI) {
+		angle -= 2 * HEADING_PI;
+	}
+	while (angle < -HEADING_PI) {
+		angle += 2 * HEADING_PI;
+	}
+	return angle;
+}
+
+/**
+ * tilt compensated magnetic heading of the node y axis, clockwise from north, from
+ * the gravity direction and the magnetic field
+ **/
+static float heading_magnetic(const struct heading_vec* up, const struct heading_vec* magn) {
+	const struct heading_vec fwd = {0.0f, 1.0f, 0.0f};
+	float mu = heading_dot(magn, up);
+	float fu = heading_dot(&fwd, up);
+	// horizontal north, and east = north x up with the same length
+	struct heading_vec north = {magn->x - mu * up->x, magn->y - mu * up->y, magn->z - mu * up->z};
+	struct heading_vec east = {north.y * up->z - north.z * up->y, north.z * up->x - north.x * up->z,
+				   north.x * up->y - north.y * up->x};
+	struct heading_vec fwd_h = {fwd.x - fu * up->x, fwd.y - fu * up->y, fwd.z - fu * up->z};
+
+	return atan2f(heading_dot(&fwd_h, &east), heading_dot(&fwd_h, &north));
+}
+
+void handle_heading_mobile(void) {
+	struct heading_vec accel, gyro, raw_magn, magn, up;
+	float heading = 0.0f;
+	bool started = false;
+	int64_t next = k_uptime_get();
+
+	if (!device_is_ready(heading_mpu)) {
+		printk("MPU9250 not ready, heading from turns only.\n");
+		return;
+	}
+
+	while (1) {
+		next += HEADING_PERIOD_MS;
+		k_sleep(K_TIMEOUT_ABS_MS(next));
+
+		if (sensor_sample_fetch(heading_mpu) < 0 ||
+				heading_read_vec(SENSOR_CHAN_ACCEL_XYZ, &accel) < 0 ||
+				heading_read_vec(SENSOR_CHAN_GYRO_XYZ, &gyro) < 0 ||
+				heading_read_vec(SENSOR_CHAN_MAGN_XYZ, &raw_magn) < 0) {
+			continue;
+		}
+
+		float norm = sqrtf(heading_dot(&accel, &accel));
+
+		if (norm < 1.0f) {
+			// free fall, no gravity to level with
+			continue;
+		}
+		up = (struct heading_vec) {accel.x / norm, accel.y / norm, accel.z / norm};
+		// the AK8963 axes are the accel and gyro axes with x and y swapped and z reversed
+		magn = (struct heading_vec) {raw_magn.y, raw_magn.x, -raw_magn.z};
+
+		float mag_heading = heading_magnetic(&up, &magn);
+
+		if (!started) {
+			heading = mag_heading;
+			started = true;
+		} else {
+			// turning clockwise seen from above is a negative rotation about up
+			heading -= heading_dot(&gyro, &up) * HEADING_DT;
+			heading += HEADING_MAG_GAIN * heading_wrap(mag_heading - heading);
+		}
+		heading = heading_wrap(heading);
+
+		sensor_snapshot_set_heading((uint8_t) lroundf(heading * 128.0f / HEADING_PI));
+		atomic_set(&heading_ready, 1);
+	}
+}
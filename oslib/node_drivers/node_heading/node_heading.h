@@ -0,0 +1,33 @@
+// Geordie Pearson
+/*
+*************************************************************
+* @file oslib/node_drivers/node_heading/node_heading.h
+* @author Geordie Pearson - 45798232
+* @date 20-05-2022
+* @brief gyro and magnetometer heading fusion for mobile nodes
+*************************************************************
+*/
+
+#ifndef NODE_HEADING_H
+#define NODE_HEADING_H
+
+#include <zephyr.h>
+
+/* Defines thread specfics */
+#define HEADING_STACKSIZE 1536
+#define HEADING_PRIORITY 7
+
+// heading of a quarter turn, headings are in 1/256 of a turn clockwise from north
+#define HEADING_QUARTER 64
+
+// Gets whether the heading thread is producing fused headings, so the heading of the
+// mobile advert comes from it.
+// Returns:
+// 	true once the MPU9250 has been read
+bool heading_available(void);
+
+// Function that operates as thread opening point to fuse the MPU9250 gyro and
+// magnetometer into a heading at CONFIG_NODE_HEADING_RATE_HZ, written to the sensor snapshot.
+void handle_heading_mobile(void);
+
+#endif
@@ -0,0 +1,317 @@
+// Geordie Pearson
+/*
+*************************************************************
+* @file oslib/node_drivers/node_history/node_history.c
+* @author Geordie Pearson - 45798232
+* @date 20-05-2022
+* @brief flash store and forward of mobile reports made out of range
+*************************************************************
+*/
+
+#include <zephyr.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/atomic.h>
+#include <storage/flash_map.h>
+#include <fs/fcb.h>
+#if defined(CONFIG_SHELL)
+#include <shell/shell.h>
+#endif
+
+#include "node_history.h"
+
+#define HISTORY_BATCH CONFIG_NODE_HISTORY_BATCH
+#define HISTORY_AREA FLASH_AREA_ID(history)
+#define HISTORY_MAX_SECTORS 16
+#define HISTORY_MAGIC 0x48495354 // "HIST"
+
+/**
+ * report as stored in flash, one fcb entry holds a batch of them
+ **/
+struct history_record {
+	uint8_t boot; // boot the report was made in, counting up from the oldest stored
+	uint32_t uptime; // uptime (ms) the report was made at
+	struct mobile_ad m_ad;
+} __packed;
+
+struct history_stats history_stats;
+
+static struct flash_sector history_sectors[HISTORY_MAX_SECTORS];
+static struct fcb history_fcb;
+static bool history_ready = false;
+// boot the reports made now are stored with, one more than the newest stored
+static uint8_t history_boot = 0;
+
+// uptime (ms) a static node or the base was last heard, 0 if never
+static atomic_t link_heard = ATOMIC_INIT(0);
+
+/* reports made since the last batch was written, taken by the bt thread or the
+ * bulk upload thread, guarded by ram_lock */
+static struct history_record ram_batch[HISTORY_BATCH];
+static int ram_len = 0;
+static struct k_spinlock ram_lock;
+
+/* batch handed to the system work queue to be written */
+static struct history_record write_batch[HISTORY_BATCH];
+static int write_len = 0;
+static atomic_t write_busy = ATOMIC_INIT(0);
+
+/* guards the fcb and the read cursor between the bt thread and the writer */
+static K_MUTEX_DEFINE(history_lock);
+
+/* last entry read back from flash, fe_sector is NULL before the oldest entry */
+static struct fcb_entry read_loc;
+static struct history_record read_buf[HISTORY_BATCH];
+static int read_len = 0;
+static int read_pos = 0;
+
+/**
+ * append the batch to the flash ring. when the ring is full the oldest sector
+ * is erased, so each sector is only erased once per pass of the ring
+ **/
+static void history_write(struct k_work *work) {
+	struct fcb_entry loc;
+	uint16_t len = write_len * sizeof(struct history_record);
+	int ret;
+
+	k_mutex_lock(&history_lock, K_FOREVER);
+	ret = fcb_append(&history_fcb, len, &loc);
+	if (ret == -ENOSPC) {
+		// the oldest sector still holds reports to send unless the cursor is past it
+		if (read_loc.fe_sector == NULL || read_loc.fe_sector == history_fcb.f_oldest) {
+			history_stats.overwritten++;
+			read_loc.fe_sector = NULL;
+		}
+		ret = fcb_rotate(&history_fcb);
+		history_stats.erases++;
+		if (ret == 0) {
+			ret = fcb_append(&history_fcb, len, &loc);
+		}
+	}
+	if (ret == 0) {
+		ret = flash_area_write(history_fcb.fap, FCB_ENTRY_FA_DATA_OFF(loc), write_batch, len);
+	}
+	if (ret == 0) {
+		ret = fcb_append_finish(&history_fcb, &loc);
+	}
+	k_mutex_unlock(&history_lock);
+
+	if (ret) {
+		printk("History write failed with code %d.\n", ret);
+	} else {
+		history_stats.writes++;
+	}
+	atomic_set(&write_busy, 0);
+}
+
+K_WORK_DEFINE(history_write_work, history_write);
+
+/**
+ * find the boot of the newest stored batch, so reports made since this boot are
+ * told apart from those made before
+ **/
+static void history_find_boot(void) {
+	struct fcb_entry loc = {.fe_sector = NULL};
+	uint8_t boot;
+
+	while (fcb_getnext(&history_fcb, &loc) == 0) {
+		if (flash_area_read(history_fcb.fap, FCB_ENTRY_FA_DATA_OFF(loc) +
+				offsetof(struct history_record, boot), &boot, sizeof(boot)) == 0) {
+			history_boot = boot + 1;
+		}
+	}
+}
+
+int history_init(void) {
+	uint32_t count = ARRAY_SIZE(history_sectors);
+	int ret;
+
+	ret = flash_area_get_sectors(HISTORY_AREA, &count, history_sectors);
+	if (ret) {
+		printk("History flash area failed with code %d.\n", ret);
+		return ret;
+	}
+
+	history_fcb.f_magic = HISTORY_MAGIC;
+	history_fcb.f_version = 2;
+	history_fcb.f_sector_cnt = count;
+	history_fcb.f_scratch_cnt = 0;
+	history_fcb.f_sectors = history_sectors;
+	ret = fcb_init(HISTORY_AREA, &history_fcb);
+	if (ret == -ENOMSG) {
+		// stored in an older record layout, start again
+		const struct flash_area *fap;
+
+		ret = flash_area_open(HISTORY_AREA, &fap);
+		if (ret == 0) {
+			ret = flash_area_erase(fap, 0, fap->fa_size);
+			flash_area_close(fap);
+			history_stats.erases += count;
+		}
+		if (ret == 0) {
+			ret = fcb_init(HISTORY_AREA, &history_fcb);
+		}
+	}
+	if (ret) {
+		printk("History init failed with code %d.\n", ret);
+		return ret;
+	}
+
+	// reports stored before a reboot are kept and sent once back in range
+	history_find_boot();
+	read_loc.fe_sector = NULL;
+	history_ready = true;
+	return 0;
+}
+
+void history_link_heard(void) {
+	atomic_set(&link_heard, k_uptime_get_32());
+}
+
+bool history_link_up(void) {
+	uint32_t heard = atomic_get(&link_heard);
+
+	return heard != 0 && k_uptime_get_32() - heard < CONFIG_NODE_HISTORY_LINK_TIMEOUT_MS;
+}
+
+void history_store(const struct mobile_ad *m_ad) {
+	k_spinlock_key_t key;
+
+	if (!history_ready) {
+		return;
+	}
+
+	key = k_spin_lock(&ram_lock);
+	ram_batch[ram_len].boot = history_boot;
+	ram_batch[ram_len].uptime = k_uptime_get_32();
+	ram_batch[ram_len].m_ad = *m_ad;
+	ram_len++;
+	history_stats.stored++;
+	if (ram_len < HISTORY_BATCH) {
+		k_spin_unlock(&ram_lock, key);
+		return;
+	}
+
+	if (atomic_get(&write_busy)) {
+		// the last batch is still being written, make room by dropping the oldest report
+		memmove(ram_batch, ram_batch + 1, (HISTORY_BATCH - 1) * sizeof(ram_batch[0]));
+		ram_len--;
+		history_stats.dropped++;
+		k_spin_unlock(&ram_lock, key);
+		return;
+	}
+
+	memcpy(write_batch, ram_batch, sizeof(write_batch));
+	write_len = ram_len;
+	ram_len = 0;
+	atomic_set(&write_busy, 1);
+	k_spin_unlock(&ram_lock, key);
+	k_work_submit(&history_write_work);
+}
+
+/**
+ * read the next batch after the cursor back from flash, must hold history_lock.
+ * once the cursor leaves the oldest sector every report in it has been sent, so
+ * it is erased and not sent again after a reboot
+ **/
+static bool history_read_next(void) {
+	struct fcb_entry loc = read_loc;
+	uint16_t len;
+
+	if (fcb_getnext(&history_fcb, &loc) != 0) {
+		return false;
+	}
+	if (read_loc.fe_sector != NULL && loc.fe_sector != read_loc.fe_sector &&
+			read_loc.fe_sector == history_fcb.f_oldest && fcb_rotate(&history_fcb) == 0) {
+		history_stats.erases++;
+	}
+	read_loc = loc;
+	len = MIN(loc.fe_data_len, sizeof(read_buf));
+	read_pos = 0;
+	read_len = 0;
+	if (flash_area_read(history_fcb.fap, FCB_ENTRY_FA_DATA_OFF(loc), read_buf, len) == 0) {
+		read_len = len / sizeof(struct history_record);
+	}
+	return true;
+}
+
+bool history_pending(void) {
+	struct fcb_entry loc;
+	bool pending;
+
+	if (!history_ready) {
+		return false;
+	}
+	if (ram_len > 0 || atomic_get(&write_busy)) {
+		return true;
+	}
+	if (k_mutex_lock(&history_lock, K_NO_WAIT) != 0) {
+		return true;
+	}
+	loc = read_loc;
+	pending = read_pos < read_len || fcb_getnext(&history_fcb, &loc) == 0;
+	k_mutex_unlock(&history_lock);
+	return pending;
+}
+
+/**
+ * copy a stored report out for sending, with its age from now, unknown if it was
+ * made before a reboot
+ **/
+static void history_age(struct history_report *report, const struct history_record *record, uint32_t now) {
+	if (record->boot != history_boot) {
+		report->age = HISTORY_AGE_UNKNOWN;
+	} else {
+		report->age = MIN((now - record->uptime) / 100, HISTORY_AGE_UNKNOWN - 1);
+	}
+	report->m_ad = record->m_ad;
+}
+
+int history_take(struct history_report *reports, int max) {
+	uint32_t now = k_uptime_get_32();
+	k_spinlock_key_t key;
+	int n = 0;
+
+	if (!history_ready || k_mutex_lock(&history_lock, K_NO_WAIT) != 0) {
+		return 0;
+	}
+
+	// oldest first: flash, then the batch being written, then the batch in ram
+	while (n < max && (read_pos < read_len || history_read_next())) {
+		if (read_pos < read_len) {
+			history_age(&reports[n++], &read_buf[read_pos++], now);
+		}
+	}
+
+	key = k_spin_lock(&ram_lock);
+	if (!atomic_get(&write_busy)) {
+		int taken = MIN(max - n, ram_len);
+
+		for (int i = 0; i < taken; i++) {
+			history_age(&reports[n++], &ram_batch[i], now);
+		}
+		ram_len -= taken;
+		memmove(ram_batch, ram_batch + taken, ram_len * sizeof(ram_batch[0]));
+	}
+	history_stats.sent += n;
+	k_spin_unlock(&ram_lock, key);
+	k_mutex_unlock(&history_lock);
+	return n;
+}
+
+#if defined(CONFIG_SHELL)
+static int cmd_history_stats(const struct shell *shell, size_t argc, char **argv) {
+	shell_print(shell, "stored %u sent %u dropped %u", history_stats.stored, history_stats.sent,
+		history_stats.dropped);
+	shell_print(shell, "flash writes %u erases %u overwritten %u", history_stats.writes,
+		history_stats.erases, history_stats.overwritten);
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(history_cmds,
+	SHELL_CMD(stats, NULL, "stored report counters", cmd_history_stats),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(history, &history_cmds, "out of range report history", NULL);
+#endif
@@ -0,0 +1,65 @@
+// Geordie Pearson
+/*
+*************************************************************
+* @file oslib/node_drivers/node_history/node_history.h
+* @author Geordie Pearson - 45798232
+* @date 20-05-2022
+* @brief flash store and forward of mobile reports made out of range
+*************************************************************
+*/
+
+#ifndef NODE_HISTORY_H
+#define NODE_HISTORY_H
+
+#include <zephyr.h>
+
+#include "node_ble.h"
+
+/**
+ * report history counters
+ **/
+struct history_stats {
+	uint32_t stored; // reports made out of range
+	uint32_t sent; // stored reports advertised again
+	uint32_t writes; // batches written to flash
+	uint32_t erases; // flash sectors erased
+	uint32_t overwritten; // flash sectors reused before all their reports were sent
+	uint32_t dropped; // reports lost because a batch was still being written
+};
+
+extern struct history_stats history_stats;
+
+// Initialises the flash circular buffer on the history partition. Reports stored
+// before a reboot are kept, and sent with an unknown age as their uptimes no
+// longer mean anything.
+// Returns:
+// 	0 on success, otherwise a negative error code
+int history_init(void);
+
+// Notes that a static node or the base was heard, so the node is in range.
+// Safe to call from the bt rx callback.
+void history_link_heard(void);
+
+// Gets whether a static node or the base was heard in the last
+// CONFIG_NODE_HISTORY_LINK_TIMEOUT_MS.
+bool history_link_up(void);
+
+// Stores a report made out of range. Reports are batched in ram and written
+// CONFIG_NODE_HISTORY_BATCH at a time from the system work queue.
+// Parameters:
+// 	- m_ad: The report advertised
+void history_store(const struct mobile_ad *m_ad);
+
+// Gets whether any stored report is still to be sent.
+bool history_pending(void);
+
+// Takes the oldest stored reports still to be sent, aged for sending now. Safe to
+// call from the bt thread and the bulk upload thread.
+// Parameters:
+// 	- reports: Where the reports are copied to
+// 	- max: The most reports to take
+// Returns:
+// 	The number of reports taken, 0 if there are none or the flash is busy
+int history_take(struct history_report *reports, int max);
+
+#endif
@@ -0,0 +1,162 @@
+// Geordie Pearson
+/*
+*************************************************************
+* @file oslib/node_drivers/node_relay/node_relay.c
+* @author Geordie Pearson - 45798232
+* @date 20-05-2022
+* @brief relay queue between the bt scan callback and the static node thread
+*************************************************************
+*/
+
+#include <zephyr.h>
+#include <sys/atomic.h>
+#include <string.h>
+
+#include "node_relay.h"
+
+#define RELAY_RING_SIZE CONFIG_NODE_RELAY_RING_SIZE
+#define RELAY_RING_MASK (RELAY_RING_SIZE - 1)
+
+BUILD_ASSERT((RELAY_RING_SIZE & RELAY_RING_MASK) == 0, "relay ring size must be a power of 2");
+
+/**
+ * records live in a slab, the ring only carries pointers to them. the slab has
+ * a spare block for each record the consumer takes off the ring for the frame
+ * it is advertising, so a full slab never turns away a record the ring has room for
+ **/
+K_MEM_SLAB_DEFINE(relay_slab, sizeof(struct relay_record), RELAY_RING_SIZE + RELAY_MAX_REPORTS, 4);
+
+static struct relay_record *relay_ring[RELAY_RING_SIZE];
+
+/**
+ * single producer single consumer indices, head is only written by the bt rx
+ * context and tail only by the static node thread. both run freely and are
+ * masked on access
+ **/
+static atomic_t relay_head = ATOMIC_INIT(0);
+static atomic_t relay_tail = ATOMIC_INIT(0);
+
+struct relay_stats relay_stats;
+
+/**
+ * recently relayed reports, keyed on (origin static, mobile id, seq). the oldest
+ * entry is replaced when the cache is full, so a report is forwarded at most once
+ * while it is still in flight
+ **/
+struct relay_seen {
+	bool valid;
+	int8_t origin;
+	char m_id;
+	uint8_t seq;
+};
+
+static struct relay_seen relay_seen[CONFIG_NODE_RELAY_SEEN_CACHE_SIZE];
+static uint8_t relay_seen_next = 0;
+
+/**
+ * gradient route to the base, the lowest hop count heard recently. a worse
+ * route is only accepted once the best one has not been refreshed for
+ * CONFIG_NODE_ROUTE_TIMEOUT_MS
+ **/
+static uint8_t route_hops = HOPS_UNKNOWN;
+static uint32_t route_updated = 0;
+
+int relay_ring_put(uint8_t type, int8_t rssi, const void *ad, size_t len) {
+	struct relay_record *rec;
+	size_t ad_len = (type == RELAY_RECORD_STATIC) ? sizeof(struct static_ad) : sizeof(struct mobile_ad);
+	atomic_val_t head = atomic_get(&relay_head);
+
+	if (len < ad_len) {
+		return -EINVAL;
+	}
+
+	if ((uint32_t) (head - atomic_get(&relay_tail)) >= RELAY_RING_SIZE ||
+			k_mem_slab_alloc(&relay_slab, (void **) &rec, K_NO_WAIT) != 0) {
+		relay_stats.overflow++;
+		return -ENOMEM;
+	}
+
+	rec->type = type;
+	rec->rssi = rssi;
+	memcpy(&rec->m_ad, ad, ad_len);
+
+	relay_ring[head & RELAY_RING_MASK] = rec;
+	// publish the record only once it is fully written
+	atomic_set(&relay_head, head + 1);
+	relay_stats.pushed++;
+	return 0;
+}
+
+struct relay_record *relay_ring_get(void) {
+	struct relay_record *rec;
+	atomic_val_t tail = atomic_get(&relay_tail);
+
+	if (tail == atomic_get(&relay_head)) {
+		return NULL;
+	}
+
+	rec = relay_ring[tail & RELAY_RING_MASK];
+	atomic_set(&relay_tail, tail + 1);
+	return rec;
+}
+
+void relay_ring_free(struct relay_record *rec) {
+	k_mem_slab_free(&relay_slab, (void **) &rec);
+}
+
+void relay_ring_drop(struct relay_record *rec) {
+	relay_stats.dropped++;
+	relay_ring_free(rec);
+}
+
+uint32_t relay_ring_pending(void) {
+	return (uint32_t) (atomic_get(&relay_head) - atomic_get(&relay_tail));
+}
+
+bool relay_seen_check(int8_t origin, char m_id, uint8_t seq) {
+	for (int i = 0; i < ARRAY_SIZE(relay_seen); i++) {
+		struct relay_seen *seen = &relay_seen[i];
+
+		if (seen->valid && seen->seq == seq && seen->m_id == m_id && seen->origin == origin) {
+			relay_stats.seen_hits++;
+			return true;
+		}
+	}
+	relay_stats.seen_misses++;
+	return false;
+}
+
+void relay_seen_mark(int8_t origin, char m_id, uint8_t seq) {
+	relay_seen[relay_seen_next] = (struct relay_seen) {.valid = true, .origin = origin, .m_id = m_id, .seq = seq};
+	relay_seen_next = (relay_seen_next + 1) % ARRAY_SIZE(relay_seen);
+}
+
+void relay_route_update(uint8_t sender_hops) {
+	uint8_t hops;
+
+	if (sender_hops >= HOPS_UNKNOWN - 1) {
+		return;
+	}
+
+	hops = sender_hops + 1;
+	if (hops <= relay_route_hops()) {
+		route_hops = hops;
+		route_updated = k_uptime_get_32();
+	}
+}
+
+uint8_t relay_route_hops(void) {
+	if (k_uptime_get_32() - route_updated > CONFIG_NODE_ROUTE_TIMEOUT_MS) {
+		return HOPS_UNKNOWN;
+	}
+	return route_hops;
+}
+
+bool relay_route_should_forward(uint8_t sender_hops) {
+	uint8_t hops = relay_route_hops();
+
+	if (hops == HOPS_UNKNOWN) {
+		return true;
+	}
+	return hops < sender_hops;
+}
@@ -0,0 +1,127 @@
+// Geordie Pearson
+/*
+*************************************************************
+* @file oslib/node_drivers/node_relay/node_relay.h
+* @author Geordie Pearson - 45798232
+* @date 20-05-2022
+* @brief relay queue between the bt scan callback and the static node thread
+*************************************************************
+*/
+
+#ifndef NODE_RELAY_H
+#define NODE_RELAY_H
+
+#include <zephyr.h>
+
+#include "node_ble.h"
+
+/**
+ * aggregated frames fill the legacy 31 byte payload after the AGG_ADV_TYPE header
+ * (2 bytes), or a larger extended advertising payload. the frames are not
+ * connectable, so carry no flags or name
+ **/
+#if defined(CONFIG_NODE_RELAY_EXT_ADV)
+#define RELAY_FRAME_LEN CONFIG_NODE_RELAY_EXT_ADV_DATA_LEN
+#else
+#define RELAY_FRAME_LEN (BT_GAP_ADV_MAX_ADV_DATA_LEN - 2)
+#endif
+#define RELAY_REPORTS(len) (((len) - sizeof(struct agg_ad)) / sizeof(struct static_ad))
+// records taken off the ring for one relay frame, held until it is advertised
+#define RELAY_MAX_REPORTS RELAY_REPORTS(RELAY_FRAME_LEN)
+
+/* Defines the kinds of record carried by the relay ring */
+#define RELAY_RECORD_MOBILE 0
+#define RELAY_RECORD_STATIC 1
+
+/**
+ * advert waiting to be relayed by a static node
+ **/
+struct relay_record {
+	uint8_t type; // RELAY_RECORD_MOBILE or RELAY_RECORD_STATIC
+	int8_t rssi; // rssi the advert was received with, RSSI_NONE for stored reports
+	union {
+		struct mobile_ad m_ad;
+		struct static_ad s_ad;
+	};
+};
+
+/**
+ * relay ring counters
+ **/
+struct relay_stats {
+	uint32_t pushed; // records accepted from the scan callback
+	uint32_t overflow; // records rejected because the ring was full
+	uint32_t dropped; // records taken off the ring but never relayed
+	uint32_t seen_hits; // reports suppressed as already relayed
+	uint32_t seen_misses; // reports not seen before
+};
+
+extern struct relay_stats relay_stats;
+
+// Queues a received advert for relaying. Must only be called from the bt rx context
+// (the single producer).
+// Parameters:
+// 	- type: RELAY_RECORD_MOBILE or RELAY_RECORD_STATIC
+// 	- rssi: The rssi the advert was received with
+// 	- ad: The advert payload, a struct mobile_ad or struct static_ad
+// 	- len: The length of the advert payload
+// Returns:
+// 	0 on success, -EINVAL if the payload is too short, -ENOMEM if the ring is full
+int relay_ring_put(uint8_t type, int8_t rssi, const void *ad, size_t len);
+
+// Takes the oldest record off the ring. Must only be called from the static node thread
+// (the single consumer), and the record must be handed back with relay_ring_free or
+// relay_ring_drop.
+// Returns:
+// 	The oldest record, or NULL if the ring is empty
+struct relay_record *relay_ring_get(void);
+
+// Releases a record that has been relayed.
+void relay_ring_free(struct relay_record *rec);
+
+// Releases a record that could not be relayed and counts it as dropped.
+void relay_ring_drop(struct relay_record *rec);
+
+// Gets the number of records waiting on the ring.
+uint32_t relay_ring_pending(void);
+
+// Checks a report against the recently relayed cache. Must only be called from the
+// bt rx context.
+// Parameters:
+// 	- origin: The static node that first relayed the report
+// 	- m_id: The mobile node the report is from
+// 	- seq: The sequence number of the report
+// Returns:
+// 	true if the report was already seen, false otherwise
+bool relay_seen_check(int8_t origin, char m_id, uint8_t seq);
+
+// Remembers a report in the recently relayed cache, replacing the oldest entry. Only
+// called once the report is queued, so a report the full ring turned away is taken
+// again when it is heard next. Must only be called from the bt rx context.
+// Parameters:
+// 	- origin: The static node that first relayed the report
+// 	- m_id: The mobile node the report is from
+// 	- seq: The sequence number of the report
+void relay_seen_mark(int8_t origin, char m_id, uint8_t seq);
+
+// Updates the gradient route from a frame heard from the base or another static node.
+// Must only be called from the bt rx context.
+// Parameters:
+// 	- sender_hops: The hop count to the base advertised by the sender
+void relay_route_update(uint8_t sender_hops);
+
+// Gets this node's hop count to the base.
+// Returns:
+// 	The hop count, or HOPS_UNKNOWN if no route is known
+uint8_t relay_route_hops(void);
+
+// Checks whether reports heard from a static node should be forwarded. With a known
+// route only reports moving closer to the base are forwarded, otherwise the node falls
+// back to flooding them.
+// Parameters:
+// 	- sender_hops: The hop count to the base advertised by the sender
+// Returns:
+// 	true if the reports should be forwarded
+bool relay_route_should_forward(uint8_t sender_hops);
+
+#endif
@@ -15,7 +15,14 @@
 #include <drivers/gpio.h>
 #include <drivers/sensor.h>
 #include <drivers/regulator.h>
+#include <sys/atomic.h>
+#include <spinlock.h>
 #include "node_sensors.h"
+#if MOBILE_NODE == 1
+#include "node_accel.h"
+#include "node_steps.h"
+#include "node_heading.h"
+#endif
 
 #if MOBILE_NODE == 1
 	/* Device handles for IO peripherals */
@@ -44,13 +51,63 @@
 	// static const struct device* thingy52_mpu;
 #endif
 
-int dir_buffer = 0;
-int step_buffer = 0; 
 static const int lis2dh_sensors[1] = {SENSOR_CHAN_ACCEL_XYZ};
 io_data io = {{0, 0, 0}, 0, 0, 100, 10};
 sensor_data data = {0, 0, 0, 0, 0, 0, 0, 0};
 K_SEM_DEFINE(sensor_sem, 1, 1);
 
+// odd while a writer is updating the snapshot
+static atomic_t snapshot_seq = ATOMIC_INIT(0);
+// serialises the sensor and heading thread writers
+static struct k_spinlock snapshot_lock;
+static struct sensor_snapshot snapshot;
+
+/**
+ * Starts a snapshot update, readers retry until it ends
+ **/
+static k_spinlock_key_t snapshot_write_begin(void) {
+	k_spinlock_key_t key = k_spin_lock(&snapshot_lock);
+
+	atomic_inc(&snapshot_seq);
+	compiler_barrier();
+	return key;
+}
+
+/**
+ * Ends a snapshot update
+ **/
+static void snapshot_write_end(k_spinlock_key_t key) {
+	snapshot.timestamp = k_uptime_get_32();
+	compiler_barrier();
+	atomic_inc(&snapshot_seq);
+	k_spin_unlock(&snapshot_lock, key);
+}
+
+void sensor_snapshot_add_steps(int steps) {
+	k_spinlock_key_t key = snapshot_write_begin();
+
+	snapshot.steps += steps;
+	snapshot_write_end(key);
+}
+
+void sensor_snapshot_set_heading(uint8_t heading) {
+	k_spinlock_key_t key = snapshot_write_begin();
+
+	snapshot.heading = heading;
+	snapshot_write_end(key);
+}
+
+void sensor_snapshot_read(struct sensor_snapshot* snap) {
+	atomic_val_t seq;
+
+	do {
+		seq = atomic_get(&snapshot_seq);
+		compiler_barrier();
+		*snap = snapshot;
+		compiler_barrier();
+	} while ((seq & 1) || seq != atomic_get(&snapshot_seq));
+}
+
 #if MOBILE_NODE == 1
 int init_led(io_data* data, int led_num) {
 	int ret = -1;
@@ -195,6 +252,24 @@ uint8_t acceleration_to_direction(sensor_data* data) {
 	return (uint8_t) direction;
 }
 
+/**
+ * Stores the mean of a batch of accelerometer samples in the sensor data, in m/s^2
+ * like the sensor driver readings
+ **/
+static void accel_batch_to_data(const struct accel_sample* samples, int count, sensor_data* data) {
+	int32_t sum[3] = {0, 0, 0};
+
+	for (int i = 0; i < count; i++) {
+		sum[0] += samples[i].x;
+		sum[1] += samples[i].y;
+		sum[2] += samples[i].z;
+	}
+	// samples are in mg, SENSOR_G is in micro m/s^2
+	data->x_accel = (double) sum[0] / count * SENSOR_G / 1000000000.0;
+	data->y_accel = (double) sum[1] / count * SENSOR_G / 1000000000.0;
+	data->z_accel = (double) sum[2] / count * SENSOR_G / 1000000000.0;
+}
+
 void handle_sensor_mobile() {
 	for (int i = 0; i < 3; i++) {
 		init_led(&io, i);
@@ -205,17 +280,42 @@ void handle_sensor_mobile() {
 	int step = 0;
 	int direction = 0;
 	int delay = 0;
+	bool fifo = IS_ENABLED(CONFIG_NODE_ACCEL_FIFO);
+	struct accel_sample batch[ACCEL_FIFO_DEPTH];
+	struct step_detector steps;
+
+	step_detector_init(&steps);
+
+	if (fifo && accel_fifo_init() != 0) {
+		printk("Accelerometer FIFO init failed, polling instead.\n");
+		fifo = false;
+	}
 
 	while(1) {
-		k_sem_take(&sensor_sem, K_FOREVER);
-		read_sensor(thingy52_lis2dh, lis2dh_sensors, 1, &data);
-	
-		step = acceleration_to_step(data, prev_values);
+		if (fifo) {
+			// the batch is drained outside the semaphore so the bt thread is not held up
+			int count = accel_fifo_read(batch);
+
+			if (count <= 0) {
+				continue;
+			}
+			step = step_detector_process(&steps, batch, count);
+			k_sem_take(&sensor_sem, K_FOREVER);
+			accel_batch_to_data(batch, count, &data);
+		} else {
+			k_sem_take(&sensor_sem, K_FOREVER);
+			read_sensor(thingy52_lis2dh, lis2dh_sensors, 1, &data);
+			step = acceleration_to_step(data, prev_values);
+		}
+
 		if (delay == 0) {
 			direction = acceleration_to_direction(&data);
 			if (direction != data.dir) {
 				delay = 5;
-				step = 0;
+				// the polled heuristic takes turns for steps
+				if (!fifo) {
+					step = 0;
+				}
 			}
 		}
 		prev_values[0] = data.x_accel;
@@ -224,14 +324,21 @@ void handle_sensor_mobile() {
 		data.dir = direction;
 		// update buffer
 	
-		step_buffer = step;
-		dir_buffer = direction;
+		if (step > 0) {
+			sensor_snapshot_add_steps(step);
+		}
+		// the fused heading is written by the heading thread
+		if (!IS_ENABLED(CONFIG_NODE_HEADING) || !heading_available()) {
+			sensor_snapshot_set_heading(direction * HEADING_QUARTER);
+		}
 		if (delay > 0) {
 		 	delay -= 1;
 		}
 
 		k_sem_give(&sensor_sem);
-		k_msleep(SENSORS_SLEEP);
+		if (!fifo) {
+			k_msleep(SENSORS_SLEEP);
+		}
 	}
 }
 #endif
@@ -41,7 +41,7 @@
 #define LED_BLUE_INDEX 2
 
 /* Defines thread specfics */
-#define SENSORS_STACKSIZE 1024
+#define SENSORS_STACKSIZE 1536
 #define SENSORS_PRIORITY 7
 #define SENSORS_SLEEP 1000
 
@@ -72,9 +72,14 @@ typedef struct sensor_data {
 	int dir;
 } sensor_data;
 
-// Global variable buffers
-extern int step_buffer;
-extern int dir_buffer;
+/**
+ * motion of the mobile node as last reported by the sensor threads
+ **/
+struct sensor_snapshot {
+	uint16_t steps; // steps since boot, wrapping
+	uint8_t heading; // 1/256 of a turn clockwise from north
+	uint32_t timestamp; // uptime (ms) of the last update
+};
 
 /* Function Prototypes */
 // Initializes the given LED.
@@ -144,6 +149,23 @@ uint8_t acceleration_to_step(sensor_data data, int* prev_values);
 // 	The current bearing of the mobile node
 uint8_t acceleration_to_direction(sensor_data* data);
 
+// Adds steps to the cumulative step count of the snapshot. Steps are never lost
+// between two reads, the reader differences the counts.
+// Parameters:
+// 	- steps: The number of steps detected
+void sensor_snapshot_add_steps(int steps);
+
+// Sets the heading of the snapshot.
+// Parameters:
+// 	- heading: The heading in 1/256 of a turn clockwise from north
+void sensor_snapshot_set_heading(uint8_t heading);
+
+// Reads a consistent copy of the snapshot without blocking the writers. The
+// snapshot is sequence locked, so a read that overlaps a write is retried.
+// Parameters:
+// 	- snap: The copy of the snapshot
+void sensor_snapshot_read(struct sensor_snapshot* snap);
+
 // Function that operates as thread opening point to handle all mobile sensor interactions.
 void handle_sensor_mobile(void);
 
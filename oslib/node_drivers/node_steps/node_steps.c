@@ -0,0 +1,157 @@
+// Geordie Pearson
+/*
+*************************************************************
+* @file oslib/node_drivers/node_steps/node_steps.c
+* @author Geordie Pearson - 45798232
+* @date 20-05-2022
+* @brief fixed point streaming step detection on accelerometer batches
+*************************************************************
+*/
+
+#include <zephyr.h>
+#include <string.h>
+
+#include "node_steps.h"
+
+/* Band-pass biquad around 2 Hz (Q 0.7) for each sample rate, coefficients in Q14.
+ * b1 is 0 and b2 is -b0, so the gravity offset of the magnitude is removed.
+ * Same direct form I as arm_biquad_cascade_df1_q15 with a postShift of 1. */
+#define STEP_COEFF_SHIFT 14
+#if CONFIG_NODE_ACCEL_ODR_HZ == 10
+#define STEP_B0 6628
+#define STEP_A1 -6030
+#define STEP_A2 3129
+#elif CONFIG_NODE_ACCEL_ODR_HZ == 25
+#define STEP_B0 4195
+#define STEP_A1 -21363
+#define STEP_A2 7995
+#elif CONFIG_NODE_ACCEL_ODR_HZ == 50
+#define STEP_B0 2471
+#define STEP_A1 -26951
+#define STEP_A2 11441
+#elif CONFIG_NODE_ACCEL_ODR_HZ == 100
+#define STEP_B0 1346
+#define STEP_A1 -29838
+#define STEP_A2 13692
+#else
+#error "no step filter for this accelerometer sample rate"
+#endif
+
+#define STEP_MIN_INTERVAL (CONFIG_NODE_STEP_MIN_INTERVAL_MS * CONFIG_NODE_ACCEL_ODR_HZ / 1000)
+#define STEP_MIN_PEAK CONFIG_NODE_STEP_MIN_PEAK_MG
+#define STEP_PEAK_EWMA_SHIFT 2
+
+/**
+ * integer square root, rounded down
+ **/
+static uint16_t step_isqrt(uint32_t v) {
+	uint32_t root = 0;
+
+	for (uint32_t bit = 1UL << 30; bit != 0; bit >>= 2) {
+		if (v >= root + bit) {
+			v -= root + bit;
+			root = (root >> 1) + bit;
+		} else {
+			root >>= 1;
+		}
+	}
+	return root;
+}
+
+/**
+ * magnitude of each sample (mg)
+ **/
+static void step_magnitude(const struct accel_sample *samples, int16_t *mag, int count) {
+	for (int i = 0; i < count; i++) {
+		int32_t x = samples[i].x;
+		int32_t y = samples[i].y;
+		int32_t z = samples[i].z;
+
+		mag[i] = step_isqrt(x * x + y * y + z * z);
+	}
+}
+
+/**
+ * band-pass filters the magnitudes in place
+ **/
+static void step_filter(struct step_detector *sd, int16_t *buf, int count) {
+	int16_t x1 = sd->x[0], x2 = sd->x[1];
+	int16_t y1 = sd->y[0], y2 = sd->y[1];
+
+	for (int i = 0; i < count; i++) {
+		int16_t x0 = buf[i];
+		int32_t acc = STEP_B0 * (x0 - x2) - STEP_A1 * y1 - STEP_A2 * y2;
+		int16_t y0 = CLAMP(acc >> STEP_COEFF_SHIFT, INT16_MIN, INT16_MAX);
+
+		x2 = x1;
+		x1 = x0;
+		y2 = y1;
+		y1 = y0;
+		buf[i] = y0;
+	}
+
+	sd->x[0] = x1;
+	sd->x[1] = x2;
+	sd->y[0] = y1;
+	sd->y[1] = y2;
+}
+
+/**
+ * counts the filtered peaks above half the running peak average, spaced at least
+ * STEP_MIN_INTERVAL apart. The average halves for every second without a step so
+ * gentler walking is picked up again.
+ **/
+static int step_peaks(struct step_detector *sd, const int16_t *buf, int count, int16_t prev,
+		int16_t prev2) {
+	int steps = 0;
+
+	for (int i = 0; i < count; i++) {
+		int32_t threshold = MAX(sd->peak_avg / 2, STEP_MIN_PEAK);
+
+		// prev is a peak once the signal falls again
+		if (prev2 < prev && prev >= buf[i] && prev > threshold &&
+				sd->since_step >= STEP_MIN_INTERVAL) {
+			sd->peak_avg += (prev - sd->peak_avg) >> STEP_PEAK_EWMA_SHIFT;
+			// the step was the previous sample
+			sd->since_step = 1;
+			steps++;
+		} else if (++sd->since_step % CONFIG_NODE_ACCEL_ODR_HZ == 0) {
+			sd->peak_avg /= 2;
+		}
+		prev2 = prev;
+		prev = buf[i];
+	}
+	return steps;
+}
+
+void step_detector_init(struct step_detector *sd) {
+	memset(sd, 0, sizeof(*sd));
+	sd->peak_avg = 2 * STEP_MIN_PEAK;
+	sd->since_step = STEP_MIN_INTERVAL;
+}
+
+int step_detector_process(struct step_detector *sd, const struct accel_sample *samples, int count) {
+	int16_t buf[ACCEL_FIFO_DEPTH];
+	int16_t prev = sd->y[0];
+	int16_t prev2 = sd->y[1];
+	int steps;
+
+	count = MIN(count, ACCEL_FIFO_DEPTH);
+	if (count <= 0) {
+		return 0;
+	}
+
+	// one pass per stage over the whole batch, so each loop can be vectorised
+	step_magnitude(samples, buf, count);
+	if (!sd->primed) {
+		// start the filter from rest at the first magnitude instead of from 0 g
+		sd->x[0] = buf[0];
+		sd->x[1] = buf[0];
+		sd->primed = true;
+	}
+	step_filter(sd, buf, count);
+	steps = step_peaks(sd, buf, count, prev, prev2);
+
+	sd->steps += steps;
+	return steps;
+}
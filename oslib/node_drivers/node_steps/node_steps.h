@@ -0,0 +1,47 @@
+// Geordie Pearson
+/*
+*************************************************************
+* @file oslib/node_drivers/node_steps/node_steps.h
+* @author Geordie Pearson - 45798232
+* @date 20-05-2022
+* @brief fixed point streaming step detection on accelerometer batches
+*************************************************************
+*/
+
+#ifndef NODE_STEPS_H
+#define NODE_STEPS_H
+
+#include <zephyr.h>
+
+#include "node_accel.h"
+
+/**
+ * state of the step detector carried from one batch to the next
+ **/
+struct step_detector {
+	int16_t x[2]; // last two magnitudes (mg), newest first
+	int16_t y[2]; // last two filtered magnitudes (mg), newest first
+	int32_t peak_avg; // running average of the step peaks (mg)
+	uint32_t since_step; // samples since the last step
+	uint32_t steps; // steps detected since init
+	bool primed; // filter state holds real samples
+};
+
+// Resets a step detector.
+// Parameters:
+// 	- sd: The step detector
+void step_detector_init(struct step_detector *sd);
+
+// Detects the steps in a batch of accelerometer samples taken at
+// CONFIG_NODE_ACCEL_ODR_HZ. The acceleration magnitude is band-pass filtered around
+// walking cadence, and each filtered peak above an adaptive threshold that comes at
+// least CONFIG_NODE_STEP_MIN_INTERVAL_MS after the last step counts as a step.
+// Parameters:
+// 	- sd: The step detector
+// 	- samples: The samples, oldest first
+// 	- count: The number of samples, at most ACCEL_FIFO_DEPTH
+// Returns:
+// 	The number of steps detected in the batch
+int step_detector_process(struct step_detector *sd, const struct accel_sample *samples, int count);
+
+#endif
@@ -0,0 +1,65 @@
+// Geordie Pearson
+/*
+*************************************************************
+* @file oslib/node_drivers/node_tdma/node_tdma.c
+* @author Geordie Pearson - 45798232
+* @date 20-05-2022
+* @brief base synchronised clock and slot schedule for nodes
+*************************************************************
+*/
+
+#include <zephyr.h>
+
+#include "node_tdma.h"
+
+struct tdma_stats tdma_stats;
+
+/**
+ * the network time in a beacon is only ever late, by however long the advert
+ * sat in the air and the controller before we parsed it. the largest offset
+ * seen over CONFIG_NODE_TDMA_SYNC_SAMPLES beacons is therefore the best estimate
+ **/
+static int64_t epoch_max;
+static uint8_t epoch_samples = 0;
+static bool offset_valid = false;
+static uint32_t last_sync = 0;
+
+void tdma_sync_sample(int64_t net_time) {
+	int64_t now = k_uptime_get();
+	int64_t sample = net_time - now;
+
+	if (epoch_samples == 0 || sample > epoch_max) {
+		epoch_max = sample;
+	}
+	epoch_samples++;
+	tdma_stats.samples++;
+	last_sync = now;
+
+	// take the first sample straight away so the schedule starts before the first estimate
+	if (epoch_samples >= CONFIG_NODE_TDMA_SYNC_SAMPLES || !offset_valid) {
+		tdma_stats.last_correction = offset_valid ? epoch_max - tdma_stats.offset : 0;
+		tdma_stats.offset = epoch_max;
+		tdma_stats.estimates++;
+		offset_valid = true;
+		epoch_samples = 0;
+	}
+}
+
+bool tdma_synced(void) {
+	return offset_valid && (k_uptime_get_32() - last_sync) <= CONFIG_NODE_TDMA_SYNC_TIMEOUT_MS;
+}
+
+int64_t tdma_net_time(void) {
+	int64_t now = k_uptime_get();
+
+	return tdma_synced() ? now + tdma_stats.offset : now;
+}
+
+int64_t tdma_next_slot(uint8_t slot) {
+	int64_t now = k_uptime_get();
+	// the 64 bit network time never wraps, so the frame phase is the same on every node
+	uint32_t frame_pos = (now + tdma_stats.offset) % TDMA_FRAME_MS;
+	uint32_t slot_start = TDMA_SLOT_START(slot);
+
+	return now + (slot_start + TDMA_FRAME_MS - frame_pos) % TDMA_FRAME_MS;
+}
@@ -0,0 +1,64 @@
+// Geordie Pearson
+/*
+*************************************************************
+* @file oslib/node_drivers/node_tdma/node_tdma.h
+* @author Geordie Pearson - 45798232
+* @date 20-05-2022
+* @brief base synchronised clock and slot schedule for nodes
+*************************************************************
+*/
+
+#ifndef NODE_TDMA_H
+#define NODE_TDMA_H
+
+#include <zephyr.h>
+
+/* Defines the slot layout of a tdma frame, mobile slots first then static relay slots,
+ * which are long enough for several relay frames */
+#define TDMA_SLOTS (CONFIG_NODE_TDMA_MOBILE_SLOTS + CONFIG_NODE_TDMA_STATIC_SLOTS)
+#define TDMA_STATIC_SLOT_MS (CONFIG_NODE_RELAY_SLOT_MS * CONFIG_NODE_TDMA_STATIC_SLOT_FRAMES)
+#define TDMA_FRAME_MS (CONFIG_NODE_TDMA_SLOT_MS * CONFIG_NODE_TDMA_MOBILE_SLOTS + \
+		TDMA_STATIC_SLOT_MS * CONFIG_NODE_TDMA_STATIC_SLOTS)
+#define TDMA_SLOT_START(slot) ((slot) < CONFIG_NODE_TDMA_MOBILE_SLOTS ? (slot) * CONFIG_NODE_TDMA_SLOT_MS : \
+		CONFIG_NODE_TDMA_MOBILE_SLOTS * CONFIG_NODE_TDMA_SLOT_MS + \
+		((slot) - CONFIG_NODE_TDMA_MOBILE_SLOTS) * TDMA_STATIC_SLOT_MS)
+#define TDMA_SLOT_LEN(slot) ((slot) < CONFIG_NODE_TDMA_MOBILE_SLOTS ? CONFIG_NODE_TDMA_SLOT_MS : TDMA_STATIC_SLOT_MS)
+#define TDMA_MOBILE_SLOT(id) ((id) % CONFIG_NODE_TDMA_MOBILE_SLOTS)
+#define TDMA_STATIC_SLOT(id) (CONFIG_NODE_TDMA_MOBILE_SLOTS + ((id) % CONFIG_NODE_TDMA_STATIC_SLOTS))
+
+/**
+ * clock offset tracking counters
+ **/
+struct tdma_stats {
+	uint32_t samples; // time sync beacons heard
+	uint32_t estimates; // offset estimates completed
+	int64_t offset; // current network time - local uptime (ms)
+	int32_t last_correction; // change of the offset at the last estimate (ms)
+};
+
+extern struct tdma_stats tdma_stats;
+
+// Feeds the network time carried by a time sync beacon into the clock offset estimate.
+// Must only be called from the bt rx context.
+// Parameters:
+// 	- net_time: The network time (ms) in the beacon, with its epoch
+void tdma_sync_sample(int64_t net_time);
+
+// Checks whether the node clock is synchronised to the base.
+// Returns:
+// 	true if a time sync beacon was heard within CONFIG_NODE_TDMA_SYNC_TIMEOUT_MS
+bool tdma_synced(void);
+
+// Gets the current network time.
+// Returns:
+// 	The network time (ms), the local uptime when not synchronised
+int64_t tdma_net_time(void);
+
+// Gets when the given slot next starts.
+// Parameters:
+// 	- slot: The slot index within the tdma frame
+// Returns:
+// 	The local uptime (ms) the slot next starts at, at or after now
+int64_t tdma_next_slot(uint8_t slot);
+
+#endif
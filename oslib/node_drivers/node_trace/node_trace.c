@@ -0,0 +1,111 @@
+// Geordie Pearson
+/*
+*************************************************************
+* @file oslib/node_drivers/node_trace/node_trace.c
+* @author Geordie Pearson - 45798232
+* @date 20-05-2022
+* @brief deferred binary trace of node events
+*************************************************************
+*/
+
+#include <zephyr.h>
+#include <string.h>
+#include <spinlock.h>
+
+#include "node_trace.h"
+
+#define TRACE_RING_SIZE CONFIG_NODE_TRACE_RING_SIZE
+#define TRACE_RING_MASK (TRACE_RING_SIZE - 1)
+
+BUILD_ASSERT((TRACE_RING_SIZE & TRACE_RING_MASK) == 0, "trace ring size must be a power of 2");
+
+/**
+ * format of each event, given the TRACE_ARGS arguments of its record
+ **/
+static const char *const trace_formats[TRACE_EVENT_COUNT] = {
+	[TRACE_RX_MOBILE] = "mobile adv found, rssi: %d len: %d",
+	[TRACE_RX_STATIC] = "static adv found, rssi: %d len: %d",
+	[TRACE_RX_AGG] = "agg adv found, rssi: %d, %d reports hops %d",
+	[TRACE_SCAN_START] = "Scan start ret:%d",
+	[TRACE_ADV_START] = "Adv start ret:%d",
+	[TRACE_ADV_STOP] = "Adv stopped",
+	[TRACE_SCAN_EXTEND] = "adv found, staying in scanning mode a little longer",
+	[TRACE_TO_ADV] = "Switching to advertising",
+	[TRACE_TO_SCAN] = "Switching to scanning offset:%d",
+	[TRACE_RELAY_ADV_START] = "SN Adv started ret:%d",
+	[TRACE_RELAY_QUEUE] = "relay hops:%d pending:%d overflow:%d",
+	[TRACE_RELAY_STATS] = "relay dropped:%d seen hit:%d miss:%d",
+	[TRACE_SCHED_STATS] = "[sched] %d windows, jitter avg %d us max %d us",
+	[TRACE_SCAN_STATS] = "[sched] scan callbacks %d useful %d",
+	[TRACE_ACCEL_BATCH] = "accel batch of %d samples, %d overruns",
+	[TRACE_DUTY_STATS] = "[duty] level %d, radio on %d s per hour, %d motion wakes",
+	[TRACE_HISTORY_STATS] = "[history] stored %d sent %d dropped %d",
+	[TRACE_BULK_STATS] = "[bulk] connections %d notifications %d lost %d",
+	[TRACE_CONTACT_STATS] = "[contact] episodes %d sent %d dropped %d",
+};
+
+struct trace_stats trace_stats;
+
+static struct trace_record trace_ring[TRACE_RING_SIZE];
+static uint32_t trace_head = 0; // next record to write
+static uint32_t trace_tail = 0; // next record to format
+static struct k_spinlock trace_lock;
+
+void trace_write(uint8_t event, const int32_t *args) {
+	k_spinlock_key_t key = k_spin_lock(&trace_lock);
+
+	if (trace_head - trace_tail >= TRACE_RING_SIZE) {
+		// keep the older records, the gap shows up as a drop count
+		trace_stats.dropped++;
+	} else {
+		struct trace_record *rec = &trace_ring[trace_head & TRACE_RING_MASK];
+
+		rec->cycles = k_cycle_get_32();
+		rec->event = event;
+		memcpy(rec->args, args, sizeof(rec->args));
+		trace_head++;
+		trace_stats.written++;
+	}
+	k_spin_unlock(&trace_lock, key);
+}
+
+/**
+ * take the oldest record off the ring
+ **/
+static bool trace_read(struct trace_record *rec) {
+	k_spinlock_key_t key = k_spin_lock(&trace_lock);
+	bool found = trace_tail != trace_head;
+
+	if (found) {
+		*rec = trace_ring[trace_tail & TRACE_RING_MASK];
+		trace_tail++;
+	}
+	k_spin_unlock(&trace_lock, key);
+	return found;
+}
+
+/**
+ * low priority thread formatting the traced events, so the bt rx callback and
+ * the radio scheduler never wait on the console
+ **/
+void trace_thread(void) {
+	struct trace_record rec;
+	uint32_t reported_drops = 0;
+
+	while (1) {
+		while (trace_read(&rec)) {
+			if (rec.event >= TRACE_EVENT_COUNT || trace_formats[rec.event] == NULL) {
+				continue;
+			}
+			printk("[%u] ", k_cyc_to_ms_floor32(rec.cycles));
+			printk(trace_formats[rec.event], rec.args[0], rec.args[1], rec.args[2]);
+			printk("\n");
+		}
+
+		if (trace_stats.dropped != reported_drops) {
+			printk("[trace] %u records dropped\n", trace_stats.dropped - reported_drops);
+			reported_drops = trace_stats.dropped;
+		}
+		k_msleep(CONFIG_NODE_TRACE_FLUSH_MS);
+	}
+}
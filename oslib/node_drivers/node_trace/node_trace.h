@@ -0,0 +1,98 @@
+// Geordie Pearson
+/*
+*************************************************************
+* @file oslib/node_drivers/node_trace/node_trace.h
+* @author Geordie Pearson - 45798232
+* @date 20-05-2022
+* @brief deferred binary trace of node events
+*************************************************************
+*/
+
+#ifndef NODE_TRACE_H
+#define NODE_TRACE_H
+
+#include <zephyr.h>
+
+/* Defines the trace levels, events above CONFIG_NODE_TRACE_LEVEL are compiled out */
+#define TRACE_LEVEL_OFF 0
+#define TRACE_LEVEL_ERR 1
+#define TRACE_LEVEL_INF 2
+#define TRACE_LEVEL_DBG 3
+
+/* Defines thread specfics */
+#define TRACE_STACKSIZE 1024
+#define TRACE_PRIORITY K_LOWEST_APPLICATION_THREAD_PRIO
+
+// arguments carried by each trace record
+#define TRACE_ARGS 3
+
+/**
+ * traced events, formatted with the strings in node_trace.c
+ **/
+enum trace_event {
+	TRACE_RX_MOBILE, // rssi, length
+	TRACE_RX_STATIC, // rssi, length
+	TRACE_RX_AGG, // rssi, reports, hops
+	TRACE_SCAN_START, // error code
+	TRACE_ADV_START, // error code
+	TRACE_ADV_STOP,
+	TRACE_SCAN_EXTEND,
+	TRACE_TO_ADV,
+	TRACE_TO_SCAN, // tdma offset (ms)
+	TRACE_RELAY_ADV_START, // error code
+	TRACE_RELAY_QUEUE, // hops, pending, overflow
+	TRACE_RELAY_STATS, // dropped, seen hits, seen misses
+	TRACE_SCHED_STATS, // windows, jitter avg (us), jitter max (us)
+	TRACE_SCAN_STATS, // callbacks, useful callbacks
+	TRACE_ACCEL_BATCH, // samples, overruns
+	TRACE_DUTY_STATS, // duty level, radio on per hour (s), motion wakes
+	TRACE_HISTORY_STATS, // stored, sent, dropped
+	TRACE_BULK_STATS, // connections, notifications, lost
+	TRACE_CONTACT_STATS, // episodes, sent, dropped
+	TRACE_EVENT_COUNT
+};
+
+/**
+ * fixed size trace record, as kept in the ring
+ **/
+struct trace_record {
+	uint32_t cycles; // hardware cycle count when the event was traced
+	uint8_t event;
+	uint8_t reserved[3];
+	int32_t args[TRACE_ARGS];
+};
+
+/**
+ * trace ring counters
+ **/
+struct trace_stats {
+	uint32_t written; // records put on the ring
+	uint32_t dropped; // records lost because the ring was full
+};
+
+extern struct trace_stats trace_stats;
+
+// Traces an event with up to TRACE_ARGS integer arguments, e.g.
+// TRACE(TRACE_LEVEL_DBG, TRACE_RX_MOBILE, rssi, m_id, seq). Compiles to nothing when
+// the level is above CONFIG_NODE_TRACE_LEVEL.
+#define TRACE(level, event, ...) do { \
+	if (CONFIG_NODE_TRACE_LEVEL >= (level)) { \
+		trace_write((event), (const int32_t[TRACE_ARGS]) { __VA_ARGS__ }); \
+	} \
+} while (0)
+
+#define TRACE_ERR(event, ...) TRACE(TRACE_LEVEL_ERR, event, ##__VA_ARGS__)
+#define TRACE_INF(event, ...) TRACE(TRACE_LEVEL_INF, event, ##__VA_ARGS__)
+#define TRACE_DBG(event, ...) TRACE(TRACE_LEVEL_DBG, event, ##__VA_ARGS__)
+
+// Puts a trace record on the ring, without formatting it. Safe to call from any
+// context. Use the TRACE macros instead so the call is compiled out by level.
+// Parameters:
+// 	- event: The event to trace
+// 	- args: The TRACE_ARGS arguments of the event
+void trace_write(uint8_t event, const int32_t *args);
+
+// Operates as thread opening point to format the traced events on the console
+void trace_thread(void);
+
+#endif
@@ -0,0 +1,197 @@
+#!/usr/bin/env python3
+
+'''
+generate the fixed point tables of the base localisation engine from the zone
+captures z1.json .. z8.json
+
+    ./gen_locate.py > ../../../oslib/base_drivers/base_locate/base_locate_data.h
+
+the path loss tables of the beacons and of the mobile to static link are set by
+the arguments. each zone is cut into chunks of consecutive reports, and the per
+beacon median rssi of each chunk becomes one kNN fingerprint. the accuracy of the
+table on the captures is printed to stderr, using the same integer kNN as the
+firmware. with --holdout the last reports of each zone are kept out of the table
+and tested on separately, as tests/base_locate does with the firmware code.
+'''
+
+import json
+import sys
+import argparse
+
+# must match tracking.py
+BEACON_COORDS = {"A": (4, 8.5), "E": (10.5, 8.5), "F": (14.8, 10.5),
+                 "G": (22, 7.6), "P": (27, 10.5), "Z": (33.2, 12)}
+# static node positions by static id, "static<id>" in tracking.py
+STATIC_COORDS = {1: (7, 8.5), 2: (19.7, 8.3), 3: (26, 9.3), 4: (31, 11)}
+ZONE_COORDS = {1: (5, 8.4), 2: (9, 8.5), 3: (12, 9), 4: (18, 8.5),
+               5: (23, 8.7), 6: (26, 8.6), 7: (29, 8.7), 8: (35, 9.6)}
+
+RSSI_MIN = -110
+RSSI_MAX = -30
+RSSI_MISSING = -100
+BEACONS = 3
+
+
+def load_zone(z):
+    '''beacon rssi dict of each report captured in a zone'''
+    reports = []
+    with open(f'z{z}.json') as f:
+        for line in f:
+            if not line.startswith('{'):
+                continue
+            try:
+                d = json.loads(line.rstrip(), strict=False)
+                reports.append({d[f'b{i}']: d[f'b{i}r'] for i in range(1, BEACONS + 1)})
+            except (ValueError, KeyError):
+                pass
+    return reports
+
+
+def vector(report, beacons):
+    return [report.get(b, RSSI_MISSING) for b in beacons]
+
+
+def median(values):
+    values = sorted(values)
+    return values[len(values) // 2]
+
+
+def fingerprints(reports, beacons, chunks):
+    prints = []
+    size = max(1, len(reports) // chunks)
+    for start in range(0, size * chunks, size):
+        chunk = [vector(r, beacons) for r in reports[start:start + size]]
+        if chunk:
+            prints.append([median(column) for column in zip(*chunk)])
+    return prints
+
+
+def knn(table, v, k):
+    '''same vote as locate_knn: majority of the k nearest, ties to the nearest,
+    and no zone (0) without any fingerprinted beacon'''
+    if all(rssi == RSSI_MISSING for rssi in v):
+        return 0
+    nearest = sorted(table, key=lambda zp: sum((a - b) ** 2 for a, b in zip(v, zp[1])))[:k]
+    votes = {}
+    for zone, _ in nearest:
+        votes[zone] = votes.get(zone, 0) + 1
+    best = max(votes.values())
+    return next(zone for zone, _ in nearest if votes[zone] == best)
+
+
+def dist_table(name, tx_power, n):
+    '''rssi to distance (cm) table of one link'''
+    dist = [min(round(100 * 10 ** ((tx_power - rssi) / (10 * n))), 0xffff) for rssi in range(RSSI_MIN, RSSI_MAX + 1)]
+    out = [f'static const uint16_t {name}[LOCATE_RSSI_MAX - LOCATE_RSSI_MIN + 1] = {{']
+    for i in range(0, len(dist), 10):
+        out.append('\t' + ' '.join(f'{d},' for d in dist[i:i + 10]))
+    out.append('};')
+    return out
+
+
+def main(args):
+    zones = {z: load_zone(z) for z in ZONE_COORDS}
+    counts = {}
+    for reports in zones.values():
+        for r in reports:
+            for b in r:
+                counts[b] = counts.get(b, 0) + 1
+    total = sum(len(r) for r in zones.values())
+    # beacons heard in at least 5% of the reports
+    beacons = sorted(b for b, n in counts.items() if n * 20 >= total and b != '\u0000')
+
+    # the last reports of each zone are held out, as consecutive reports are
+    # too alike to test on reports interleaved with the fingerprinted ones
+    train = {z: reports[:len(reports) - int(len(reports) * args.holdout)] for z, reports in zones.items()}
+    test = {z: reports[len(train[z]):] for z, reports in zones.items()}
+
+    table = [(z, fp) for z, reports in train.items() for fp in fingerprints(reports, beacons, args.chunks)]
+
+    correct = sum(knn(table, vector(r, beacons), args.k) == z for z, reports in train.items() for r in reports)
+    print(f'{len(table)} fingerprints of {len(beacons)} beacons, '
+          f'{correct}/{sum(len(r) for r in train.values())} fingerprinted reports in the right zone', file=sys.stderr)
+    if args.holdout > 0:
+        held = [(z, r, knn(table, vector(r, beacons), args.k)) for z, reports in test.items() for r in reports]
+        print(f'{sum(z == guess for z, _, guess in held)}/{len(held)} held out reports in the right zone',
+              file=sys.stderr)
+        if args.holdout_csv:
+            with open(args.holdout_csv, 'w') as f:
+                f.write('zone,knn_zone' + ''.join(f',b{i},b{i}r' for i in range(1, BEACONS + 1)) + '\n')
+                for z, r, guess in held:
+                    heard = sorted(r.items(), key=lambda br: -br[1])[:BEACONS]
+                    heard += [('', 0)] * (BEACONS - len(heard))
+                    f.write(f'{z},{guess}' + ''.join(f',{ord(b) if b else 0},{rssi}' for b, rssi in heard) + '\n')
+
+    out = []
+    out.append('// Generated by project/base/data/gen_locate.py from the zone captures, do not edit.')
+    out.append('')
+    out.append('#ifndef BASE_LOCATE_DATA_H')
+    out.append('#define BASE_LOCATE_DATA_H')
+    out.append('')
+    out.append('struct locate_point {')
+    out.append('\tchar id; // beacon id, static node id, or zone number')
+    out.append('\tint16_t x; // cm')
+    out.append('\tint16_t y;')
+    out.append('};')
+    out.append('')
+    out.append(f'#define LOCATE_RSSI_MIN {RSSI_MIN}')
+    out.append(f'#define LOCATE_RSSI_MAX {RSSI_MAX}')
+    out.append('')
+    out.append(f'// beacon rssi (dBm) to distance (cm), {args.tx_power} dBm at 1 m, path loss exponent {args.n}')
+    out += dist_table('locate_dist_cm', args.tx_power, args.n)
+    out.append('')
+    out.append(f'// rssi (dBm) of a mobile node heard by a static node to distance (cm), '
+               f'{args.static_tx_power} dBm at 1 m, path loss exponent {args.static_n}')
+    out += dist_table('locate_static_dist_cm', args.static_tx_power, args.static_n)
+    out.append('')
+    out.append('// beacon positions (cm)')
+    out.append('static const struct locate_point locate_anchors[] = {')
+    for b, (x, y) in sorted(BEACON_COORDS.items()):
+        out.append(f"\t{{'{b}', {round(x * 100)}, {round(y * 100)}}},")
+    out.append('};')
+    out.append('')
+    out.append('// static node positions (cm)')
+    out.append('static const struct locate_point locate_static_anchors[] = {')
+    for s, (x, y) in sorted(STATIC_COORDS.items()):
+        out.append(f'\t{{{s}, {round(x * 100)}, {round(y * 100)}}},')
+    out.append('};')
+    out.append('')
+    out.append('// zone centres (cm)')
+    out.append('static const struct locate_point locate_zones[] = {')
+    for z, (x, y) in sorted(ZONE_COORDS.items()):
+        out.append(f'\t{{{z}, {round(x * 100)}, {round(y * 100)}}},')
+    out.append('};')
+    out.append('')
+    out.append(f'#define LOCATE_RSSI_MISSING {RSSI_MISSING}')
+    out.append(f'#define LOCATE_FP_BEACONS {len(beacons)}')
+    out.append(f'static const char locate_fp_beacons[LOCATE_FP_BEACONS] = {{{", ".join(repr(b) for b in beacons)}}};')
+    out.append('')
+    out.append('struct locate_fingerprint {')
+    out.append('\tuint8_t zone;')
+    out.append('\tint8_t rssi[LOCATE_FP_BEACONS]; // rssi of each of locate_fp_beacons')
+    out.append('};')
+    out.append('')
+    out.append('static const struct locate_fingerprint locate_fingerprints[] = {')
+    for z, fp in table:
+        out.append(f'\t{{{z}, {{{", ".join(str(v) for v in fp)}}}}},')
+    out.append('};')
+    out.append('')
+    out.append('#endif')
+    print('\n'.join(out))
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='generate base_locate_data.h')
+    parser.add_argument('-c', '--chunks', type=int, default=16, help='fingerprints per zone')
+    parser.add_argument('-k', type=int, default=3, help='neighbours voting, as CONFIG_BASE_LOCATE_KNN_K')
+    parser.add_argument('--holdout', type=float, default=0,
+                        help='fraction of each zone held out of the fingerprints to test them on')
+    parser.add_argument('--holdout-csv', help='write the held out reports and their kNN zone here')
+    parser.add_argument('--tx-power', type=int, default=-59, help='rssi (dBm) at 1 m')
+    parser.add_argument('--n', type=float, default=4, help='path loss exponent')
+    # the mobile to static link has other antennas and tx power than the
+    # beacons, and is mostly line of sight between nodes at the same height
+    parser.add_argument('--static-tx-power', type=int, default=-55,
+                        help='rssi (dBm) at 1 m of a mobile node heard by a static node')
+    parser.add_argument('--static-n', type=float, default=3, help='path loss exponent of the mobile to static link')
+    main(parser.parse_args())
@@ -4,6 +4,7 @@ import time
 import argparse
 import serial
 import json
+import struct
 
 port = serial.Serial()
 port.port = "/dev/ttyACM0"
@@ -11,6 +12,122 @@ port.port = "/dev/ttyACM0"
 
 shellprompt=b"\r\x1b[1;32mSHELLY>"
 
+# binary records from the base (-b), see oslib/base_drivers/base_output/base_output.c
+RECORD_MOBILE = 1
+RECORD_STATIC = 2
+RECORD_FUSED = 3
+RECORD_POSITION = 4
+RECORD_CONTACT = 5
+RSSI_NONE = 127
+RELAY_TTL = 4 # ttl a static node relays a report it heard with, see node_ble.h
+RECORD_HEADER = struct.Struct("<BbIbbBBHBB")
+POSITION = struct.Struct("<hhBBhh")
+CONTACT = struct.Struct("<BbIBBBH")
+LOCATE_UNKNOWN = -32768
+
+def cobs_decode(frame):
+    out = bytearray()
+    i = 0
+    while i < len(frame):
+        code = frame[i]
+        if code == 0 or i + code > len(frame) + 1:
+            raise ValueError("bad cobs frame")
+        out += frame[i + 1:i + code]
+        i += code
+        if code < 0xff and i < len(frame):
+            out.append(0)
+    return bytes(out)
+
+def crc16_ccitt(data, crc=0xffff):
+    # matches zephyr crc16_ccitt, reflected polynomial 0x1021 without a final xor
+    for byte in data:
+        crc ^= byte
+        for _ in range(8):
+            crc = (crc >> 1) ^ 0x8408 if crc & 1 else crc >> 1
+    return crc
+
+def decode_record(frame):
+    """decodes a binary frame into the same dict as the json lines, or None if it is corrupt"""
+    try:
+        data = cobs_decode(frame)
+    except ValueError:
+        return None
+    if len(data) < CONTACT.size + 2:
+        return None
+    record, crc = data[:-2], struct.unpack("<H", data[-2:])[0]
+    if crc16_ccitt(record) != crc:
+        return None
+
+    if record[0] == RECORD_CONTACT:
+        if len(record) < CONTACT.size:
+            return None
+        _, rssi, uptime, mobile_id, contact_id, episode, dwell = CONTACT.unpack_from(record)
+        return {"mobile_id": mobile_id, "contact_id": contact_id, "episode": episode, "rssi": rssi,
+                "dwell": dwell, "uptime": uptime}
+    if len(record) < RECORD_HEADER.size:
+        return None
+
+    kind, rssi, uptime, static_id, ttl, mobile_id, seq, steps, heading, count = \
+        RECORD_HEADER.unpack_from(record)
+    if len(record) < RECORD_HEADER.size + 2 * count:
+        return None
+
+    d = {}
+    if kind == RECORD_STATIC:
+        d["static_id"] = static_id
+        d["ttl"] = ttl
+        d["hops"] = min(max(RELAY_TTL - ttl + 1, 1), RELAY_TTL)
+        offset = RECORD_HEADER.size + 2 * count
+        if len(record) < offset + 1:
+            return None
+        d["static_rssi"] = None if record[offset] == RSSI_NONE else struct.unpack_from("<b", record, offset)[0]
+    if kind != RECORD_POSITION:
+        d["rssi"] = None if kind == RECORD_FUSED and rssi == RSSI_NONE else rssi
+    d["mobile_id"] = mobile_id
+    d["seq"] = seq
+    for i in range(count):
+        beacon_id, beacon_rssi = struct.unpack_from("<Bb", record, RECORD_HEADER.size + 2 * i)
+        d["b%d" % (i + 1)] = chr(beacon_id)
+        d["b%dr" % (i + 1)] = beacon_rssi
+    d["steps"] = steps
+    d["heading"] = heading
+    d["uptime"] = uptime
+
+    if kind == RECORD_FUSED:
+        offset = RECORD_HEADER.size + 2 * count
+        if len(record) < offset + 1 or len(record) < offset + 1 + 4 * record[offset]:
+            return None
+        d["statics"] = [dict(zip(("static_id", "rssi", "ttl", "static_rssi"),
+                                 struct.unpack_from("<bbbb", record, offset + 1 + 4 * i)))
+                        for i in range(record[offset])]
+        for s in d["statics"]:
+            if s["static_rssi"] == RSSI_NONE:
+                s["static_rssi"] = None
+    elif kind == RECORD_POSITION:
+        offset = RECORD_HEADER.size + 2 * count
+        if len(record) < offset + POSITION.size:
+            return None
+        x, y, anchors, zone, zone_x, zone_y = POSITION.unpack_from(record, offset)
+        unknown = lambda v: None if v == LOCATE_UNKNOWN else v
+        d.update(x=unknown(x), y=unknown(y), anchors=anchors, zone=zone,
+                 zone_x=unknown(zone_x), zone_y=unknown(zone_y))
+    return d
+
+def binary_messages(s):
+    """yields the json messages decoded from the binary frames on the serial port"""
+    buf = bytearray()
+    dropped = 0
+    while 1:
+        buf += s.read(max(1, s.in_waiting))
+        while b"\x00" in buf:
+            frame, _, buf = buf.partition(b"\x00")
+            d = decode_record(bytes(frame))
+            if d is None:
+                dropped += 1
+                print("corrupt frame dropped (%d total)" % dropped)
+                continue
+            yield json.dumps(d)
+
 def publish(client, topic, message):
     client.publish(topic, message)
 
@@ -42,8 +159,13 @@ def main(args):
     client.connect(args.host, args.port)
     time.sleep(2)
     # client.subscribe(args.topic)
+    port.port = args.serial
     with port as s:
             print("serial connected.")
+            if args.binary:
+                for msg in binary_messages(s):
+                    print('publishing:',msg)
+                    publish(client, args.topic, msg)
             while 1:
                 msg = s.readline()#(80).split(b'\n')
                 # data = s.readline()
@@ -66,7 +188,13 @@ if __name__ == "__main__":
     parser.add_argument('-H', action='store', dest='host', required=False, default="localhost")
     parser.add_argument('-p', action='store', dest='port', type=int, required=False, default="1883")
     parser.add_argument('-t', action='store', dest='topic', required=True)
+    parser.add_argument('-b', action='store_true', dest='binary', required=False,
+                        help="decode binary records from a base built with -DBINARY_OUTPUT=ON")
+    parser.add_argument('-s', action='store', dest='serial', required=False, default=None,
+                        help="serial port, /dev/ttyACM0 for json lines or /dev/ttyACM1 for binary records")
     args = parser.parse_args()
+    if args.serial is None:
+        args.serial = "/dev/ttyACM1" if args.binary else "/dev/ttyACM0"
 
     main(args)
 
@@ -76,4 +76,4 @@ void main(void)
 
 K_THREAD_DEFINE(ble_base, THREAD_BLE_BASE_STACK, thread_ble_base, NULL, NULL, NULL, THREAD_PRIORITY_BLE_BASE, 0, 0);
 // K_THREAD_DEFINE(ble_led, THREAD_BLE_LED_STACK, thread_ble_led, NULL, NULL, NULL, THREAD_PRIORITY_BLE_LED, 0, 0);
-// K_THREAD_DEFINE(ble_json_sampling, THREAD_BLE_JSON_STACK, thread_ble_json_output, NULL, NULL, NULL, THREAD_PRIORITY_JSON_SAMPLING, 0, 0);
+K_THREAD_DEFINE(ble_json_sampling, THREAD_BLE_JSON_STACK, thread_ble_json_output, NULL, NULL, NULL, THREAD_PRIORITY_JSON_SAMPLING, 0, 0);
@@ -14,14 +14,32 @@
 
 #include "node_sensors.h"
 #include "node_ble.h"
+#include "node_trace.h"
+#if MOBILE_NODE == 1
+#include "node_heading.h"
+#include "node_bulk.h"
+#endif
 
 #if MOBILE_NODE == 1
 K_THREAD_DEFINE(handle_sensor_id, SENSORS_STACKSIZE, handle_sensor_mobile,
 		NULL, NULL, NULL,
 		SENSORS_PRIORITY, 0, 0);
 K_THREAD_DEFINE(handle_bt_id, 2048, handle_bt_mobile, NULL, NULL, NULL, 8, 0, 0);
+#ifdef CONFIG_NODE_HEADING
+K_THREAD_DEFINE(handle_heading_id, HEADING_STACKSIZE, handle_heading_mobile,
+		NULL, NULL, NULL,
+		HEADING_PRIORITY, 0, 0);
+#endif
+#ifdef CONFIG_NODE_BULK
+K_THREAD_DEFINE(handle_bulk_id, BULK_STACKSIZE, handle_bulk_mobile,
+		NULL, NULL, NULL,
+		BULK_PRIORITY, 0, 0);
+#endif
 // K_THREAD_DEFINE
 #else
 // K_THREAD_DEFINE(handle_bt_id, 2048, handle_bt_mobile, NULL, NULL, NULL,8, 0, 0);
 K_THREAD_DEFINE(handle_bt_id, 2048, handle_bt_static, NULL, NULL, NULL,8, 0, 0);
 #endif
+
+// formats traced events at the lowest priority, after the radio and sensor threads
+K_THREAD_DEFINE(trace_id, TRACE_STACKSIZE, trace_thread, NULL, NULL, NULL, TRACE_PRIORITY, 0, 0);
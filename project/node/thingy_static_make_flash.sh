@@ -1,10 +1,7 @@
-if [[ $# -eq 1 ]] ; then
-  echo "building with Mobile ID $1"
-  sed -i "s/M_ID=./M_ID=$1/" CMakeLists.txt
-else
-  echo "building with Mobile ID 5"
-  sed -i "s/M_ID=./M_ID=5/" CMakeLists.txt
+if [[ $# -ne 1 ]] ; then
+  echo "usage: $0 <static id>"
+  exit 1
 fi
+echo "building with Static ID $1"
 
-west build -p auto -b thingy52_nrf52832  && west flash -r jlink
-
+west build -p auto -b thingy52_nrf52832 -- -DNODE_ID=$1 && west flash -r jlink
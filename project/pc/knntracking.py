@@ -52,6 +52,11 @@ beacon_coords = { "A" : (4, 8.5),
                   "base"    : (13.5, 7.5)
           }
 
+# clockwise angle (degrees) of magnetic north from the top of the map
+MAP_NORTH = 0
+# last step count of each mobile node
+step_counts = {}
+
 mobile_loc_1 = None
 mobile_coords_1 = [13.5, 7.5]
 mobile_coords_1_knn = [20, 8]
@@ -186,17 +191,21 @@ def compute_multilat(rssi_ids, rssi_values):
     #print(np.linalg.lstsq(A, b, rcond=None))
     return np.linalg.lstsq(A, b, rcond=None)
     
-def step_to_coordinate(coordinate, step, direction):
-    final_coords = coordinate
-
-    if direction == 0:
-        final_coords = (coordinate[0], coordinate[1] + (1.2 * step))
-    elif direction == 1:
-        final_coords = (coordinate[0] + (1.2 * step), coordinate[1])
-    elif direction == 2:
-        final_coords = (coordinate[0], coordinate[1] - (1.2 * step))
-    elif direction == 3:
-        final_coords = (coordinate[0] - (1.2 * step), coordinate[1])
+def steps_since_last(mobile_id, count):
+    """steps taken since the last message of a mobile node, from its wrapping 16 bit step count"""
+    last = step_counts.get(mobile_id, count)
+    delta = (count - last) & 0xffff
+    if delta >= 0x8000:
+        # a late copy of an older report
+        return 0
+    step_counts[mobile_id] = count
+    return delta
+
+def step_to_coordinate(coordinate, step, heading):
+    # heading is in 1/256 of a turn clockwise from north, north being MAP_NORTH on the map
+    angle = 2 * math.pi * heading / 256 + math.radians(MAP_NORTH)
+    final_coords = (coordinate[0] + (1.2 * step) * math.sin(angle),
+                    coordinate[1] + (1.2 * step) * math.cos(angle))
 
     return final_coords
 
@@ -223,6 +232,9 @@ def on_message(client, userdata, message):
 
     line = message.payload.decode().strip()
     d = json.loads(line, strict=False)
+    if "contact_id" in d:
+        # contact episodes are reported by tracking.py
+        return
    
     new_coords = (0, 0)
     rssi_ids = []
@@ -230,10 +242,10 @@ def on_message(client, userdata, message):
     for i in range(1,4):
         rssi_ids.append(d["b" + str(i)])
         rssi_values.append(float(d["b" + str(i) + "r"]))
-    steps = int(d["speed"])
-    direction = int(d["direction"])
+    steps = steps_since_last(d["mobile_id"], int(d["steps"]))
+    heading = int(d["heading"])
     #print(steps)
-    #print(direction)
+    #print(heading)
 
     multilat = compute_multilat(rssi_ids, rssi_values)
     knn_res = compute_knn(rssi_ids, rssi_values)[0]
@@ -260,19 +272,19 @@ def on_message(client, userdata, message):
             dif = math.sqrt(((new_coords[0] - mobile_coords_1[0]) ** 2 +
                 (new_coords[1] - mobile_coords_1[1]) ** 2))
             """if dif > 2:
-                final_coords = step_to_coordinate(mobile_coords_1, steps, direction)
+                final_coords = step_to_coordinate(mobile_coords_1, steps, heading)
             else:
-                final_coords = step_to_coordinate(new_coords, steps, direction)"""
-            final_coords = step_to_coordinate(new_coords, steps, direction)
+                final_coords = step_to_coordinate(new_coords, steps, heading)"""
+            final_coords = step_to_coordinate(new_coords, steps, heading)
             mobile_coords_1 = final_coords
         else:
             dif = math.sqrt(((new_coords[0] - mobile_coords_2[0]) ** 2 +
                 (new_coords[1] - mobile_coords_2[1]) ** 2))
             """if dif > 2:
-                final_coords = step_to_coordinate(mobile_coords_2, steps, direction)
+                final_coords = step_to_coordinate(mobile_coords_2, steps, heading)
             else:
-                final_coords = step_to_coordinate(new_coords, steps, direction)"""
-            final_coords = step_to_coordinate(new_coords, steps, direction)
+                final_coords = step_to_coordinate(new_coords, steps, heading)"""
+            final_coords = step_to_coordinate(new_coords, steps, heading)
             mobile_coords_2  = final_coords
         
         if int(d["mobile_id"]) == 1:
@@ -52,6 +52,11 @@ beacon_coords = { "A" : (4, 8.5),
                   "base"    : (13.5, 7.5)
           }
 
+# clockwise angle (degrees) of magnetic north from the top of the map
+MAP_NORTH = 0
+# last step count of each mobile node
+step_counts = {}
+
 mobile_loc_1 = None
 mobile_coords_1 = [13.5, 7.5]
 mobile_coords_1_knn = [20, 8]
@@ -64,6 +69,11 @@ ax = None
 family = [[0], [0]]
 same = 0
 
+# path loss of a mobile node heard by a static node, must match --static-tx-power
+# and --static-n of project/base/data/gen_locate.py
+STATIC_MP = -55
+STATIC_N = 3
+
 """ Function that converts a RSSI value to a distance based on -59 at 1m.
 """
 def dist_to_rssi(rssi, mp=-59, N=4):
@@ -159,44 +169,59 @@ def draw_points(coordinates, mobile_id, knn=False):
     plt.pause(0.01)
     return point
 
+def static_ranges(d):
+    """(id, rssi) of the static nodes that heard the mobile node directly, so they
+    range it from their position in beacon_coords like beacons"""
+    if "statics" in d:
+        relays = d["statics"]
+    elif "static_id" in d:
+        relays = [d]
+    else:
+        relays = []
+    return [("static%d" % s["static_id"], float(s["static_rssi"]))
+            for s in relays if s.get("static_rssi") is not None]
+
 def compute_multilat(rssi_ids, rssi_values):
 
     distances = []
     positions = []
 
-    for value in rssi_values:
-        distances.append(dist_to_rssi(value))
-    #print(distances)
-    
-    for bt_id in rssi_ids:
+    # only the anchors with a known position, keeping each distance with its anchor
+    for bt_id, value in zip(rssi_ids, rssi_values):
         if bt_id in beacon_coords:
             positions.append(beacon_coords[bt_id])
+            if bt_id.startswith("static"):
+                distances.append(dist_to_rssi(value, STATIC_MP, STATIC_N))
+            else:
+                distances.append(dist_to_rssi(value))
     #print(positions)
 
     if len(positions) < 3:
         return (-1, -1);
 
-    A_x = np.array([2 * (positions[2][0] - positions[0][0]), 2 * (positions[2][0] - positions[1][0])])
-    A_y = np.array([2 * (positions[2][1] - positions[0][1]), 2 * (positions[2][1] - positions[1][1])])
-    A = np.vstack([A_x, A_y]).T
-    
-    b = np.array([distances[0]**2 - distances[2]**2 - positions[0][0]**2 - positions[0][1]**2 + positions[2][0]**2 + positions[2][1]**2, 
-                  distances[1]**2 - distances[2]**2 - positions[1][0]**2 - positions[1][1]**2 + positions[2][0]**2 + positions[2][1]**2, 
-                ])
+    # subtracting the circle of the last anchor leaves one linear equation per other anchor
+    last = len(positions) - 1
+    A = np.array([[2 * (positions[last][0] - p[0]), 2 * (positions[last][1] - p[1])] for p in positions[:last]])
+    b = np.array([distances[i]**2 - distances[last]**2 - positions[i][0]**2 - positions[i][1]**2 +
+                  positions[last][0]**2 + positions[last][1]**2 for i in range(last)])
     #print(np.linalg.lstsq(A, b, rcond=None))
     return np.linalg.lstsq(A, b, rcond=None)
     
-def step_to_coordinate(coordinate, step, direction):
-    final_coords = coordinate
-
-    if direction == 0:
-        final_coords = (coordinate[0], coordinate[1] + (1.2 * step))
-    elif direction == 1:
-        final_coords = (coordinate[0] + (1.2 * step), coordinate[1])
-    elif direction == 2:
-        final_coords = (coordinate[0], coordinate[1] - (1.2 * step))
-    elif direction == 3:
-        final_coords = (coordinate[0] - (1.2 * step), coordinate[1])
+def steps_since_last(mobile_id, count):
+    """steps taken since the last message of a mobile node, from its wrapping 16 bit step count"""
+    last = step_counts.get(mobile_id, count)
+    delta = (count - last) & 0xffff
+    if delta >= 0x8000:
+        # a late copy of an older report
+        return 0
+    step_counts[mobile_id] = count
+    return delta
+
+def step_to_coordinate(coordinate, step, heading):
+    # heading is in 1/256 of a turn clockwise from north, north being MAP_NORTH on the map
+    angle = 2 * math.pi * heading / 256 + math.radians(MAP_NORTH)
+    final_coords = (coordinate[0] + (1.2 * step) * math.sin(angle),
+                    coordinate[1] + (1.2 * step) * math.cos(angle))
 
     return final_coords
 
@@ -213,6 +238,12 @@ def compute_knn(rssi_ids, rssi_values):
     return pred
 
 
+def report_contact(d):
+    """contact episode measured by a mobile node itself (CONFIG_NODE_CONTACT), so it
+    does not depend on the positions being up to date"""
+    print("COVID BAD (contact) mobile %d with %d for %d s, rssi %d, started at %d ms" %
+          (d["mobile_id"], d["contact_id"], d["dwell"], d["rssi"], d["uptime"]), datetime.datetime.now())
+
 def on_message(client, userdata, message):
     global mobile_loc_1,mobile_loc_1_knn
     global mobile_loc_2,mobile_loc_2_knn
@@ -223,6 +254,9 @@ def on_message(client, userdata, message):
 
     line = message.payload.decode().strip()
     d = json.loads(line, strict=False)
+    if "contact_id" in d:
+        report_contact(d)
+        return
    
     new_coords = (0, 0)
     rssi_ids = []
@@ -230,21 +264,32 @@ def on_message(client, userdata, message):
     for i in range(1,4):
         rssi_ids.append(d["b" + str(i)])
         rssi_values.append(float(d["b" + str(i) + "r"]))
-    steps = int(d["speed"])
-    direction = int(d["direction"])
+    steps = steps_since_last(d["mobile_id"], int(d["steps"]))
+    heading = int(d["heading"])
     #print(steps)
-    #print(direction)
+    #print(heading)
 
-    multilat = compute_multilat(rssi_ids, rssi_values)
-    knn_res = compute_knn(rssi_ids, rssi_values)[0]
-    # print('knn res:',knn_res)
-    try:
-        new_coords = (multilat[0][0], multilat[3][1])
-    except TypeError as e:
-        new_coords = (-1,-1)
+    if "zone" in d:
+        # position estimated by the base (CONFIG_BASE_LOCATE), in cm
+        if d["x"] is not None and d["y"] is not None:
+            new_coords = (d["x"] / 100, d["y"] / 100)
+        else:
+            new_coords = (-1, -1)
+        knn_res = d["zone"]
+    else:
+        anchors = static_ranges(d)
+        multilat = compute_multilat(rssi_ids + [a[0] for a in anchors], rssi_values + [a[1] for a in anchors])
+        knn_res = compute_knn(rssi_ids, rssi_values)[0]
+        # print('knn res:',knn_res)
+        try:
+            new_coords = (multilat[0][0], multilat[0][1])
+        except TypeError as e:
+            new_coords = (-1,-1)
 
     # knn updates regardless of accel
-    if d["mobile_id"] == 1:
+    if knn_res not in knn_zone_coords:
+        pass
+    elif d["mobile_id"] == 1:
         if mobile_coords_1_knn != knn_zone_coords[knn_res]:
             mobile_loc_1_knn = draw_points(knn_zone_coords[knn_res], 1, knn=True)
             mobile_coords_1_knn = knn_zone_coords[knn_res] 
@@ -260,19 +305,19 @@ def on_message(client, userdata, message):
             dif = math.sqrt(((new_coords[0] - mobile_coords_1[0]) ** 2 +
                 (new_coords[1] - mobile_coords_1[1]) ** 2))
             """if dif > 2:
-                final_coords = step_to_coordinate(mobile_coords_1, steps, direction)
+                final_coords = step_to_coordinate(mobile_coords_1, steps, heading)
             else:
-                final_coords = step_to_coordinate(new_coords, steps, direction)"""
-            final_coords = step_to_coordinate(new_coords, steps, direction)
+                final_coords = step_to_coordinate(new_coords, steps, heading)"""
+            final_coords = step_to_coordinate(new_coords, steps, heading)
             mobile_coords_1 = final_coords
         else:
             dif = math.sqrt(((new_coords[0] - mobile_coords_2[0]) ** 2 +
                 (new_coords[1] - mobile_coords_2[1]) ** 2))
             """if dif > 2:
-                final_coords = step_to_coordinate(mobile_coords_2, steps, direction)
+                final_coords = step_to_coordinate(mobile_coords_2, steps, heading)
             else:
-                final_coords = step_to_coordinate(new_coords, steps, direction)"""
-            final_coords = step_to_coordinate(new_coords, steps, direction)
+                final_coords = step_to_coordinate(new_coords, steps, heading)"""
+            final_coords = step_to_coordinate(new_coords, steps, heading)
             mobile_coords_2  = final_coords
         
         if int(d["mobile_id"]) == 1:
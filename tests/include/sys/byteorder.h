@@ -0,0 +1,8 @@
+/*
+ * Empty host stub, the headers under test include it but use nothing from it.
+ */
+
+#ifndef TESTS_SYS_BYTEORDER_H
+#define TESTS_SYS_BYTEORDER_H
+
+#endif
@@ -0,0 +1,26 @@
+/*
+ * Host stub of the parts of zephyr.h used by the drivers under test.
+ */
+
+#ifndef TESTS_ZEPHYR_H
+#define TESTS_ZEPHYR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+#define CLAMP(val, low, high) (((val) <= (low)) ? (low) : MIN(val, high))
+#define ARRAY_SIZE(array) (sizeof(array) / sizeof((array)[0]))
+#define BUILD_ASSERT(expr, msg) _Static_assert(expr, msg)
+#define __packed __attribute__((__packed__))
+
+/* 1 if the option is defined to 1, otherwise 0, as in sys/util_macro.h */
+#define IS_ENABLED(config_macro) Z_IS_ENABLED1(config_macro)
+#define Z_IS_ENABLED1(config_macro) Z_IS_ENABLED2(_XXXX##config_macro)
+#define _XXXX1 _YYYY,
+#define Z_IS_ENABLED2(one_or_two_args) Z_IS_ENABLED3(one_or_two_args 1, 0)
+#define Z_IS_ENABLED3(ignore_this, val, ...) val
+
+#endif
@@ -0,0 +1,212 @@
+// Geordie Pearson
+/*
+*************************************************************
+* @file tests/node_steps/main.c
+* @author Geordie Pearson - 45798232
+* @date 20-05-2022
+* @brief host test of the step detector on synthetic accelerometer traces
+*************************************************************
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "node_steps.h"
+
+#define ODR CONFIG_NODE_ACCEL_ODR_HZ
+#define BATCH CONFIG_NODE_ACCEL_FIFO_WATERMARK
+#define TRACE_MAX (120 * ODR)
+#define STEPS_MAX 512
+
+// counted steps may be off by this many percent, or 2 steps on short traces
+#define COUNT_TOLERANCE_PCT 5
+// a detection this close to a true step matches it
+#define MATCH_MS 250
+
+/**
+ * walking segment of a synthetic trace, cadence 0 for standing still
+ **/
+struct segment {
+	float seconds;
+	float cadence; // steps/s
+	float amplitude; // vertical acceleration swing (mg)
+};
+
+struct trace {
+	const char *name;
+	struct segment segments[4];
+};
+
+static const struct trace traces[] = {
+	{"slow walk", {{60, 1.4f, 150}}},
+	{"walk", {{60, 1.9f, 250}}},
+	{"fast walk", {{60, 2.4f, 400}}},
+	{"run", {{40, 2.9f, 800}}},
+	{"standing", {{40, 0, 0}}},
+	{"walk stop walk", {{20, 1.9f, 250}, {20, 0, 0}, {20, 2.1f, 300}}},
+};
+
+static struct accel_sample samples[TRACE_MAX];
+static float step_times[STEPS_MAX];
+static float detect_times[STEPS_MAX];
+
+static uint32_t rng_state = 1;
+
+/**
+ * uniform in [0, 1), deterministic across hosts
+ **/
+static float rng_uniform(void) {
+	rng_state = rng_state * 1664525u + 1013904223u;
+	return (rng_state >> 8) / 16777216.0f;
+}
+
+static float rng_gauss(void) {
+	float u1 = rng_uniform() + 1e-7f;
+	float u2 = rng_uniform();
+
+	return sqrtf(-2 * logf(u1)) * cosf(2 * (float) M_PI * u2);
+}
+
+/**
+ * synthesises a trace: gravity along a tilted axis, a heel strike bump per step
+ * along it with a 5% step to step jitter, a sideways sway at half the cadence,
+ * and 15 mg of sensor noise
+ * Returns:
+ * 	the number of samples, the true step times in step_times
+ **/
+static int trace_build(const struct trace *t, int *steps) {
+	const float gx = 0.20f, gy = 0.35f, gz = 0.915f; // unit gravity axis
+	int n = 0;
+	float phase = 0, period = 0;
+
+	*steps = 0;
+	for (int s = 0; s < 4 && t->segments[s].seconds > 0; s++) {
+		const struct segment *seg = &t->segments[s];
+		int end = n + seg->seconds * ODR;
+
+		phase = 0;
+		period = seg->cadence > 0 ? 1 / seg->cadence : 0;
+		for (; n < end && n < TRACE_MAX; n++) {
+			float v = 0, sway = 0;
+
+			if (seg->cadence > 0) {
+				float next = phase + 1.0f / (ODR * period);
+
+				// the bump peaks a quarter of the way into each step
+				if (((phase < 0.25f && next >= 0.25f) || next >= 1.25f) && *steps < STEPS_MAX) {
+					step_times[(*steps)++] = (float) n / ODR;
+				}
+				if (next >= 1) {
+					next -= 1;
+					period = (1 + 0.1f * (rng_uniform() - 0.5f)) / seg->cadence;
+				}
+				phase = next;
+				v = seg->amplitude * (0.8f * sinf(2 * (float) M_PI * phase) +
+						0.2f * sinf(4 * (float) M_PI * phase + 1.0f));
+				sway = 0.2f * seg->amplitude * sinf((float) M_PI * (*steps + phase));
+			}
+			samples[n].x = lrintf((1000 + v) * gx + sway * 0.87f + 15 * rng_gauss());
+			samples[n].y = lrintf((1000 + v) * gy - sway * 0.49f + 15 * rng_gauss());
+			samples[n].z = lrintf((1000 + v) * gz + 15 * rng_gauss());
+		}
+	}
+	return n;
+}
+
+static uint64_t cycles_now(void) {
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+/**
+ * matches each detection to the nearest unmatched true step within MATCH_MS
+ * Returns:
+ * 	the number of matched detections
+ **/
+static int match_steps(int steps, int detections) {
+	bool used[STEPS_MAX] = {false};
+	int matched = 0;
+
+	for (int d = 0; d < detections; d++) {
+		int best = -1;
+
+		for (int s = 0; s < steps; s++) {
+			float dt = fabsf(detect_times[d] - step_times[s]);
+
+			if (!used[s] && dt * 1000 <= MATCH_MS &&
+					(best < 0 || dt < fabsf(detect_times[d] - step_times[best]))) {
+				best = s;
+			}
+		}
+		if (best >= 0) {
+			used[best] = true;
+			matched++;
+		}
+	}
+	return matched;
+}
+
+int main(void) {
+	int failures = 0;
+	uint64_t cycles = 0;
+	long processed = 0;
+	int total_steps = 0, total_detected = 0, total_matched = 0;
+
+	printf("step detector at %d Hz, batches of %d\n", ODR, BATCH);
+	for (int t = 0; t < (int) ARRAY_SIZE(traces); t++) {
+		struct step_detector sd;
+		int steps, detected = 0, detections = 0, matched, tolerance;
+		int n = trace_build(&traces[t], &steps);
+		uint64_t start;
+
+		// batches as drained from the FIFO, timed
+		step_detector_init(&sd);
+		start = cycles_now();
+		for (int i = 0; i < n; i += BATCH) {
+			detected += step_detector_process(&sd, &samples[i], MIN(BATCH, n - i));
+		}
+		cycles += cycles_now() - start;
+		processed += n;
+
+		// the detector is streaming, so one sample at a time dates each step
+		// and must count the same
+		step_detector_init(&sd);
+		for (int i = 0; i < n; i++) {
+			if (step_detector_process(&sd, &samples[i], 1) && detections < STEPS_MAX) {
+				// the peak is found on the sample after it
+				detect_times[detections++] = (float) (i - 1) / ODR;
+			}
+		}
+		matched = match_steps(steps, detections);
+
+		tolerance = MAX(steps * COUNT_TOLERANCE_PCT / 100, 2);
+		printf("%-16s %3d steps, counted %3d, %3d within %d ms, %s\n", traces[t].name, steps, detected,
+			matched, MATCH_MS, abs(detected - steps) <= tolerance && detections == detected ? "ok" : "FAIL");
+		if (abs(detected - steps) > tolerance || detections != detected) {
+			failures++;
+		}
+		total_steps += steps;
+		total_detected += detected;
+		total_matched += matched;
+	}
+
+	printf("recall %.1f%% precision %.1f%%\n", 100.0 * total_matched / total_steps,
+		total_detected ? 100.0 * total_matched / total_detected : 0.0);
+#if defined(__x86_64__) || defined(__i386__)
+	printf("%.1f host cycles per sample\n", (double) cycles / processed);
+#else
+	printf("%.1f host ns per sample\n", (double) cycles / processed);
+#endif
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}